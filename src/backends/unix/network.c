@@ -24,11 +24,16 @@
  * =======================================================================
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+ #define _GNU_SOURCE
+#endif
+
 #include "../../common/header/common.h"
 
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/select.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <sys/param.h>
@@ -44,12 +49,25 @@
 #include <arpa/inet.h>
 #include <net/if.h>
 
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__)
+ #define HAVE_MMSG
+#endif
+
+#if defined(__linux__)
+ #include <sys/prctl.h>
+#endif
+
 netadr_t net_local_adr;
 
 #define LOOPBACK 0x7f000001
 #define MAX_LOOPBACK 4
 #define QUAKE2MCAST "ff12::666"
 
+/* Server packets are received and sent in batches of
+   up to NET_BATCH datagrams per recvmmsg/sendmmsg call. */
+#define NET_BATCH 16
+#define NET_SENDPOOL 0x20000
+
 typedef struct
 {
 	byte data[MAX_MSGLEN];
@@ -68,6 +86,51 @@ int ip6_sockets[2];
 int ipx_sockets[2];
 char *multicast_interface = NULL;
 
+static cvar_t *net_batch;
+
+/* Ring of datagrams drained from the server sockets */
+typedef struct
+{
+	byte data[NET_BATCH][MAX_MSGLEN];
+	int datalen[NET_BATCH];
+	qboolean truncated[NET_BATCH];
+	struct sockaddr_storage from[NET_BATCH];
+	int count, get;
+	int protocol;
+} netrecvring_t;
+
+/* Server datagrams queued until the next NET_Flush */
+typedef struct
+{
+	byte pool[NET_SENDPOOL];
+	int poolsize;
+	struct
+	{
+		int socket;
+		struct sockaddr_storage addr;
+		int addrlen;
+		int offset;
+		int length;
+	} msgs[NET_BATCH];
+	int count;
+} netsendqueue_t;
+
+/* Packets per syscall counters, shown by net_stats */
+typedef struct
+{
+	unsigned long long recv_packets;
+	unsigned long long recv_calls;
+	unsigned long long send_packets;
+	unsigned long long send_calls;
+} netstats_t;
+
+#ifdef HAVE_MMSG
+static netrecvring_t net_recvring;
+static netsendqueue_t net_sendqueue;
+#endif
+static netstats_t net_stats;
+static qboolean net_mmsg_missing;
+
 static int NET_Socket(const char *net_interface, int port, netsrc_t type, int family);
 static const char *NET_ErrorString(void);
 
@@ -188,10 +251,42 @@ SockadrToNetadr(struct sockaddr_storage *s, netadr_t *a)
 	}
 }
 
+static void
+NET_Stats_f(void)
+{
+	Com_Printf("batching: %s\n", (net_batch->value && !net_mmsg_missing) ?
+			"enabled" : "disabled");
+	Com_Printf("received: %llu packets in %llu calls (%.2f per call)\n",
+			net_stats.recv_packets, net_stats.recv_calls,
+			net_stats.recv_calls ?
+				(double)net_stats.recv_packets / net_stats.recv_calls : 0.0);
+	Com_Printf("sent:     %llu packets in %llu calls (%.2f per call)\n",
+			net_stats.send_packets, net_stats.send_calls,
+			net_stats.send_calls ?
+				(double)net_stats.send_packets / net_stats.send_calls : 0.0);
+
+	if ((Cmd_Argc() > 1) && !strcmp(Cmd_Argv(1), "reset"))
+	{
+		memset(&net_stats, 0, sizeof(net_stats));
+	}
+}
+
 void
 NET_Init()
 {
+	net_batch = Cvar_Get("net_batch", "1", 0);
+
+	Cmd_AddCommand("net_stats", NET_Stats_f);
+}
+
+#ifdef HAVE_MMSG
+static qboolean
+NET_BatchEnabled(netsrc_t sock)
+{
+	return (sock == NS_SERVER) && net_batch && net_batch->value &&
+		!net_mmsg_missing;
 }
+#endif
 
 qboolean
 NET_CompareAdr(netadr_t a, netadr_t b)
@@ -515,6 +610,145 @@ NET_SendLoopPacket(netsrc_t sock, int length, const void *data, netadr_t to)
 	loop->msgs[i].datalen = length;
 }
 
+static int
+NET_ProtocolSocket(netsrc_t sock, int protocol)
+{
+	if (protocol == 0)
+	{
+		return ip_sockets[sock];
+	}
+	else if (protocol == 1)
+	{
+		return ip6_sockets[sock];
+	}
+
+	return ipx_sockets[sock];
+}
+
+#ifdef HAVE_MMSG
+/*
+ * Refills the receive ring with one recvmmsg call on
+ * the given socket. Returns the number of datagrams
+ * read, 0 if the socket is drained and -1 if the
+ * batched calls aren't available.
+ */
+static int
+NET_FillRecvRing(int net_socket)
+{
+	struct mmsghdr msgs[NET_BATCH];
+	struct iovec iov[NET_BATCH];
+	int i, ret;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < NET_BATCH; i++)
+	{
+		iov[i].iov_base = net_recvring.data[i];
+		iov[i].iov_len = sizeof(net_recvring.data[i]);
+
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &net_recvring.from[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(net_recvring.from[i]);
+	}
+
+	ret = recvmmsg(net_socket, msgs, NET_BATCH, MSG_DONTWAIT, NULL);
+
+	if (ret == -1)
+	{
+		int err = errno;
+
+		if (err == ENOSYS)
+		{
+			Com_Printf("%s: recvmmsg not available, batching disabled\n",
+					__func__);
+			net_mmsg_missing = true;
+			return -1;
+		}
+
+		if ((err != EWOULDBLOCK) && (err != ECONNREFUSED))
+		{
+			Com_Printf("%s: %s\n", __func__, NET_ErrorString());
+		}
+
+		return 0;
+	}
+
+	net_stats.recv_calls++;
+	net_stats.recv_packets += ret;
+
+	for (i = 0; i < ret; i++)
+	{
+		net_recvring.datalen[i] = msgs[i].msg_len;
+		net_recvring.truncated[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+	}
+
+	net_recvring.count = ret;
+	net_recvring.get = 0;
+
+	return ret;
+}
+
+/*
+ * Hands out the next datagram from the receive ring,
+ * refilling it socket by socket. Once all sockets are
+ * drained false is returned and the next call starts
+ * over with the first socket.
+ */
+static qboolean
+NET_GetBatchedPacket(netadr_t *net_from, sizebuf_t *net_message)
+{
+	int net_socket, ret, i;
+
+	while (true)
+	{
+		while (net_recvring.get < net_recvring.count)
+		{
+			i = net_recvring.get++;
+
+			SockadrToNetadr(&net_recvring.from[i], net_from);
+
+			if (net_recvring.truncated[i] ||
+				(net_recvring.datalen[i] >= net_message->maxsize))
+			{
+				Com_Printf("Oversize packet from %s\n", NET_AdrToString(*net_from));
+				continue;
+			}
+
+			memcpy(net_message->data, net_recvring.data[i], net_recvring.datalen[i]);
+			net_message->cursize = net_recvring.datalen[i];
+			return true;
+		}
+
+		if (net_recvring.protocol >= 3)
+		{
+			net_recvring.protocol = 0;
+			return false;
+		}
+
+		net_socket = NET_ProtocolSocket(NS_SERVER, net_recvring.protocol);
+		ret = 0;
+
+		if (net_socket)
+		{
+			ret = NET_FillRecvRing(net_socket);
+
+			if (ret < 0)
+			{
+				net_recvring.protocol = 0;
+				return false;
+			}
+		}
+
+		/* a short read means the socket is drained */
+		if (ret < NET_BATCH)
+		{
+			net_recvring.protocol++;
+		}
+	}
+}
+#endif
+
 qboolean
 NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 {
@@ -530,20 +764,16 @@ NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 		return true;
 	}
 
+#ifdef HAVE_MMSG
+	if (NET_BatchEnabled(sock))
+	{
+		return NET_GetBatchedPacket(net_from, net_message);
+	}
+#endif
+
 	for (protocol = 0; protocol < 3; protocol++)
 	{
-		if (protocol == 0)
-		{
-			net_socket = ip_sockets[sock];
-		}
-		else if (protocol == 1)
-		{
-			net_socket = ip6_sockets[sock];
-		}
-		else
-		{
-			net_socket = ipx_sockets[sock];
-		}
+		net_socket = NET_ProtocolSocket(sock, protocol);
 
 		if (!net_socket)
 		{
@@ -556,6 +786,7 @@ NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 				0, (struct sockaddr *)&from, &fromlen);
 
 		SockadrToNetadr(&from, net_from);
+		net_stats.recv_calls++;
 
 		if (ret == -1)
 		{
@@ -577,6 +808,7 @@ NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 			continue;
 		}
 
+		net_stats.recv_packets++;
 		net_message->cursize = ret;
 		return true;
 	}
@@ -584,6 +816,129 @@ NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 	return false;
 }
 
+#ifdef HAVE_MMSG
+/*
+ * Sends the queued datagrams in as few sendmmsg calls
+ * as possible. Consecutive datagrams for the same
+ * socket share one call, so the queue order is kept.
+ */
+static void
+NET_FlushSendQueue(void)
+{
+	struct mmsghdr msgs[NET_BATCH];
+	struct iovec iov[NET_BATCH];
+	int first, last, i;
+
+	for (first = 0; first < net_sendqueue.count; first = last)
+	{
+		int net_socket = net_sendqueue.msgs[first].socket;
+		int num, sent;
+
+		for (last = first; last < net_sendqueue.count; last++)
+		{
+			if (net_sendqueue.msgs[last].socket != net_socket)
+			{
+				break;
+			}
+		}
+
+		num = last - first;
+		memset(msgs, 0, sizeof(msgs));
+
+		for (i = 0; i < num; i++)
+		{
+			iov[i].iov_base = net_sendqueue.pool + net_sendqueue.msgs[first + i].offset;
+			iov[i].iov_len = net_sendqueue.msgs[first + i].length;
+
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &net_sendqueue.msgs[first + i].addr;
+			msgs[i].msg_hdr.msg_namelen = net_sendqueue.msgs[first + i].addrlen;
+		}
+
+		for (sent = 0; sent < num; )
+		{
+			netadr_t to;
+			int ret;
+
+			if (net_mmsg_missing)
+			{
+				/* fallback, one datagram per call */
+				ret = sendto(net_socket, iov[sent].iov_base, iov[sent].iov_len, 0,
+						msgs[sent].msg_hdr.msg_name, msgs[sent].msg_hdr.msg_namelen);
+				ret = (ret == -1) ? -1 : 1;
+			}
+			else
+			{
+				ret = sendmmsg(net_socket, msgs + sent, num - sent, 0);
+			}
+
+			net_stats.send_calls++;
+
+			if (ret == -1)
+			{
+				if (errno == ENOSYS)
+				{
+					Com_Printf("%s: sendmmsg not available, batching disabled\n",
+							__func__);
+					net_mmsg_missing = true;
+					continue;
+				}
+
+				/* the datagram at the head failed, skip it */
+				SockadrToNetadr(msgs[sent].msg_hdr.msg_name, &to);
+				Com_Printf("%s ERROR: %s to %s\n", NET_ErrorString(),
+						__func__, NET_AdrToString(to));
+				sent++;
+				continue;
+			}
+
+			net_stats.send_packets += ret;
+			sent += ret;
+		}
+	}
+
+	net_sendqueue.count = 0;
+	net_sendqueue.poolsize = 0;
+}
+
+static void
+NET_QueuePacket(int net_socket, const struct sockaddr_storage *addr,
+		int addr_size, int length, const void *data)
+{
+	if ((net_sendqueue.count == NET_BATCH) ||
+		(net_sendqueue.poolsize + length > NET_SENDPOOL))
+	{
+		NET_FlushSendQueue();
+	}
+
+	net_sendqueue.msgs[net_sendqueue.count].socket = net_socket;
+	net_sendqueue.msgs[net_sendqueue.count].addr = *addr;
+	net_sendqueue.msgs[net_sendqueue.count].addrlen = addr_size;
+	net_sendqueue.msgs[net_sendqueue.count].offset = net_sendqueue.poolsize;
+	net_sendqueue.msgs[net_sendqueue.count].length = length;
+	net_sendqueue.count++;
+
+	memcpy(net_sendqueue.pool + net_sendqueue.poolsize, data, length);
+	net_sendqueue.poolsize += length;
+}
+#endif
+
+/*
+ * Sends everything queued by NET_SendPacket for
+ * the given socket. Called once per server frame.
+ */
+void
+NET_Flush(netsrc_t sock)
+{
+#ifdef HAVE_MMSG
+	if ((sock == NS_SERVER) && net_sendqueue.count)
+	{
+		NET_FlushSendQueue();
+	}
+#endif
+}
+
 void
 NET_SendPacket(netsrc_t sock, int length, const void *data, netadr_t to)
 {
@@ -724,6 +1079,17 @@ NET_SendPacket(netsrc_t sock, int length, const void *data, netadr_t to)
 		}
 	}
 
+#ifdef HAVE_MMSG
+	if (NET_BatchEnabled(sock) && (length <= NET_SENDPOOL))
+	{
+		NET_QueuePacket(net_socket, &addr, addr_size, length, data);
+		return;
+	}
+
+	/* keep the order of already queued datagrams */
+	NET_Flush(sock);
+#endif
+
 	ret = sendto(net_socket,
 			data,
 			length,
@@ -731,7 +1097,13 @@ NET_SendPacket(netsrc_t sock, int length, const void *data, netadr_t to)
 			(struct sockaddr *)&addr,
 			addr_size);
 
-	if (ret == -1)
+	net_stats.send_calls++;
+
+	if (ret != -1)
+	{
+		net_stats.send_packets++;
+	}
+	else
 	{
 		Com_Printf("%s ERROR: %s to %s\n", NET_ErrorString(),
 				__func__, NET_AdrToString(to));
@@ -781,6 +1153,14 @@ NET_Config(qboolean multiplayer)
 	{
 		int i;
 
+		/* send what's left before the sockets go away */
+		NET_Flush(NS_SERVER);
+
+#ifdef HAVE_MMSG
+		net_recvring.count = net_recvring.get = 0;
+		net_recvring.protocol = 0;
+#endif
+
 		/* shut down any existing sockets */
 		for (i = 0; i < 2; i++)
 		{
@@ -1027,3 +1407,71 @@ NET_Sleep(int msec)
 					ip6_sockets[NS_SERVER]) + 1, &fdset, NULL, NULL, &timeout);
 }
 
+/*
+ * Sleeps until Sys_Microseconds() reaches deadline or
+ * a server socket or stdin becomes readable. Unlike
+ * NET_Sleep() the timeout isn't rounded to whole
+ * milliseconds, so the server wakes up right at the
+ * tick. Packets arriving earlier end the sleep and
+ * are read before the caller sleeps again.
+ */
+void
+NET_SleepUntil(long long deadline)
+{
+	struct timespec timeout;
+	fd_set fdset;
+	long long usec;
+	int maxfd;
+	extern qboolean stdin_active;
+#if defined(__linux__)
+	static qboolean slack_set;
+#endif
+
+	if ((!ip_sockets[NS_SERVER] &&
+		 !ip6_sockets[NS_SERVER]) || (dedicated && !dedicated->value))
+	{
+		return; /* we're not a server, just run full speed */
+	}
+
+#if defined(__linux__)
+	/* the default timer slack of 50 usec is
+	   larger than the jitter we're aiming for */
+	if (!slack_set)
+	{
+		prctl(PR_SET_TIMERSLACK, 1000, 0, 0, 0);
+		slack_set = true;
+	}
+#endif
+
+	usec = deadline - Sys_Microseconds();
+
+	if (usec <= 0)
+	{
+		return;
+	}
+
+	FD_ZERO(&fdset);
+	maxfd = 0;
+
+	if (stdin_active)
+	{
+		FD_SET(0, &fdset); /* stdin is processed too */
+	}
+
+	if (ip_sockets[NS_SERVER])
+	{
+		FD_SET(ip_sockets[NS_SERVER], &fdset); /* IPv4 network socket */
+		maxfd = MAX(maxfd, ip_sockets[NS_SERVER]);
+	}
+
+	if (ip6_sockets[NS_SERVER])
+	{
+		FD_SET(ip6_sockets[NS_SERVER], &fdset); /* IPv6 network socket */
+		maxfd = MAX(maxfd, ip6_sockets[NS_SERVER]);
+	}
+
+	timeout.tv_sec = usec / 1000000;
+	timeout.tv_nsec = (usec % 1000000) * 1000;
+	pselect(maxfd + 1, &fdset, NULL, NULL, &timeout, NULL);
+}
+
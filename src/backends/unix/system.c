@@ -34,6 +34,8 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/select.h> /* for fd_set */
 #ifndef FNDELAY
@@ -310,6 +312,61 @@ Sys_Nanosleep(int nanosec)
 
 /* ================================================================ */
 
+typedef struct
+{
+	pthread_t thread;
+	void (*func)(void *);
+	void *arg;
+} systhread_t;
+
+static void *
+Sys_ThreadMain(void *data)
+{
+	systhread_t *thread = data;
+
+	thread->func(thread->arg);
+
+	return NULL;
+}
+
+/*
+ * Starts func(arg) in a new thread. Returns
+ * NULL if the thread couldn't be created.
+ */
+void *
+Sys_CreateThread(void (*func)(void *), void *arg)
+{
+	systhread_t *thread;
+
+	thread = malloc(sizeof(*thread));
+	YQ2_COM_CHECK_OOM(thread, "malloc()", sizeof(*thread))
+
+	thread->func = func;
+	thread->arg = arg;
+
+	if (pthread_create(&thread->thread, NULL, Sys_ThreadMain, thread))
+	{
+		free(thread);
+		return NULL;
+	}
+
+	return thread;
+}
+
+/*
+ * Waits for a thread started by Sys_CreateThread() to return.
+ */
+void
+Sys_JoinThread(void *data)
+{
+	systhread_t *thread = data;
+
+	pthread_join(thread->thread, NULL);
+	free(thread);
+}
+
+/* ================================================================ */
+
 /* The musthave and canhave arguments are unused in YQ2. We
    can't remove them since Sys_FindFirst() and Sys_FindNext()
    are defined in shared.h and may be used in custom game DLLs. */
@@ -621,6 +678,48 @@ Sys_Rename(const char *from, const char *to)
 	return rename(from, to);
 }
 
+/*
+ * Maps a whole file read only and shared with all
+ * other processes mapping it. Returns NULL on error.
+ */
+void *
+Sys_MapFile(const char *path, size_t *size)
+{
+	struct stat sb;
+	void *data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+
+	if (fd == -1)
+	{
+		return NULL;
+	}
+
+	if ((fstat(fd, &sb) == -1) || (sb.st_size <= 0))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	data = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	*size = sb.st_size;
+	return data;
+}
+
+void
+Sys_UnmapFile(void *data, size_t size)
+{
+	munmap(data, size);
+}
+
 void
 Sys_RemoveDir(const char *path)
 {
@@ -1166,6 +1166,15 @@ NET_OpenIPX(void)
 	}
 }
 
+/*
+ * Packets are sent immediately,
+ * there's nothing to flush.
+ */
+void
+NET_Flush(netsrc_t sock)
+{
+}
+
 /*
  * A single player game will
  * only use the loopback code
@@ -1263,6 +1272,25 @@ NET_Sleep(int msec)
 	select(i + 1, &fdset, NULL, NULL, &timeout);
 }
 
+/*
+ * Sleeps until Sys_Microseconds() reaches deadline
+ * or a net socket is ready. select() only has
+ * millisecond precision here, round up so we
+ * never wake up before the deadline.
+ */
+void
+NET_SleepUntil(long long deadline)
+{
+	long long usec;
+
+	usec = deadline - Sys_Microseconds();
+
+	if (usec > 0)
+	{
+		NET_Sleep((int)((usec + 999) / 1000));
+	}
+}
+
 /* =================================================================== */
 
 void
@@ -316,6 +316,61 @@ Sys_Nanosleep(int nanosec)
 	CloseHandle(timer);
 }
 
+typedef struct
+{
+	HANDLE thread;
+	void (*func)(void *);
+	void *arg;
+} systhread_t;
+
+static DWORD WINAPI
+Sys_ThreadMain(LPVOID data)
+{
+	systhread_t *thread = data;
+
+	thread->func(thread->arg);
+
+	return 0;
+}
+
+/*
+ * Starts func(arg) in a new thread. Returns
+ * NULL if the thread couldn't be created.
+ */
+void *
+Sys_CreateThread(void (*func)(void *), void *arg)
+{
+	systhread_t *thread;
+
+	thread = malloc(sizeof(*thread));
+	YQ2_COM_CHECK_OOM(thread, "malloc()", sizeof(*thread))
+
+	thread->func = func;
+	thread->arg = arg;
+	thread->thread = CreateThread(NULL, 0, Sys_ThreadMain, thread, 0, NULL);
+
+	if (!thread->thread)
+	{
+		free(thread);
+		return NULL;
+	}
+
+	return thread;
+}
+
+/*
+ * Waits for a thread started by Sys_CreateThread() to return.
+ */
+void
+Sys_JoinThread(void *data)
+{
+	systhread_t *thread = data;
+
+	WaitForSingleObject(thread->thread, INFINITE);
+	CloseHandle(thread->thread);
+	free(thread);
+}
+
 /* ================================================================ */
 
 /* The musthave and canhave arguments are unused in YQ2. We
@@ -572,6 +627,61 @@ Sys_Rename(const char *from, const char *to)
 	return _wrename(wfrom, wto);
 }
 
+/*
+ * Maps a whole file read only and shared with all
+ * other processes mapping it. Returns NULL on error.
+ */
+void *
+Sys_MapFile(const char *path, size_t *size)
+{
+	WCHAR wpath[MAX_OSPATH] = {0};
+	LARGE_INTEGER filesize;
+	HANDLE file, mapping;
+	void *data;
+
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_OSPATH);
+
+	file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return NULL;
+	}
+
+	if (!GetFileSizeEx(file, &filesize) || (filesize.QuadPart <= 0))
+	{
+		CloseHandle(file);
+		return NULL;
+	}
+
+	mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+
+	if (!mapping)
+	{
+		return NULL;
+	}
+
+	/* the view keeps the mapping alive */
+	data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+
+	if (!data)
+	{
+		return NULL;
+	}
+
+	*size = (size_t)filesize.QuadPart;
+	return data;
+}
+
+void
+Sys_UnmapFile(void *data, size_t size)
+{
+	UnmapViewOfFile(data);
+}
+
 void
 Sys_RemoveDir(const char *path)
 {
@@ -753,13 +753,71 @@ CL_Download_f(void)
 	cls.downloadnumber++;
 }
 
+/*
+ * Opens the temp file of the current download,
+ * unless it's already open for resuming.
+ */
+static qboolean
+CL_OpenDownloadFile(void)
+{
+	char name[MAX_OSPATH];
+
+	if (cls.download)
+	{
+		return true;
+	}
+
+	CL_DownloadFileName(name, sizeof(name), cls.downloadtempname);
+
+	FS_CreatePath(name);
+
+	cls.download = Q_fopen(name, "wb");
+
+	if (!cls.download)
+	{
+		Com_Printf("Failed to open %s\n", cls.downloadtempname);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Renames the finished temp file to it's final
+ * name and goes on with the next file.
+ */
+static void
+CL_FinishDownload(void)
+{
+	char oldn[MAX_OSPATH];
+	char newn[MAX_OSPATH];
+	int r;
+
+	fclose(cls.download);
+
+	/* rename the temp file to it's final name */
+	CL_DownloadFileName(oldn, sizeof(oldn), cls.downloadtempname);
+	CL_DownloadFileName(newn, sizeof(newn), cls.downloadname);
+	r = Sys_Rename(oldn, newn);
+
+	if (r)
+	{
+		Com_Printf("failed to rename.\n");
+	}
+
+	cls.download = NULL;
+	cls.downloadpercent = 0;
+
+	/* get another file if needed */
+	CL_RequestNextDownload();
+}
+
 /*
  * A download message has been received from the server
  */
 void
 CL_ParseDownload(void)
 {
-	char name[MAX_OSPATH];
 	int percent, size;
 	static qboolean second_try;
 
@@ -802,21 +860,11 @@ CL_ParseDownload(void)
 	second_try = false;
 
 	/* open the file if not opened yet */
-	if (!cls.download)
+	if (!CL_OpenDownloadFile())
 	{
-		CL_DownloadFileName(name, sizeof(name), cls.downloadtempname);
-
-		FS_CreatePath(name);
-
-		cls.download = Q_fopen(name, "wb");
-
-		if (!cls.download)
-		{
-			net_message.readcount += size;
-			Com_Printf("Failed to open %s\n", cls.downloadtempname);
-			CL_RequestNextDownload();
-			return;
-		}
+		net_message.readcount += size;
+		CL_RequestNextDownload();
+		return;
 	}
 
 	fwrite(net_message.data + net_message.readcount, 1, size, cls.download);
@@ -833,27 +881,176 @@ CL_ParseDownload(void)
 	}
 	else
 	{
-		char oldn[MAX_OSPATH];
-		char newn[MAX_OSPATH];
-		int r;
+		CL_FinishDownload();
+	}
+}
 
-		fclose(cls.download);
+/*
+ * The server starts a windowed download. The chunks
+ * follow unreliable and in any order, they're written
+ * where they belong and acknowledged with each packet.
+ */
+void
+CL_ParseDownloadWindow(void)
+{
+	int size, start;
 
-		/* rename the temp file to it's final name */
-		CL_DownloadFileName(oldn, sizeof(oldn), cls.downloadtempname);
-		CL_DownloadFileName(newn, sizeof(newn), cls.downloadname);
-		r = Sys_Rename(oldn, newn);
+	size = MSG_ReadLong(&net_message);
+	start = MSG_ReadLong(&net_message);
 
-		if (r)
-		{
-			Com_Printf("failed to rename.\n");
-		}
+	if ((size < 0) || (start < 0) || (start > size))
+	{
+		Com_Error(ERR_DROP, "%s: bad download window", __func__);
+		return;
+	}
 
-		cls.download = NULL;
-		cls.downloadpercent = 0;
+	CL_StopDownloadWindow();
 
-		/* get another file if needed */
+	if (!CL_OpenDownloadFile())
+	{
 		CL_RequestNextDownload();
+		return;
+	}
+
+	cls.downloadsize = size;
+	cls.downloadstart = start;
+	cls.downloadnumchunks = (size - start + DOWNLOAD_CHUNK - 1) / DOWNLOAD_CHUNK;
+	cls.downloadchunkbase = 0;
+	cls.downloadchunkcount = 0;
+	cls.downloadacktime = 0;
+	cls.downloadacknow = false;
+
+	if (!cls.downloadnumchunks)
+	{
+		CL_FinishDownload();
+		return;
+	}
+
+	cls.downloadchunks = calloc((cls.downloadnumchunks + 7) / 8, 1);
+	YQ2_COM_CHECK_OOM(cls.downloadchunks, "calloc()",
+			(cls.downloadnumchunks + 7) / 8)
+}
+
+void
+CL_ParseDownloadChunk(void)
+{
+	int offset, len, chunk;
+	byte *data;
+
+	offset = MSG_ReadLong(&net_message);
+	len = MSG_ReadShort(&net_message);
+
+	if ((len < 0) || (net_message.readcount + len > net_message.cursize))
+	{
+		Com_Error(ERR_DROP, "%s: bad download chunk", __func__);
+		return;
+	}
+
+	data = net_message.data + net_message.readcount;
+	net_message.readcount += len;
+
+	/* left over from an aborted download */
+	if (!cls.downloadchunks || !cls.download)
+	{
+		return;
+	}
+
+	chunk = (offset - cls.downloadstart) / DOWNLOAD_CHUNK;
+
+	if ((offset < cls.downloadstart) ||
+		((offset - cls.downloadstart) % DOWNLOAD_CHUNK) ||
+		(chunk >= cls.downloadnumchunks) ||
+		(offset + len > cls.downloadsize))
+	{
+		return;
+	}
+
+	/* the ack was lost, we already have it */
+	if (cls.downloadchunks[chunk >> 3] & (1 << (chunk & 7)))
+	{
+		cls.downloadacknow = true;
+		return;
+	}
+
+	fseek(cls.download, offset, SEEK_SET);
+	fwrite(data, 1, len, cls.download);
+
+	cls.downloadchunks[chunk >> 3] |= 1 << (chunk & 7);
+	cls.downloadchunkcount++;
+	cls.downloadacknow = true;
+
+	while ((cls.downloadchunkbase < cls.downloadnumchunks) &&
+		   (cls.downloadchunks[cls.downloadchunkbase >> 3] &
+			(1 << (cls.downloadchunkbase & 7))))
+	{
+		cls.downloadchunkbase++;
+	}
+
+	cls.downloadpercent = cls.downloadchunkcount * 100 / cls.downloadnumchunks;
+
+	if (cls.downloadchunkbase == cls.downloadnumchunks)
+	{
+		/* the last ack goes reliable, so the server
+		   doesn't have to keep the file around */
+		MSG_WriteByte(&cls.netchan.message, clc_downloadack);
+		MSG_WriteLong(&cls.netchan.message, cls.downloadchunkbase);
+		MSG_WriteLong(&cls.netchan.message, 0);
+
+		CL_StopDownloadWindow();
+		CL_FinishDownload();
 	}
 }
 
+/*
+ * Tells the server which chunks of a windowed download
+ * arrived. Sent with new chunks or at least ten times
+ * a second, a lost ack just causes a resend.
+ */
+void
+CL_WriteDownloadAck(sizebuf_t *buf)
+{
+	unsigned acked;
+	int i, chunk;
+
+	if (!cls.downloadchunks)
+	{
+		return;
+	}
+
+	if (!cls.downloadacknow && (cls.realtime - cls.downloadacktime < 100))
+	{
+		return;
+	}
+
+	acked = 0;
+
+	for (i = 0; i < DOWNLOAD_WINDOW; i++)
+	{
+		chunk = cls.downloadchunkbase + i;
+
+		if (chunk >= cls.downloadnumchunks)
+		{
+			break;
+		}
+
+		if (cls.downloadchunks[chunk >> 3] & (1 << (chunk & 7)))
+		{
+			acked |= 1u << i;
+		}
+	}
+
+	MSG_WriteByte(buf, clc_downloadack);
+	MSG_WriteLong(buf, cls.downloadchunkbase);
+	MSG_WriteLong(buf, (int)acked);
+
+	cls.downloadacknow = false;
+	cls.downloadacktime = cls.realtime;
+}
+
+void
+CL_StopDownloadWindow(void)
+{
+	free(cls.downloadchunks);
+	cls.downloadchunks = NULL;
+}
+
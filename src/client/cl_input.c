@@ -757,9 +757,13 @@ CL_SendCmd(void)
 
 	if (cls.state == ca_connected)
 	{
-		if (cls.netchan.message.cursize || (curtime - cls.netchan.last_sent > 1000))
+		SZ_Init(&buf, data, sizeof(data));
+		CL_WriteDownloadAck(&buf);
+
+		if (buf.cursize || cls.netchan.message.cursize ||
+			(curtime - cls.netchan.last_sent > 1000))
 		{
-			Netchan_Transmit(&cls.netchan, 0, buf.data);
+			Netchan_Transmit(&cls.netchan, buf.cursize, buf.data);
 		}
 
 		return;
@@ -825,6 +829,9 @@ CL_SendCmd(void)
 			buf.data + checksumIndex + 1, buf.cursize - checksumIndex - 1,
 			cls.netchan.outgoing_sequence);
 
+	/* downloads started in game */
+	CL_WriteDownloadAck(&buf);
+
 	/* deliver the message */
 	Netchan_Transmit(&cls.netchan, buf.cursize, buf.data);
 
@@ -131,8 +131,9 @@ CL_SendConnectPacket(void)
 
 	userinfo_modified = false;
 
-	Netchan_OutOfBandPrint(NS_CLIENT, adr, "connect %i %i %i \"%s\"\n",
-			PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo());
+	Netchan_OutOfBandPrint(NS_CLIENT, adr, "connect %i %i %i \"%s\" %i\n",
+			PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo(),
+			PROTOCOL_EXT_ALL);
 }
 
 /*
@@ -341,6 +342,8 @@ CL_Disconnect(void)
 		cls.download = NULL;
 	}
 
+	CL_StopDownloadWindow();
+
 #ifdef USE_CURL
 	CL_CancelHTTPDownloads(true);
 	cls.downloadReferer[0] = 0;
@@ -26,6 +26,7 @@
 
 #include "header/client.h"
 #include "input/header/input.h"
+#include "../common/unzip/miniz/miniz.h"
 
 static int bitcounts[32]; /* just for protocol profiling */
 
@@ -67,6 +68,10 @@ static const char *svc_strings[] = {
 	"svc_help_path",
 	"svc_muzzleflash3",
 	"svc_achievement",
+
+	"svc_gamestate",
+	"svc_downloadwindow",
+	"svc_downloadchunk",
 };
 
 void
@@ -1641,6 +1646,107 @@ CL_ParseConfigString(void)
 	}
 }
 
+/*
+ * Collects the fragments of a deflated gamestate. Once
+ * it's complete it's inflated and parsed like the
+ * configstrings and baselines the legacy way.
+ */
+static void
+CL_ParseGamestate(void)
+{
+	static byte *packed;
+	static int received;
+	int size, rawsize, offset, len;
+	mz_ulong inflated;
+	sizebuf_t saved;
+	byte *raw;
+
+	size = MSG_ReadLong(&net_message);
+	rawsize = MSG_ReadLong(&net_message);
+	offset = MSG_ReadLong(&net_message);
+	len = MSG_ReadShort(&net_message);
+
+	if ((size <= 0) || (size > MAX_GAMESTATE) ||
+		(rawsize <= 0) || (rawsize > MAX_GAMESTATE) ||
+		(len <= 0) || (offset < 0) || (offset + len > size) ||
+		(net_message.readcount + len > net_message.cursize))
+	{
+		Com_Error(ERR_DROP, "%s: bad gamestate fragment", __func__);
+		return;
+	}
+
+	if (offset == 0)
+	{
+		free(packed);
+		packed = malloc(size);
+		YQ2_COM_CHECK_OOM(packed, "malloc()", size)
+		received = 0;
+	}
+
+	if (!packed || (offset != received))
+	{
+		Com_Error(ERR_DROP, "%s: gamestate fragment out of order", __func__);
+		return;
+	}
+
+	memcpy(packed + offset, net_message.data + net_message.readcount, len);
+	net_message.readcount += len;
+	received += len;
+
+	if (received < size)
+	{
+		return;
+	}
+
+	raw = malloc(rawsize);
+	YQ2_COM_CHECK_OOM(raw, "malloc()", rawsize)
+
+	inflated = rawsize;
+
+	if ((uncompress(raw, &inflated, packed, size) != Z_OK) ||
+		(inflated != rawsize))
+	{
+		free(raw);
+		Com_Error(ERR_DROP, "%s: couldn't inflate gamestate", __func__);
+		return;
+	}
+
+	free(packed);
+	packed = NULL;
+
+	Com_DPrintf("Gamestate: %i bytes inflated to %i\n", size, rawsize);
+
+	/* run it through the usual parsers */
+	saved = net_message;
+	SZ_Init(&net_message, raw, rawsize);
+	net_message.cursize = rawsize;
+
+	while (net_message.readcount < net_message.cursize)
+	{
+		int cmd = MSG_ReadByte(&net_message);
+
+		if (cmd == svc_configstring)
+		{
+			CL_ParseConfigString();
+		}
+		else if (cmd == svc_spawnbaseline)
+		{
+			CL_ParseBaseline();
+		}
+		else
+		{
+			net_message = saved;
+			free(raw);
+			Com_Error(ERR_DROP, "%s: illegible gamestate 0x%02x",
+					__func__, cmd);
+			return;
+		}
+	}
+
+	net_message = saved;
+	free(raw);
+}
+
 static void
 CL_ParseStartSoundPacket(void)
 {
@@ -1839,6 +1945,8 @@ CL_ParseServerMessage(void)
 					cls.download = NULL;
 				}
 
+				CL_StopDownloadWindow();
+
 				cls.state = ca_connecting;
 				cls.connect_time = -99999; /* CL_CheckForResend() will fire immediately */
 				break;
@@ -1888,6 +1996,10 @@ CL_ParseServerMessage(void)
 				CL_ParseBaseline();
 				break;
 
+			case svc_gamestate:
+				CL_ParseGamestate();
+				break;
+
 			case svc_temp_entity:
 				CL_ParseTEnt();
 				break;
@@ -1904,6 +2016,14 @@ CL_ParseServerMessage(void)
 				CL_ParseDownload();
 				break;
 
+			case svc_downloadwindow:
+				CL_ParseDownloadWindow();
+				break;
+
+			case svc_downloadchunk:
+				CL_ParseDownloadChunk();
+				break;
+
 			case svc_frame:
 				CL_ParseFrame();
 				break;
@@ -271,6 +271,16 @@ typedef struct
 	size_t		downloadposition;
 	int			downloadpercent;
 
+	/* windowed download, PROTOCOL_EXT_DOWNLOAD */
+	byte		*downloadchunks; /* a bit for each chunk received, NULL if not windowed */
+	int			downloadsize;
+	int			downloadstart; /* file offset of the first chunk */
+	int			downloadnumchunks;
+	int			downloadchunkbase; /* chunks received in a row */
+	int			downloadchunkcount; /* chunks received */
+	int			downloadacktime; /* cls.realtime of the last ack */
+	qboolean	downloadacknow; /* chunks arrived since the last ack */
+
 	/* demo recording info must be here, so it isn't cleared on level change */
 	qboolean	demorecording;
 	qboolean	demowaiting; /* don't record until a non-delta message is received */
@@ -544,6 +554,10 @@ void CL_ParseClientinfo(int player);
 void CL_Download_f(void);
 void CL_DownloadFileName(char *dest, int destlen, char *fn);
 void CL_ParseDownload(void);
+void CL_ParseDownloadWindow(void);
+void CL_ParseDownloadChunk(void);
+void CL_WriteDownloadAck(sizebuf_t *buf);
+void CL_StopDownloadWindow(void);
 
 extern	int			gun_frame;
 
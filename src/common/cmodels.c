@@ -55,6 +55,38 @@ Mod_CalcLumpHunkSize(const lump_t *l, int inSize, int outSize, int extra)
 	return size;
 }
 
+/*
+=================
+Mod_SwapVisibility
+
+Checks a visibility lump of len bytes and
+converts it in place to host byte order.
+=================
+*/
+qboolean
+Mod_SwapVisibility(const char *name, dvis_t *vis, int len)
+{
+	int	i;
+
+	/* ensure numclusters and its bitofs pairs fit within the lump */
+	if ((int)(sizeof(int) + LittleLong(vis->numclusters) * sizeof(int) * 2) > len)
+	{
+		Com_DPrintf("%s: Map %s has invalid clusters number\n",
+			__func__, name);
+		return false;
+	}
+
+	vis->numclusters = LittleLong(vis->numclusters);
+
+	for (i = 0; i < vis->numclusters; i++)
+	{
+		vis->bitofs[i][0] = LittleLong(vis->bitofs[i][0]);
+		vis->bitofs[i][1] = LittleLong(vis->bitofs[i][1]);
+	}
+
+	return true;
+}
+
 /*
 =================
 Mod_LoadVisibility
@@ -65,7 +97,6 @@ Mod_LoadVisibility(const char *name, dvis_t **vis, int *numvisibility,
 	const byte *mod_base, const lump_t *l)
 {
 	dvis_t	*out;
-	int	i;
 
 	if (!l->filelen)
 	{
@@ -83,23 +114,11 @@ Mod_LoadVisibility(const char *name, dvis_t **vis, int *numvisibility,
 	*vis = out;
 	memcpy(out, mod_base + l->fileofs, l->filelen);
 
-	/* ensure numclusters and its bitofs pairs fit within the lump */
-	if ((int)(sizeof(int) + LittleLong(out->numclusters) * sizeof(int) * 2) > l->filelen)
+	if (!Mod_SwapVisibility(name, out, l->filelen))
 	{
-		Com_DPrintf("%s: Map %s has invalid clusters number\n",
-			__func__, name);
 		*vis = NULL;
 		*numvisibility = 0;
 		Hunk_Free(out);
-		return;
-	}
-
-	out->numclusters = LittleLong(out->numclusters);
-
-	for (i = 0; i < out->numclusters; i++)
-	{
-		out->bitofs[i][0] = LittleLong(out->bitofs[i][0]);
-		out->bitofs[i][1] = LittleLong(out->bitofs[i][1]);
 	}
 }
 
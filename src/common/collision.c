@@ -25,6 +25,7 @@
  * =======================================================================
  */
 
+#include <limits.h>
 #include <stdint.h>
 
 #include "header/common.h"
@@ -116,8 +117,35 @@ typedef struct
 
 	int extradatasize;
 	void *extradata;
+
+	/* read only mapping holding cache and map_vis,
+	   see sv_sharedmaps */
+	void *shared;
+	size_t shared_size;
 } model_t;
 
+/*
+ * File layout of the shared maps: This header, the
+ * converted map and the visibility lump in host byte
+ * order. The key is the checksum and length of the
+ * original file and the maptype it was converted with.
+ */
+#define SHAREDMAP_IDENT (('M' << 24) + ('S' << 16) + ('Q' << 8) + 'Y') /* little-endian "YQSM" */
+#define SHAREDMAP_VERSION 1
+
+typedef struct
+{
+	int ident;
+	int version;
+	unsigned checksum;
+	int filelen;
+	int maptype;
+	int cacheofs;
+	int cachesize;
+	int visofs;
+	int vissize;
+} sharedmapheader_t;
+
 #define MAX_MOD_KNOWN 8
 
 /* Just empty model for cinematic */
@@ -142,6 +170,7 @@ static cplane_t *box_planes = NULL;
 static cvar_t *map_noareas;
 static cvar_t *r_maptype;
 static cvar_t *r_game;
+static cvar_t *sv_sharedmaps;
 static int box_headnode;
 static int checkcount;
 static int floodvalid;
@@ -310,9 +339,9 @@ CM_WriteAreaBits(byte *buffer, int area)
  * Writes the portal state to a savegame file
  */
 void
-CM_WritePortalState(FILE *f)
+CM_WritePortalState(sizebuf_t *msg)
 {
-	fwrite(cmod->portalopen, sizeof(qboolean) * cmod->numareaportals, 1, f);
+	SZ_Write(msg, cmod->portalopen, sizeof(qboolean) * cmod->numareaportals);
 }
 
 /*
@@ -1789,6 +1818,11 @@ CM_ModFree(model_t *cmod)
 		Hunk_Free(cmod->extradata);
 	}
 
+	if (cmod->shared)
+	{
+		Sys_UnmapFile(cmod->shared, cmod->shared_size);
+	}
+
 	memset(cmod, 0, sizeof(model_t));
 }
 
@@ -1806,6 +1840,7 @@ CM_ModInit(void)
 	map_noareas = Cvar_Get("map_noareas", "0", 0);
 	r_maptype = Cvar_Get("maptype", "0", CVAR_ARCHIVE);
 	r_game = Cvar_Get("game", "", CVAR_LATCH | CVAR_SERVERINFO);
+	sv_sharedmaps = Cvar_Get("sv_sharedmaps", "", 0);
 }
 
 void
@@ -1844,6 +1879,170 @@ CM_ModFreeAll(void)
 	Com_Printf("Server models free up\n");
 }
 
+static void
+CM_SharedMapPath(char *path, size_t size, const model_t *mod, int filelen,
+	int maptype)
+{
+	snprintf(path, size, "%s/yq2map-%08x-%x-%d.bin", sv_sharedmaps->string,
+		mod->checksum, filelen, maptype);
+}
+
+/*
+ * Uses the shared copy of a map converted by another
+ * process, if there's one matching the loaded file.
+ */
+static qboolean
+CM_AttachSharedMap(model_t *mod, int filelen, int maptype)
+{
+	const sharedmapheader_t *header;
+	char path[MAX_OSPATH];
+	const dvis_t *vis;
+	size_t size;
+	byte *data;
+
+	CM_SharedMapPath(path, sizeof(path), mod, filelen, maptype);
+	data = Sys_MapFile(path, &size);
+
+	if (!data)
+	{
+		return false;
+	}
+
+	header = (const sharedmapheader_t *)data;
+
+	if ((size < sizeof(*header)) || (size > INT_MAX) ||
+		(header->ident != SHAREDMAP_IDENT) ||
+		(header->version != SHAREDMAP_VERSION) ||
+		(header->checksum != mod->checksum) ||
+		(header->filelen != filelen) ||
+		(header->maptype != maptype) ||
+		(header->cacheofs < (int)sizeof(*header)) || (header->cacheofs & 63) ||
+		(header->cachesize < (int)sizeof(dheader_t)) ||
+		(header->cachesize > (int)size - header->cacheofs) ||
+		(header->visofs < (int)sizeof(*header)) || (header->visofs & 63) ||
+		(header->vissize < 0) || (header->vissize > (int)size - header->visofs))
+	{
+		Com_Printf("%s: Ignoring invalid %s\n", __func__, path);
+		Sys_UnmapFile(data, size);
+		return false;
+	}
+
+	vis = (const dvis_t *)(data + header->visofs);
+
+	if (header->vissize &&
+		((header->vissize < (int)sizeof(int)) || (vis->numclusters < 0) ||
+		(vis->numclusters > (header->vissize - (int)sizeof(int)) / (int)(sizeof(int) * 2))))
+	{
+		Com_Printf("%s: Ignoring invalid %s\n", __func__, path);
+		Sys_UnmapFile(data, size);
+		return false;
+	}
+
+	mod->shared = data;
+	mod->shared_size = size;
+	mod->cache = data + header->cacheofs;
+	mod->cache_size = header->cachesize;
+	mod->map_vis = header->vissize ? (dvis_t *)vis : NULL;
+	mod->numvisibility = header->vissize;
+
+	Com_DPrintf("%s: Attached to %s: " YQ2_COM_PRIdS " Kb\n",
+		__func__, path, size / 1024);
+
+	return true;
+}
+
+/*
+ * Writes the converted map for other processes and
+ * replaces the private copy with the shared one.
+ */
+static void
+CM_CreateSharedMap(model_t *mod, int filelen, int maptype,
+	const byte *cmod_base, size_t length)
+{
+	const lump_t *l = &((const dheader_t *)cmod_base)->lumps[LUMP_VISIBILITY];
+	char path[MAX_OSPATH], tmp[MAX_OSPATH + 32];
+	sharedmapheader_t *header;
+	size_t size;
+	byte *data;
+	qboolean ok;
+	FILE *f;
+
+	if ((l->fileofs < 0) || (l->filelen < 0) ||
+		((size_t)l->fileofs + l->filelen > length))
+	{
+		return;
+	}
+
+	size = (sizeof(*header) + 63) & ~63;
+	size += (length + 63) & ~63;
+	size += l->filelen;
+
+	data = calloc(1, size);
+	YQ2_COM_CHECK_OOM(data, "calloc()", size)
+
+	if (!data)
+	{
+		return;
+	}
+
+	header = (sharedmapheader_t *)data;
+	header->ident = SHAREDMAP_IDENT;
+	header->version = SHAREDMAP_VERSION;
+	header->checksum = mod->checksum;
+	header->filelen = filelen;
+	header->maptype = maptype;
+	header->cacheofs = (sizeof(*header) + 63) & ~63;
+	header->cachesize = length;
+	header->visofs = header->cacheofs + ((length + 63) & ~63);
+	header->vissize = l->filelen;
+
+	memcpy(data + header->cacheofs, cmod_base, length);
+	memcpy(data + header->visofs, cmod_base + l->fileofs, l->filelen);
+
+	if (header->vissize && !Mod_SwapVisibility(mod->name,
+			(dvis_t *)(data + header->visofs), header->vissize))
+	{
+		header->vissize = 0;
+	}
+
+	CM_SharedMapPath(path, sizeof(path), mod, filelen, maptype);
+
+	/* unique, other servers may be writing the same map */
+	snprintf(tmp, sizeof(tmp), "%s.%llx.tmp", path,
+		(unsigned long long)Sys_Microseconds());
+	f = Q_fopen(tmp, "wb");
+
+	if (!f)
+	{
+		Com_Printf("%s: Couldn't write %s\n", __func__, tmp);
+		free(data);
+		return;
+	}
+
+	ok = (fwrite(data, size, 1, f) == 1);
+	free(data);
+
+	if (fclose(f) || !ok)
+	{
+		Sys_Remove(tmp);
+		return;
+	}
+
+	if (Sys_Rename(tmp, path))
+	{
+		/* Windows doesn't replace existing files */
+		Sys_Remove(path);
+
+		if (Sys_Rename(tmp, path))
+		{
+			Sys_Remove(tmp);
+			return;
+		}
+	}
+
+	CM_AttachSharedMap(mod, filelen, maptype);
+}
+
 static void
 CM_LoadCachedMap(const char *name, model_t *mod)
 {
@@ -1851,7 +2050,7 @@ CM_LoadCachedMap(const char *name, model_t *mod)
 	byte *cmod_base, *filebuf;
 	maptype_t maptype;
 	dheader_t *header;
-	int filelen;
+	int filelen, sharedtype;
 
 	filelen = FS_LoadFile(name, (void **)&filebuf);
 
@@ -1865,16 +2064,33 @@ CM_LoadCachedMap(const char *name, model_t *mod)
 
 	/* Can't detect will use provided */
 	maptype = r_maptype->value;
-
-	cmod_base = Mod_Load2QBSP(name, (byte *)filebuf, filelen, &length, &maptype);
-	FS_FreeFile(filebuf);
-
-	header = (dheader_t *)cmod_base;
+	sharedtype = maptype;
 
 	/* load into heap */
 	Q_strlcpy(mod->name, name, sizeof(mod->name));
 
-	hunkSize = length; /* allocate memory for future maps cache */
+	if (sv_sharedmaps->string[0] &&
+		CM_AttachSharedMap(mod, filelen, sharedtype))
+	{
+		cmod_base = NULL;
+		length = mod->cache_size;
+		FS_FreeFile(filebuf);
+	}
+	else
+	{
+		cmod_base = Mod_Load2QBSP(name, (byte *)filebuf, filelen, &length, &maptype);
+		FS_FreeFile(filebuf);
+
+		if (sv_sharedmaps->string[0])
+		{
+			CM_CreateSharedMap(mod, filelen, sharedtype, cmod_base, length);
+		}
+	}
+
+	header = mod->shared ? (dheader_t *)mod->cache : (dheader_t *)cmod_base;
+
+	/* the shared map brings its own cache and visibility */
+	hunkSize = mod->shared ? 0 : length; /* allocate memory for future maps cache */
 	hunkSize += Mod_CalcLumpHunkSize(&header->lumps[LUMP_TEXINFO],
 		sizeof(xtexinfo_t), sizeof(mapsurface_t), EXTRA_LUMP_TEXINFO);
 	hunkSize += Mod_CalcLumpHunkSize(&header->lumps[LUMP_LEAFS],
@@ -1895,16 +2111,24 @@ CM_LoadCachedMap(const char *name, model_t *mod)
 		sizeof(dareaportal_t), sizeof(dareaportal_t), 0);
 	hunkSize += Mod_CalcLumpHunkSize(&header->lumps[LUMP_AREAPORTALS],
 		sizeof(dareaportal_t), sizeof(qboolean), 0);
-	hunkSize += Mod_CalcLumpHunkSize(&header->lumps[LUMP_VISIBILITY],
-		1, 1, 0);
+
+	if (!mod->shared)
+	{
+		hunkSize += Mod_CalcLumpHunkSize(&header->lumps[LUMP_VISIBILITY],
+			1, 1, 0);
+	}
+
 	hunkSize += Mod_CalcLumpHunkSize(&header->lumps[LUMP_ENTITIES],
 		1, 1, MAX_MAP_ENTSTRING);
 
 	mod->extradata = Hunk_Begin(hunkSize);
 
-	mod->cache = Hunk_Alloc(length);
-	memcpy(mod->cache, cmod_base, length);
-	mod->cache_size = length;
+	if (!mod->shared)
+	{
+		mod->cache = Hunk_Alloc(length);
+		memcpy(mod->cache, cmod_base, length);
+		mod->cache_size = length;
+	}
 
 	CMod_LoadSurfaces(mod->name, &mod->map_surfaces, &mod->numtexinfo,
 		mod->cache, &header->lumps[LUMP_TEXINFO]);
@@ -1928,8 +2152,12 @@ CM_LoadCachedMap(const char *name, model_t *mod)
 	CMod_LoadAreaPortals(mod->name, &mod->map_areaportals,
 		&mod->portalopen, &mod->numareaportals,
 		mod->cache, &header->lumps[LUMP_AREAPORTALS]);
-	Mod_LoadVisibility(mod->name, &mod->map_vis, &mod->numvisibility,
-		mod->cache, &header->lumps[LUMP_VISIBILITY]);
+
+	if (!mod->shared)
+	{
+		Mod_LoadVisibility(mod->name, &mod->map_vis, &mod->numvisibility,
+			mod->cache, &header->lumps[LUMP_VISIBILITY]);
+	}
 
 	if (!mod->map_vis)
 	{
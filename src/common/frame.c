@@ -208,7 +208,12 @@ Qcommon_Mainloop(void)
 			}
 		}
 #else
-		Sys_Nanosleep(850000);
+		/* SV_Frame() sleeps until the next tick or the next
+		   packet by itself, sleeping here would overshoot. */
+		if (!sv_tickscheduler->value || !Com_ServerState())
+		{
+			Sys_Nanosleep(850000);
+		}
 #endif
 
 		newtime = Sys_Microseconds();
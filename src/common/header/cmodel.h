@@ -55,6 +55,7 @@ typedef enum
 } maptype_t;
 
 extern int Mod_CalcLumpHunkSize(const lump_t *l, int inSize, int outSize, int extra);
+extern qboolean Mod_SwapVisibility(const char *name, dvis_t *vis, int len);
 extern void Mod_LoadVisibility(const char *name, dvis_t **vis, int *numvisibility,
 	const byte *mod_base, const lump_t *l);
 extern void Mod_LoadPlanes(const char *name, cplane_t **planes, int *numplanes,
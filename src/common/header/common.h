@@ -206,6 +206,21 @@ void Info_Print(const char *s);
 	((x) == PROTOCOL_XATRIX_VERSION) || \
 	((x) == PROTOCOL_R97_VERSION))
 
+/* Optional protocol extensions. The client sends the
+   ones it supports as an extra argument to connect,
+   older servers just ignore it. */
+#define PROTOCOL_EXT_GAMESTATE 1    /* deflated gamestate in svc_gamestate */
+#define PROTOCOL_EXT_DOWNLOAD 2     /* windowed downloads, svc_downloadchunk */
+#define PROTOCOL_EXT_ALL (PROTOCOL_EXT_GAMESTATE | PROTOCOL_EXT_DOWNLOAD)
+
+/* upper limit for both sizes of a deflated gamestate */
+#define MAX_GAMESTATE 0x400000
+
+/* windowed downloads send the file in chunks of this size,
+   at most DOWNLOAD_WINDOW past the first missing one */
+#define DOWNLOAD_CHUNK 1280
+#define DOWNLOAD_WINDOW 32
+
 /* ========================================= */
 
 #define PORT_MASTER 27900
@@ -261,6 +276,12 @@ enum svc_ops_e
 	svc_help_path,              /* [Paril-KEX] help path */
 	svc_muzzleflash3,           /* [Paril-KEX] muzzleflashes, but ushort id */
 	svc_achievement,            /* [Paril-KEX] */
+
+	/* YQ2 extensions */
+	svc_gamestate,              /* [long] size [long] inflated size [long] offset */
+	                            /*   [short] length [length bytes] deflated gamestate */
+	svc_downloadwindow,         /* [long] size [long] offset, chunks follow unreliable */
+	svc_downloadchunk,          /* [long] offset [short] length [length bytes] */
 };
 
 /* ============================================== */
@@ -272,7 +293,8 @@ enum clc_ops_e
 	clc_nop,
 	clc_move,               /* [[usercmd_t] */
 	clc_userinfo,           /* [[userinfo string] */
-	clc_stringcmd           /* [string] message */
+	clc_stringcmd,          /* [string] message */
+	clc_downloadack         /* [long] chunks in a row [long] chunks received after them */
 };
 
 /* ============================================== */
@@ -594,6 +616,7 @@ void NET_Config(qboolean multiplayer);
 qboolean NET_GetPacket(netsrc_t sock, netadr_t *net_from,
 		sizebuf_t *net_message);
 void NET_SendPacket(netsrc_t sock, int length, const void *data, netadr_t to);
+void NET_Flush(netsrc_t sock);
 
 qboolean NET_CompareAdr(netadr_t a, netadr_t b);
 qboolean NET_CompareBaseAdr(netadr_t a, netadr_t b);
@@ -601,6 +624,7 @@ qboolean NET_IsLocalAddress(netadr_t adr);
 char *NET_AdrToString(netadr_t a);
 qboolean NET_StringToAdr(const char *s, netadr_t *a);
 void NET_Sleep(int msec);
+void NET_SleepUntil(long long deadline);
 
 /*=================================================================== */
 
@@ -708,7 +732,7 @@ qboolean CM_AreasConnected(int area1, int area2);
 int CM_WriteAreaBits(byte *buffer, int area);
 qboolean CM_HeadnodeVisible(int nodenum, const byte *visbits);
 
-void CM_WritePortalState(FILE *f);
+void CM_WritePortalState(sizebuf_t *msg);
 int CM_LoadFile(const char *path, void **buffer);
 
 /* Shared Model load code */
@@ -848,6 +872,9 @@ extern cvar_t *log_stats;
 /* External entity files. */
 extern cvar_t *sv_entfile;
 
+/* The dedicated server waits for its ticks itself. */
+extern cvar_t *sv_tickscheduler;
+
 /* Hack for portable client */
 extern qboolean is_portable;
 
@@ -918,6 +945,8 @@ char *Sys_GetHomeDir(void);
 void Sys_Remove(const char *path);
 int Sys_Rename(const char *from, const char *to);
 void Sys_RemoveDir(const char *path);
+void *Sys_MapFile(const char *path, size_t *size);
+void Sys_UnmapFile(void *data, size_t size);
 long long Sys_Microseconds(void);
 void Sys_Nanosleep(int);
 void *Sys_GetProcAddress(void *handle, const char *sym);
@@ -928,6 +957,8 @@ void Sys_UnloadGame(void);
 void Sys_GetWorkDir(char *buffer, size_t len);
 qboolean Sys_SetWorkDir(const char *path);
 qboolean Sys_Realpath(const char *in, char *out, size_t size);
+void *Sys_CreateThread(void (*func)(void *), void *arg);
+void Sys_JoinThread(void *thread);
 
 // Windows only (system.c)
 #ifdef _WIN32
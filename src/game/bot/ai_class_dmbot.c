@@ -428,27 +428,26 @@ BOT_DMclass_FindEnemy(edict_t *self)
 		if (self->ai->status.playersWeights[i] == 0)
 			continue;
 
-		if (!AIEnemies[i]->deadflag && visible(self, AIEnemies[i]) &&
-			//trap_inPVS (self->s.origin, players[i]->s.origin))
-			gi.inPVS(self->s.origin, AIEnemies[i]->s.origin))
-		{
-			//(weight enemies from fusionbot) Is enemy visible, or is it too close to ignore
-			VectorSubtract(self->s.origin, AIEnemies[i]->s.origin, dist);
-			weight = VectorLength( dist );
+		if (AIEnemies[i]->deadflag)
+			continue;
 
-			//modify weight based on precomputed player weights
-			weight *= (1.0 - self->ai->status.playersWeights[i]);
+		//(weight enemies from fusionbot) Is enemy visible, or is it too close to ignore
+		VectorSubtract(self->s.origin, AIEnemies[i]->s.origin, dist);
+		weight = VectorLength( dist );
 
-			if (infront( self, AIEnemies[i]) ||
-				(weight < 300))
-			{
-				// Check if best target, or better than current target
-				if (weight < bestweight)
-				{
-					bestweight = weight;
-					bestenemy = AIEnemies[i];
-				}
-			}
+		//modify weight based on precomputed player weights
+		weight *= (1.0 - self->ai->status.playersWeights[i]);
+
+		// Check if best target, or better than current target.
+		// The traces last, only for enemies that would be picked
+		if (weight < bestweight &&
+			(infront( self, AIEnemies[i]) || (weight < 300)) &&
+			//trap_inPVS (self->s.origin, players[i]->s.origin))
+			gi.inPVS(self->s.origin, AIEnemies[i]->s.origin) &&
+			visible(self, AIEnemies[i]))
+		{
+			bestweight = weight;
+			bestenemy = AIEnemies[i];
 		}
 	}
 
@@ -1031,6 +1030,7 @@ void
 BOT_DMclass_InitPersistant(edict_t *self)
 {
 	self->classname = "dmbot";
+	G_IndexEdict(self);
 
 	/* copy name */
 	if (self->client->pers.netname[0])
@@ -490,6 +490,8 @@ AITools_InitEditnodes(void)
 
 		/* delete everything but nodes */
 		memset(pLinks, 0, sizeof(nav_plink_t) * MAX_NODES);
+		AStar_FlushCache();
+		AI_DropNavTable();
 
 		nav.num_ents = 0;
 		memset(nav.ents, 0, sizeof(nav_ents_t) * MAX_EDICTS);
@@ -194,6 +194,9 @@ AI_AddLink( int n1, int n2, int linkType)
 
 	pLinks[n1].numLinks++;
 
+	AStar_FlushCache();
+	AI_DropNavTable();
+
 	return true;
 }
 
@@ -40,6 +40,7 @@
 // extern  cvar_t				*bot_showsrgoal;
 // extern  cvar_t				*bot_showlrgoal;
 extern cvar_t *bot_debugmonster;
+extern cvar_t *bot_navtable;
 
 //----------------------------------------------------------
 
@@ -115,6 +116,12 @@ int AI_FindClosestReachableNode( vec3_t origin, edict_t *passent, int range, int
 void AI_SetGoal(edict_t *self, int goal_node);
 qboolean AI_FollowPath(edict_t *self);
 
+// ai_navtable.c
+//----------------------------------------------------------
+void AI_BuildNavTable(void);
+void AI_DropNavTable(void);
+qboolean AI_NavTableCost(int from, int to, int movetypes, int *cost);
+
 // ai_nodes.c
 //----------------------------------------------------------
 qboolean AI_DropNodeOriginToFloor(vec3_t origin, edict_t *passent);
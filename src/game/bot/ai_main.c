@@ -34,6 +34,7 @@ ai_devel_t	AIDevel;
 // cvar_t *bot_showsrgoal;
 // cvar_t *bot_showlrgoal;
 cvar_t *bot_debugmonster;
+cvar_t *bot_navtable;
 
 //ACE
 
@@ -49,6 +50,7 @@ void AI_Init(void)
 	// bot_showsrgoal = gi.cvar("bot_showsrgoal", "0", CVAR_SERVERINFO);
 	// bot_showlrgoal = gi.cvar("bot_showlrgoal", "0", CVAR_SERVERINFO);
 	bot_debugmonster = gi.cvar("bot_debugmonster", "0", CVAR_SERVERINFO|CVAR_ARCHIVE);
+	bot_navtable = gi.cvar("bot_navtable", "1", 0);
 
 	AIDevel.debugMode = false;
 	AIDevel.debugChased = false;
@@ -301,6 +303,7 @@ AI_PickShortRangeGoal(edict_t *self)
 {
 	edict_t *target;
 	float best_weight=0.0;
+	float weight;
 	edict_t *best = NULL;
 
 	if (!self->client)
@@ -329,20 +332,15 @@ AI_PickShortRangeGoal(edict_t *self)
 			}
 		}
 
-		if (AI_ItemIsReachable(self,target->s.origin))
-		{
-			if (infront(self, target))
-			{
-				float weight;
-
-				weight = AI_ItemWeight(self, target);
+		// only a better item can change the pick, so weigh
+		// first and trace just the candidates left
+		weight = AI_ItemWeight(self, target);
 
-				if (weight > best_weight)
-				{
-					best_weight = weight;
-					best = target;
-				}
-			}
+		if (weight > best_weight && infront(self, target) &&
+			AI_ItemIsReachable(self, target->s.origin))
+		{
+			best_weight = weight;
+			best = target;
 		}
 
 		// next target
@@ -38,6 +38,10 @@
 int AI_FindCost(int from, int to, int movetypes)
 {
 	astarpath_t	path;
+	int cost;
+
+	if (AI_NavTableCost(from, to, movetypes, &cost))
+		return cost;
 
 	if (!AStar_GetPath( from, to, movetypes, &path))
 		return -1;
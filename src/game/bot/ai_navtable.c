@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 1997-2001 Id Software, Inc.
+ * Copyright (C) 2001 Steve Yeager
+ * Copyright (C) 2001-2004 Pat AfterMoon
+ * Copyright (c) ZeniMax Media Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include <limits.h>
+#include <time.h>
+#include "../header/local.h"
+#include "ai_local.h"
+
+//==========================================
+// Distance table. For every pair of nodes it
+// holds how many links the shortest path
+// between them takes, so rating goals doesn't need
+// a path search per candidate. Built when the
+// navigation is set up for a map and stored
+// next to the .nav file for the next time.
+//==========================================
+
+#define NAVTABLE_IDENT (('T' << 24) + ('N' << 16) + ('Q' << 8) + 'Y') /* YQNT */
+#define NAVTABLE_VERSION 1
+#define NAVTABLE_EXTENSION "ntb"
+#define NAVTABLE_UNREACHABLE 0xffff
+
+// the movetypes of the dmbot class, the only ones asked for while playing
+#define NAVTABLE_MOVETYPES ( \
+	LINK_MOVE | \
+	LINK_STAIRS | \
+	LINK_FALL | \
+	LINK_WATER | \
+	LINK_WATERJUMP | \
+	LINK_JUMPPAD | \
+	LINK_PLATFORM | \
+	LINK_TELEPORT | \
+	LINK_LADDER | \
+	LINK_JUMP | \
+	LINK_CROUCH)
+
+typedef struct
+{
+	int ident;
+	int version;
+	int numnodes;
+	int movetypes;
+	unsigned int checksum;
+} navtableheader_t;
+
+static struct
+{
+	qboolean valid;
+	int numnodes;
+	unsigned int checksum;
+	// numnodes * numnodes, row is the origin. Not TAG_LEVEL,
+	// loading a savegame frees that but keeps the navigation.
+	unsigned short *hops;
+} navtable;
+
+//==========================================
+// AI_NavTableChecksum
+// Fingerprint of the graph the table is for
+//==========================================
+static unsigned int
+AI_NavTableChecksum(void)
+{
+	unsigned int hash = 2166136261u;
+	const byte *data;
+	size_t i, len;
+
+	data = (const byte *)pLinks;
+	len = nav.num_nodes * sizeof(nav_plink_t);
+
+	for (i = 0; i < len; i++)
+	{
+		hash = (hash ^ data[i]) * 16777619u;
+	}
+
+	return hash ^ (unsigned int)nav.num_nodes;
+}
+
+//==========================================
+// AI_NavTableFile
+//==========================================
+static void
+AI_NavTableFile(char *filename, size_t size)
+{
+	Com_sprintf(filename, size, "%s/%s/%s.%s", gi.Gamedir(),
+		AI_NODES_FOLDER, level.mapname, NAVTABLE_EXTENSION);
+}
+
+//==========================================
+// AI_NavTableRow
+// Dijkstra over the link distances from one
+// origin, fills in the link counts of the
+// shortest paths. On equal distance the path
+// with less links wins.
+//==========================================
+static void
+AI_NavTableRow(int origin, int *dist, int *heap, int *heappos,
+	unsigned short *row)
+{
+	int heapsize, i;
+
+	for (i = 0; i < nav.num_nodes; i++)
+	{
+		dist[i] = INT_MAX;
+		heappos[i] = -1;
+		row[i] = NAVTABLE_UNREACHABLE;
+	}
+
+	dist[origin] = 0;
+	row[origin] = 0;
+	heap[0] = origin;
+	heappos[origin] = 0;
+	heapsize = 1;
+
+	while (heapsize)
+	{
+		int node, pos;
+
+		// pop the closest
+		node = heap[0];
+		heappos[node] = -2;	//done
+		heapsize--;
+
+		if (heapsize)
+		{
+			int last = heap[heapsize];
+
+			pos = 0;
+
+			while (1)
+			{
+				int child = pos * 2 + 1;
+
+				if (child >= heapsize)
+				{
+					break;
+				}
+
+				if (child + 1 < heapsize && dist[heap[child + 1]] < dist[heap[child]])
+				{
+					child++;
+				}
+
+				if (dist[heap[child]] >= dist[last])
+				{
+					break;
+				}
+
+				heap[pos] = heap[child];
+				heappos[heap[pos]] = pos;
+				pos = child;
+			}
+
+			heap[pos] = last;
+			heappos[last] = pos;
+		}
+
+		for (i = 0; i < pLinks[node].numLinks; i++)
+		{
+			int next = pLinks[node].nodes[i];
+			int newdist;
+
+			if (!(NAVTABLE_MOVETYPES & pLinks[node].moveType[i]) ||
+				next < 0 || next >= nav.num_nodes || heappos[next] == -2)
+			{
+				continue;
+			}
+
+			newdist = dist[node] + pLinks[node].dist[i];
+
+			if (newdist > dist[next] ||
+				(newdist == dist[next] && row[node] + 1 >= row[next]))
+			{
+				continue;
+			}
+
+			dist[next] = newdist;
+			row[next] = row[node] + 1;
+
+			// push or decrease
+			pos = heappos[next];
+
+			if (pos < 0)
+			{
+				pos = heapsize++;
+			}
+
+			while (pos > 0 && dist[heap[(pos - 1) / 2]] > newdist)
+			{
+				heap[pos] = heap[(pos - 1) / 2];
+				heappos[heap[pos]] = pos;
+				pos = (pos - 1) / 2;
+			}
+
+			heap[pos] = next;
+			heappos[next] = pos;
+		}
+	}
+}
+
+//==========================================
+// AI_NavTableLoad
+//==========================================
+static qboolean
+AI_NavTableLoad(const char *filename)
+{
+	navtableheader_t header;
+	size_t count;
+	FILE *pIn;
+
+	pIn = Q_fopen(filename, "rb");
+	if (!pIn)
+	{
+		return false;
+	}
+
+	count = (size_t)navtable.numnodes * navtable.numnodes;
+
+	if (fread(&header, sizeof(header), 1, pIn) != 1 ||
+		header.ident != NAVTABLE_IDENT ||
+		header.version != NAVTABLE_VERSION ||
+		header.numnodes != navtable.numnodes ||
+		header.movetypes != NAVTABLE_MOVETYPES ||
+		header.checksum != navtable.checksum ||
+		fread(navtable.hops, sizeof(navtable.hops[0]), count, pIn) != count)
+	{
+		fclose(pIn);
+		return false;
+	}
+
+	fclose(pIn);
+
+	return true;
+}
+
+//==========================================
+// AI_NavTableSave
+//==========================================
+static void
+AI_NavTableSave(const char *filename)
+{
+	navtableheader_t header;
+	FILE *pOut;
+
+	gi.CreatePath(filename);
+	pOut = Q_fopen(filename, "wb");
+	if (!pOut)
+	{
+		Com_Printf("AI: Failed to store: %s\n", filename);
+		return;
+	}
+
+	header.ident = NAVTABLE_IDENT;
+	header.version = NAVTABLE_VERSION;
+	header.numnodes = navtable.numnodes;
+	header.movetypes = NAVTABLE_MOVETYPES;
+	header.checksum = navtable.checksum;
+
+	fwrite(&header, sizeof(header), 1, pOut);
+	fwrite(navtable.hops, sizeof(navtable.hops[0]),
+		(size_t)navtable.numnodes * navtable.numnodes, pOut);
+	fclose(pOut);
+}
+
+//==========================================
+// AI_BuildNavTable
+// Called when all nodes and links of the map
+// are in place. Loads the table for this graph
+// or builds and stores it.
+//==========================================
+void
+AI_BuildNavTable(void)
+{
+	char filename[MAX_OSPATH];
+	int *dist, *heap, *heappos;
+	clock_t start;
+	int i;
+
+	AI_DropNavTable();
+
+	if (!bot_navtable->value || !nav.loaded || nav.num_nodes < 2)
+	{
+		return;
+	}
+
+	navtable.numnodes = nav.num_nodes;
+	navtable.checksum = AI_NavTableChecksum();
+	navtable.hops = gi.TagMalloc((size_t)nav.num_nodes * nav.num_nodes *
+		sizeof(navtable.hops[0]), TAG_GAME);
+
+	AI_NavTableFile(filename, sizeof(filename));
+
+	if (AI_NavTableLoad(filename))
+	{
+		navtable.valid = true;
+		Com_Printf("AI: Loaded distance table for %i nodes.\n", nav.num_nodes);
+		return;
+	}
+
+	start = clock();
+
+	dist = gi.TagMalloc(nav.num_nodes * 3 * sizeof(int), TAG_GAME);
+	heap = dist + nav.num_nodes;
+	heappos = heap + nav.num_nodes;
+
+	for (i = 0; i < nav.num_nodes; i++)
+	{
+		AI_NavTableRow(i, dist, heap, heappos,
+			navtable.hops + (size_t)i * nav.num_nodes);
+	}
+
+	gi.TagFree(dist);
+
+	navtable.valid = true;
+	Com_Printf("AI: Built distance table for %i nodes in %.1f ms.\n",
+		nav.num_nodes, (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+
+	AI_NavTableSave(filename);
+}
+
+//==========================================
+// AI_DropNavTable
+// The graph changed, the table doesn't fit
+// anymore. It's rebuilt with the navigation.
+//==========================================
+void
+AI_DropNavTable(void)
+{
+	navtable.valid = false;
+
+	if (navtable.hops)
+	{
+		gi.TagFree(navtable.hops);
+		navtable.hops = NULL;
+	}
+}
+
+//==========================================
+// AI_NavTableCost
+// Same result as AI_FindCost(), false if the
+// table can't answer it.
+//==========================================
+qboolean
+AI_NavTableCost(int from, int to, int movetypes, int *cost)
+{
+	unsigned short hops;
+
+	if (!navtable.valid || !bot_navtable->value ||
+		movetypes != NAVTABLE_MOVETYPES ||
+		from < 0 || from >= navtable.numnodes ||
+		to < 0 || to >= navtable.numnodes)
+	{
+		return false;
+	}
+
+	hops = navtable.hops[(size_t)from * navtable.numnodes + to];
+
+	// no path to itself, like AStar_GetPath()
+	if (hops == NAVTABLE_UNREACHABLE || hops == 0)
+	{
+		*cost = -1;
+	}
+	else
+	{
+		*cost = hops - 1;
+	}
+
+	return true;
+}
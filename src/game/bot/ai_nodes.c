@@ -28,6 +28,7 @@
  * in NO WAY supported by Steve Yeager.
  */
 
+#include <time.h>
 #include "../header/local.h"
 #include "ai_local.h"
 
@@ -706,6 +707,8 @@ AI_LoadPLKFile(char *mapname)
 		return false;
 	}
 
+	AStar_FlushCache();
+
 	if (fread(pLinks, sizeof(nav_plink_t), nav.num_nodes, pIn) != nav.num_nodes)
 	{
 		Com_Printf("%s: broken navigation %s file links\n", __func__, filename);
@@ -1016,12 +1019,174 @@ AI_LinkServerNodes(int start)
 	return count;
 }
 
+//==========================================
+// Link cache. Linking the entity and server
+// nodes traces a lot and stalls the level
+// start on big maps. The links it produces
+// are stored next to the .nav file, keyed by
+// the map checksum and everything the link
+// tests start from, and reused while the key
+// matches.
+//==========================================
+
+#define LINKCACHE_IDENT (('C' << 24) + ('L' << 16) + ('Q' << 8) + 'Y') /* YQLC */
+#define LINKCACHE_VERSION 1
+#define LINKCACHE_EXTENSION "lnk"
+
+typedef struct
+{
+	int ident;
+	int version;
+	int mapchecksum;
+	unsigned int key;
+	int numnodes;
+	int newlinks;
+	int newjumplinks;
+} linkcacheheader_t;
+
+//==========================================
+// AI_LinkCacheKey
+// Hash of the nodes and of the links before
+// the server pass
+//==========================================
+static unsigned int
+AI_LinkCacheKey(void)
+{
+	unsigned int hash = 2166136261u;
+	const byte *data;
+	size_t i, len;
+
+	data = (const byte *)nodes;
+	len = nav.num_nodes * sizeof(nav_node_t);
+
+	for (i = 0; i < len; i++)
+	{
+		hash = (hash ^ data[i]) * 16777619u;
+	}
+
+	data = (const byte *)pLinks;
+	len = nav.num_nodes * sizeof(nav_plink_t);
+
+	for (i = 0; i < len; i++)
+	{
+		hash = (hash ^ data[i]) * 16777619u;
+	}
+
+	return hash;
+}
+
+//==========================================
+// AI_LoadLinkCache
+//==========================================
+static qboolean
+AI_LoadLinkCache(const char *filename, int mapchecksum, unsigned int key,
+	int *newlinks, int *newjumplinks)
+{
+	linkcacheheader_t header;
+	nav_plink_t *links;
+	FILE *pIn;
+	int i, j;
+
+	pIn = Q_fopen(filename, "rb");
+	if (!pIn)
+	{
+		return false;
+	}
+
+	if (fread(&header, sizeof(header), 1, pIn) != 1 ||
+		header.ident != LINKCACHE_IDENT ||
+		header.version != LINKCACHE_VERSION ||
+		header.mapchecksum != mapchecksum ||
+		header.key != key ||
+		header.numnodes != nav.num_nodes)
+	{
+		fclose(pIn);
+		return false;
+	}
+
+	/* don't touch pLinks before all of it checked out,
+	   a broken file falls back to linking */
+	links = gi.TagMalloc(nav.num_nodes * sizeof(nav_plink_t), TAG_LEVEL);
+
+	if (fread(links, sizeof(nav_plink_t), nav.num_nodes, pIn) != nav.num_nodes)
+	{
+		Com_Printf("%s: broken link cache %s\n", __func__, filename);
+		gi.TagFree(links);
+		fclose(pIn);
+		return false;
+	}
+
+	fclose(pIn);
+
+	for (i = 0; i < nav.num_nodes; i++)
+	{
+		if (links[i].numLinks < 0 || links[i].numLinks > NODES_MAX_PLINKS)
+		{
+			Com_Printf("%s: broken link cache %s links count\n", __func__, filename);
+			gi.TagFree(links);
+			return false;
+		}
+
+		for (j = 0; j < links[i].numLinks; j++)
+		{
+			if (links[i].nodes[j] < 0 || links[i].nodes[j] >= nav.num_nodes)
+			{
+				Com_Printf("%s: broken link cache %s link target\n", __func__, filename);
+				gi.TagFree(links);
+				return false;
+			}
+		}
+	}
+
+	memcpy(pLinks, links, nav.num_nodes * sizeof(nav_plink_t));
+	gi.TagFree(links);
+	AStar_FlushCache();
+
+	*newlinks = header.newlinks;
+	*newjumplinks = header.newjumplinks;
+
+	return true;
+}
+
+//==========================================
+// AI_SaveLinkCache
+//==========================================
+static void
+AI_SaveLinkCache(const char *filename, int mapchecksum, unsigned int key,
+	int newlinks, int newjumplinks)
+{
+	linkcacheheader_t header;
+	FILE *pOut;
+
+	gi.CreatePath(filename);
+	pOut = Q_fopen(filename, "wb");
+	if (!pOut)
+	{
+		Com_Printf("AI: Failed to store: %s\n", filename);
+		return;
+	}
+
+	header.ident = LINKCACHE_IDENT;
+	header.version = LINKCACHE_VERSION;
+	header.mapchecksum = mapchecksum;
+	header.key = key;
+	header.numnodes = nav.num_nodes;
+	header.newlinks = newlinks;
+	header.newjumplinks = newjumplinks;
+
+	fwrite(&header, sizeof(header), 1, pOut);
+	fwrite(pLinks, sizeof(nav_plink_t), nav.num_nodes, pOut);
+	fclose(pOut);
+}
+
 void
 AI_CleanNodesAndLinks(void)
 {
 	nav.num_nodes = 0;
 	memset(nodes, 0, sizeof(nav_node_t) * MAX_NODES);
 	memset(pLinks, 0, sizeof(nav_plink_t) * MAX_NODES);
+	AStar_FlushCache();
+	AI_DropNavTable();
 }
 
 //==========================================
@@ -1036,6 +1201,10 @@ AI_InitNavigationData(void)
 	int newjumplinks;
 	int linkscount;
 	int	servernodesstart = 0;
+	char cachename[MAX_OSPATH];
+	int mapchecksum;
+	unsigned int key;
+	clock_t start;
 
 	AI_CleanNodesAndLinks();
 
@@ -1056,8 +1225,27 @@ AI_InitNavigationData(void)
 
 	//create nodes for map entities
 	AI_CreateNodesForEntities();
-	newlinks = AI_LinkServerNodes(servernodesstart);
-	newjumplinks = AI_LinkCloseNodes_JumpPass(servernodesstart);
+
+	//link them, or take the links from the last time
+	Com_sprintf(cachename, sizeof(cachename), "%s/%s/%s.%s",
+		gi.Gamedir(), AI_NODES_FOLDER, level.mapname, LINKCACHE_EXTENSION);
+	mapchecksum = (int)strtol(gi.GetConfigString(CS_MAPCHECKSUM), NULL, 10);
+	key = AI_LinkCacheKey();
+
+	if (AI_LoadLinkCache(cachename, mapchecksum, key, &newlinks, &newjumplinks))
+	{
+		Com_Printf("AI: Loaded server links from cache.\n");
+	}
+	else
+	{
+		start = clock();
+		newlinks = AI_LinkServerNodes(servernodesstart);
+		newjumplinks = AI_LinkCloseNodes_JumpPass(servernodesstart);
+		Com_Printf("AI: Linked server nodes in %.1f ms.\n",
+			(double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+
+		AI_SaveLinkCache(cachename, mapchecksum, key, newlinks, newjumplinks);
+	}
 
 	Com_Printf("-------------------------------------\n");
 	Com_Printf("AI: Nodes Initialized.\n");
@@ -1067,4 +1255,6 @@ AI_InitNavigationData(void)
 	Com_Printf("Loaded links: %i.\n", linkscount);
 	Com_Printf("Added links: %i.\n", newlinks);
 	Com_Printf("Added jump links: %i.\n", newjumplinks);
+
+	AI_BuildNavTable();
 }
@@ -31,9 +31,6 @@
 //
 //==========================================
 
-static int alist[MAX_NODES];	//list contains all studied nodes, Open and Closed together
-static int alist_nodesnum;
-
 typedef enum {
 	NOLIST,
 	OPENLIST,
@@ -46,10 +43,54 @@ typedef struct
 	int g;
 	int h;
 
+	/* the fields above are only valid if
+	   generation matches astar_generation */
+	unsigned int generation;
+	int seq;	//order the node was first studied in, breaks ties
+	int heappos;
 	astarnodelist_e list;
 } astarnode_t;
 
 static astarnode_t	astar_nodes[MAX_NODES];
+static unsigned int astar_generation;
+static int astar_seq;
+
+//open list, binary heap ordered by F and seq
+static int astar_heap[MAX_NODES];
+static int astar_heapsize;
+
+//==========================================
+// Recently found paths. Bots rate all items
+// from the node they stand on and then go for
+// the best one, and bots going for the
+// same items ask for the same paths
+//==========================================
+#define ASTAR_CACHE_SIZE 256
+#define ASTAR_CACHE_MAXNODES 128
+
+typedef struct
+{
+	int origin;
+	int goal;
+	int movetypes;
+	qboolean found;
+	int numNodes;
+	int nodes[ASTAR_CACHE_MAXNODES];
+	unsigned int lastused;
+	unsigned int version;
+} astarcache_t;
+
+static astarcache_t astar_cache[ASTAR_CACHE_SIZE];
+static unsigned int astar_cachetime;
+static unsigned int astar_cacheversion;	//bumped when nodes or links change
+
+static struct
+{
+	unsigned int searches;
+	unsigned int hits;
+	unsigned int expanded;
+	unsigned int failed;
+} astar_stats;
 
 //==========================================
 //
@@ -84,13 +125,27 @@ AStar_IsValidNode(int node)
 	return (node >= 0 && node < MAX_NODES);
 }
 
+/*
+ * List of the node in the current search.
+ */
+static inline astarnodelist_e
+AStar_NodeList(int node)
+{
+	if (astar_nodes[node].generation != astar_generation)
+	{
+		return NOLIST;
+	}
+
+	return astar_nodes[node].list;
+}
+
 /*
  * Check if a node is in the Closed list.
  */
 static inline qboolean
 AStar_nodeIsInClosed(int node)
 {
-	return (AStar_IsValidNode(node) && astar_nodes[node].list == CLOSEDLIST);
+	return (AStar_IsValidNode(node) && AStar_NodeList(node) == CLOSEDLIST);
 }
 
 /*
@@ -99,24 +154,158 @@ AStar_nodeIsInClosed(int node)
 static inline qboolean
 AStar_nodeIsInOpen(int node)
 {
-	return (AStar_IsValidNode(node) && astar_nodes[node].list == OPENLIST);
+	return (AStar_IsValidNode(node) && AStar_NodeList(node) == OPENLIST);
 }
 
+/*
+ * Starts a new search. Instead of clearing all
+ * nodes the generation is bumped, which makes
+ * the state of all of them stale at once.
+ */
 static void
 AStar_InitLists(void)
 {
-	size_t i;
+	astar_generation++;
+
+	if (!astar_generation)
+	{
+		/* wrapped, old stamps could match again */
+		memset(astar_nodes, 0, sizeof(astar_nodes));
+		astar_generation = 1;
+	}
+
+	astar_seq = 0;
+	astar_heapsize = 0;
+}
+
+/*
+ * Makes node part of the current search.
+ */
+static void
+AStar_StudyNode(int node)
+{
+	if (astar_nodes[node].generation == astar_generation)
+	{
+		return;
+	}
+
+	astar_nodes[node].generation = astar_generation;
+	astar_nodes[node].g = 0;
+	astar_nodes[node].h = 0;
+	astar_nodes[node].parent = 0;
+	astar_nodes[node].list = NOLIST;
+	astar_nodes[node].seq = astar_seq++;
+	astar_nodes[node].heappos = -1;
+}
+
+/*
+ * True if a is a better pick than b. Lower F
+ * wins, on a tie the node studied first, like
+ * the linear scan over all nodes used to do.
+ */
+static inline qboolean
+AStar_HeapLess(int a, int b)
+{
+	int fa = astar_nodes[a].g + astar_nodes[a].h;
+	int fb = astar_nodes[b].g + astar_nodes[b].h;
+
+	if (fa != fb)
+	{
+		return fa < fb;
+	}
+
+	return astar_nodes[a].seq < astar_nodes[b].seq;
+}
+
+static void
+AStar_HeapSet(int pos, int node)
+{
+	astar_heap[pos] = node;
+	astar_nodes[node].heappos = pos;
+}
+
+static void
+AStar_HeapUp(int pos)
+{
+	int node = astar_heap[pos];
+
+	while (pos > 0)
+	{
+		int parent = (pos - 1) / 2;
+
+		if (!AStar_HeapLess(node, astar_heap[parent]))
+		{
+			break;
+		}
+
+		AStar_HeapSet(pos, astar_heap[parent]);
+		pos = parent;
+	}
+
+	AStar_HeapSet(pos, node);
+}
 
-	for (i = 0; i < MAX_NODES; i++)
+static void
+AStar_HeapDown(int pos)
+{
+	int node = astar_heap[pos];
+
+	while (1)
 	{
-		astar_nodes[i].g = 0;
-		astar_nodes[i].h = 0;
-		astar_nodes[i].parent = 0;
-		astar_nodes[i].list = NOLIST;
+		int child = pos * 2 + 1;
+
+		if (child >= astar_heapsize)
+		{
+			break;
+		}
+
+		if (child + 1 < astar_heapsize &&
+			AStar_HeapLess(astar_heap[child + 1], astar_heap[child]))
+		{
+			child++;
+		}
+
+		if (!AStar_HeapLess(astar_heap[child], node))
+		{
+			break;
+		}
+
+		AStar_HeapSet(pos, astar_heap[child]);
+		pos = child;
 	}
 
-	alist_nodesnum = 0;
-	memset(alist, -1, sizeof(alist));
+	AStar_HeapSet(pos, node);
+}
+
+static void
+AStar_HeapPush(int node)
+{
+	AStar_HeapSet(astar_heapsize, node);
+	astar_heapsize++;
+	AStar_HeapUp(astar_heapsize - 1);
+}
+
+static int
+AStar_HeapPop(void)
+{
+	int best;
+
+	if (!astar_heapsize)
+	{
+		return -1;
+	}
+
+	best = astar_heap[0];
+	astar_nodes[best].heappos = -1;
+	astar_heapsize--;
+
+	if (astar_heapsize)
+	{
+		AStar_HeapSet(0, astar_heap[astar_heapsize]);
+		AStar_HeapDown(0);
+	}
+
+	return best;
 }
 
 static int
@@ -191,12 +380,7 @@ AStar_PutInClosed(int node)
 		return;
 	}
 
-	if (!astar_nodes[node].list)
-	{
-		alist[alist_nodesnum] = node;
-		alist_nodesnum++;
-	}
-
+	AStar_StudyNode(node);
 	astar_nodes[node].list = CLOSEDLIST;
 }
 
@@ -256,6 +440,7 @@ AStar_PutAdjacentsInOpen(int node)
 			{
 				astar_nodes[addnode].parent = node;
 				astar_nodes[addnode].g = astar_nodes[node].g + plink_dist;
+				AStar_HeapUp(astar_nodes[addnode].heappos);
 			}
 		}
 		else
@@ -280,16 +465,13 @@ AStar_PutAdjacentsInOpen(int node)
 			}
 
 			// put in global list
-			if (!astar_nodes[addnode].list)
-			{
-				alist[alist_nodesnum] = addnode;
-				alist_nodesnum++;
-			}
+			AStar_StudyNode(addnode);
 
 			astar_nodes[addnode].parent = node;
 			astar_nodes[addnode].g = astar_nodes[node].g + plink_dist;
 			astar_nodes[addnode].h = Astar_HDist_ManhatanGuess( addnode );
 			astar_nodes[addnode].list = OPENLIST;
+			AStar_HeapPush(addnode);
 		}
 	}
 }
@@ -297,25 +479,9 @@ AStar_PutAdjacentsInOpen(int node)
 static int
 AStar_FindInOpen_BestF(void)
 {
-	size_t i;
-	int	bestF = -1;
-	int best = -1;
-
-	for (i = 0; i < alist_nodesnum; i++)
-	{
-		int node = alist[i];
+	int best;
 
-		if (!AStar_IsValidNode(node) || astar_nodes[node].list != OPENLIST)
-		{
-			continue;
-		}
-
-		if (bestF < 0 || bestF > (astar_nodes[node].g + astar_nodes[node].h))
-		{
-			bestF = astar_nodes[node].g + astar_nodes[node].h;
-			best = node;
-		}
-	}
+	best = AStar_HeapPop();
 
 	if (bot_debugmonster->value)
 	{
@@ -353,6 +519,8 @@ AStar_ListsToPath(struct astarpath_s *astar_path)
 static qboolean
 AStar_FillLists(void)
 {
+	astar_stats.expanded++;
+
 	// put current node inside closed list
 	AStar_PutInClosed(currentNode);
 
@@ -373,6 +541,13 @@ AStar_ResolvePath(int origin, int goal, int movetypes, struct astarpath_s *path)
 		return false;
 	}
 
+	// the origin goes to the closed list first, so the
+	// search would only end after trying every node
+	if (origin == goal)
+	{
+		return false;
+	}
+
 	ValidLinksMask = movetypes;
 	if (!ValidLinksMask)
 	{
@@ -397,12 +572,146 @@ AStar_ResolvePath(int origin, int goal, int movetypes, struct astarpath_s *path)
 	return true;
 }
 
+static astarcache_t *
+AStar_CacheFind(int origin, int goal, int movetypes)
+{
+	size_t i;
+
+	for (i = 0; i < ASTAR_CACHE_SIZE; i++)
+	{
+		astarcache_t *entry = &astar_cache[i];
+
+		if (entry->origin == origin && entry->goal == goal &&
+			entry->movetypes == movetypes && entry->lastused &&
+			entry->version == astar_cacheversion)
+		{
+			entry->lastused = ++astar_cachetime;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+AStar_CacheStore(int origin, int goal, int movetypes, qboolean found,
+	const struct astarpath_s *path)
+{
+	astarcache_t *entry;
+	size_t i;
+
+	if (found && path->numNodes + 1 > ASTAR_CACHE_MAXNODES)
+	{
+		return;	//too long to keep
+	}
+
+	// replace an outdated or the least recently used one
+	entry = &astar_cache[0];
+
+	for (i = 0; i < ASTAR_CACHE_SIZE; i++)
+	{
+		if (astar_cache[i].version != astar_cacheversion)
+		{
+			entry = &astar_cache[i];
+			break;
+		}
+
+		if (astar_cache[i].lastused < entry->lastused)
+		{
+			entry = &astar_cache[i];
+		}
+	}
+
+	entry->origin = origin;
+	entry->goal = goal;
+	entry->movetypes = movetypes;
+	entry->found = found;
+	entry->lastused = ++astar_cachetime;
+	entry->version = astar_cacheversion;
+
+	if (found)
+	{
+		entry->numNodes = path->numNodes;
+		memcpy(entry->nodes, path->nodes,
+			(path->numNodes + 1) * sizeof(path->nodes[0]));
+	}
+}
+
+/*
+ * Forgets all cached paths, must be called
+ * whenever nodes or links change. Cheap, the
+ * link building calls it for every new link.
+ */
+void
+AStar_FlushCache(void)
+{
+	astar_cacheversion++;
+}
+
+/*
+ * Prints the path finding statistics,
+ * used by the "sv astarstats" command.
+ */
+void
+AStar_Stats(qboolean reset)
+{
+	Com_Printf("A*: %u searches, %u from the cache (%.1f%%), %u failed\n",
+		astar_stats.searches, astar_stats.hits,
+		astar_stats.searches ? 100.0f * astar_stats.hits / astar_stats.searches : 0,
+		astar_stats.failed);
+	Com_Printf("%u nodes expanded, %.1f per search\n", astar_stats.expanded,
+		(astar_stats.searches > astar_stats.hits) ? (float)astar_stats.expanded /
+			(astar_stats.searches - astar_stats.hits) : 0);
+
+	if (reset)
+	{
+		memset(&astar_stats, 0, sizeof(astar_stats));
+	}
+}
+
 qboolean
 AStar_GetPath(int origin, int goal, int movetypes, struct astarpath_s *path)
 {
-	if (!AStar_ResolvePath(origin, goal, movetypes, path))
+	astarcache_t *cached;
+	qboolean found;
+
+	if (!movetypes)
 	{
-		return false;
+		movetypes = DEFAULT_MOVETYPES_MASK;
+	}
+
+	astar_stats.searches++;
+
+	cached = AStar_CacheFind(origin, goal, movetypes);
+
+	if (cached)
+	{
+		astar_stats.hits++;
+
+		if (!cached->found)
+		{
+			astar_stats.failed++;
+			return false;
+		}
+
+		path->numNodes = cached->numNodes;
+		memcpy(path->nodes, cached->nodes,
+			(cached->numNodes + 1) * sizeof(path->nodes[0]));
+	}
+	else
+	{
+		found = AStar_ResolvePath(origin, goal, movetypes, path);
+
+		if (origin >= 0 && goal >= 0)
+		{
+			AStar_CacheStore(origin, goal, movetypes, found, path);
+		}
+
+		if (!found)
+		{
+			astar_stats.failed++;
+			return false;
+		}
 	}
 
 	path->originNode = origin;
@@ -36,6 +36,50 @@ static qboolean enemy_infront;
 static int enemy_range;
 static float enemy_yaw;
 
+/*
+ * Results of visible(). A MASK_OPAQUE trace only
+ * hits the world and brush models, so a result
+ * stays good until one of the eye spots moves or
+ * a brush model is linked across the line. The
+ * latter is caught by wrapping gi.linkentity().
+ */
+#define VISCACHE_SIZE 2048 /* must be a power of two */
+#define VISCACHE_PROBES 8
+
+typedef struct
+{
+	qboolean valid;
+	qboolean visible;
+	int lastused; /* framenum */
+	short self;
+	short other;
+	vec3_t spot1;
+	vec3_t spot2;
+	vec3_t mins;
+	vec3_t maxs;
+} visentry_t;
+
+static visentry_t viscache[VISCACHE_SIZE];
+static int viscache_count;
+
+/* solid + 1 of each brush model when it was last
+   linked, 0 if unknown. Grown with game.maxentities */
+static byte *vis_linksolid;
+static int vis_linksolid_size;
+
+static void (*vis_linkentity)(edict_t *ent);
+static void (*vis_unlinkentity)(edict_t *ent);
+
+static struct
+{
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int moved; /* cached, but one of the eyes moved */
+	unsigned int blocked; /* dropped because a brush model moved */
+	unsigned int evicted;
+	float start;
+} vis_stats;
+
 /* ========================================================================== */
 
 /*
@@ -416,6 +460,191 @@ ai_range(edict_t *self, edict_t *other)
 	return RANGE_FAR;
 }
 
+/*
+ * Finds the cache slot for self looking at other.
+ * Returns the matching entry if there's one,
+ * otherwise a slot to overwrite.
+ */
+static visentry_t *
+VisCacheLookup(const edict_t *self, const edict_t *other)
+{
+	visentry_t *entry, *victim;
+	unsigned int hash;
+	int i;
+
+	hash = (unsigned int)(self - g_edicts) * 2654435761u ^
+		(unsigned int)(other - g_edicts) * 40503u;
+	victim = NULL;
+
+	for (i = 0; i < VISCACHE_PROBES; i++)
+	{
+		entry = &viscache[(hash + i) & (VISCACHE_SIZE - 1)];
+
+		if (!entry->valid)
+		{
+			if (!victim || victim->valid)
+			{
+				victim = entry;
+			}
+
+			continue;
+		}
+
+		if ((entry->self == self - g_edicts) &&
+			(entry->other == other - g_edicts))
+		{
+			return entry;
+		}
+
+		if (!victim || (victim->valid && (entry->lastused < victim->lastused)))
+		{
+			victim = entry;
+		}
+	}
+
+	if (victim->valid)
+	{
+		vis_stats.evicted++;
+		victim->valid = false;
+		viscache_count--;
+	}
+
+	return victim;
+}
+
+/*
+ * Drops all results whose line of sight
+ * crosses the box of a brush model.
+ */
+static void
+VisCacheBlock(const vec3_t absmin, const vec3_t absmax)
+{
+	visentry_t *entry;
+	int i;
+
+	for (i = 0; i < VISCACHE_SIZE && viscache_count; i++)
+	{
+		entry = &viscache[i];
+
+		if (!entry->valid ||
+			(entry->mins[0] > absmax[0]) || (entry->maxs[0] < absmin[0]) ||
+			(entry->mins[1] > absmax[1]) || (entry->maxs[1] < absmin[1]) ||
+			(entry->mins[2] > absmax[2]) || (entry->maxs[2] < absmin[2]))
+		{
+			continue;
+		}
+
+		entry->valid = false;
+		viscache_count--;
+		vis_stats.blocked++;
+	}
+}
+
+static qboolean
+VisCacheBrush(const edict_t *ent)
+{
+	return (ent->solid == SOLID_BSP) ||
+		(ent->model && (ent->model[0] == '*'));
+}
+
+/*
+ * gi.linkentity() and gi.unlinkentity() go through
+ * here, the box is checked before and after the
+ * move since the brush model left one place and
+ * arrived in another. Most relinks of brush models
+ * don't move them or change their solidity, those
+ * keep the cache as it is. The solidity is set
+ * before gi.linkentity() is called, so the one of
+ * the last link is remembered.
+ */
+static void
+VisCacheLinkEntity(edict_t *ent)
+{
+	vec3_t origin, angles, absmin, absmax;
+	qboolean linked;
+	int index, solid;
+
+	index = ent - g_edicts;
+
+	if (!VisCacheBrush(ent) || (index < 0) || (index >= game.maxentities))
+	{
+		vis_linkentity(ent);
+		return;
+	}
+
+	if (vis_linksolid_size < game.maxentities)
+	{
+		if (vis_linksolid_size)
+		{
+			gi.TagFree(vis_linksolid);
+		}
+
+		vis_linksolid = gi.TagMalloc(game.maxentities, TAG_GAME);
+		vis_linksolid_size = game.maxentities;
+	}
+
+	linked = (ent->area.prev != NULL);
+	solid = vis_linksolid[index];
+	VectorCopy(ent->s.origin, origin);
+	VectorCopy(ent->s.angles, angles);
+	VectorCopy(ent->absmin, absmin);
+	VectorCopy(ent->absmax, absmax);
+
+	vis_linkentity(ent);
+
+	vis_linksolid[index] = ent->solid + 1;
+
+	if (!viscache_count)
+	{
+		return;
+	}
+
+	/* the box of a rotating brush model doesn't
+	   change, so the origin and angles are needed.
+	   A func_wall vanishes with the same box. */
+	if (linked && (ent->area.prev != NULL) &&
+		(solid == vis_linksolid[index]) &&
+		VectorCompare(origin, ent->s.origin) &&
+		VectorCompare(angles, ent->s.angles) &&
+		VectorCompare(absmin, ent->absmin) &&
+		VectorCompare(absmax, ent->absmax))
+	{
+		return;
+	}
+
+	if (linked)
+	{
+		VisCacheBlock(absmin, absmax);
+	}
+
+	VisCacheBlock(ent->absmin, ent->absmax);
+}
+
+static void
+VisCacheUnlinkEntity(edict_t *ent)
+{
+	if (viscache_count && VisCacheBrush(ent) && ent->area.prev)
+	{
+		VisCacheBlock(ent->absmin, ent->absmax);
+	}
+
+	vis_unlinkentity(ent);
+}
+
+/*
+ * Called from GetGameAPI() right after gi was
+ * filled, puts the wrappers above in place.
+ */
+void
+G_HookVisCache(void)
+{
+	vis_linkentity = gi.linkentity;
+	vis_unlinkentity = gi.unlinkentity;
+
+	gi.linkentity = VisCacheLinkEntity;
+	gi.unlinkentity = VisCacheUnlinkEntity;
+}
+
 /*
  * returns 1 if the entity is visible
  * to self, even if not infront
@@ -426,6 +655,8 @@ visible(const edict_t *self, const edict_t *other)
 	vec3_t spot1;
 	vec3_t spot2;
 	trace_t trace;
+	visentry_t *entry;
+	int i;
 
 	if (!self || !other)
 	{
@@ -448,14 +679,113 @@ visible(const edict_t *self, const edict_t *other)
 	spot1[2] += self->viewheight;
 	VectorCopy(other->s.origin, spot2);
 	spot2[2] += other->viewheight;
-	trace = gi.trace(spot1, vec3_origin, vec3_origin, spot2, self, MASK_OPAQUE);
 
-	if ((trace.fraction == 1.0) || (trace.ent == other))
+	if (!g_viscache->value)
 	{
-		return true;
+		trace = gi.trace(spot1, vec3_origin, vec3_origin, spot2,
+				self, MASK_OPAQUE);
+
+		return (trace.fraction == 1.0) || (trace.ent == other);
 	}
 
-	return false;
+	entry = VisCacheLookup(self, other);
+
+	if (entry->valid)
+	{
+		if (VectorCompare(entry->spot1, spot1) &&
+			VectorCompare(entry->spot2, spot2))
+		{
+			vis_stats.hits++;
+			entry->lastused = level.framenum;
+
+			return entry->visible;
+		}
+
+		vis_stats.moved++;
+	}
+	else
+	{
+		vis_stats.misses++;
+		entry->valid = true;
+		viscache_count++;
+	}
+
+	trace = gi.trace(spot1, vec3_origin, vec3_origin, spot2,
+			self, MASK_OPAQUE);
+
+	entry->visible = (trace.fraction == 1.0) || (trace.ent == other);
+	entry->lastused = level.framenum;
+	entry->self = self - g_edicts;
+	entry->other = other - g_edicts;
+	VectorCopy(spot1, entry->spot1);
+	VectorCopy(spot2, entry->spot2);
+
+	for (i = 0; i < 3; i++)
+	{
+		entry->mins[i] = Q_min(spot1[i], spot2[i]);
+		entry->maxs[i] = Q_max(spot1[i], spot2[i]);
+	}
+
+	return entry->visible;
+}
+
+/*
+ * Called when the game dll is loaded, the
+ * solidities were freed with TAG_GAME.
+ */
+void
+G_InitVisCache(void)
+{
+	vis_linksolid = NULL;
+	vis_linksolid_size = 0;
+}
+
+/*
+ * Forgets all cached results, needed when
+ * a new level is spawned or loaded.
+ */
+void
+G_ResetVisCache(void)
+{
+	memset(viscache, 0, sizeof(viscache));
+	viscache_count = 0;
+
+	memset(&vis_stats, 0, sizeof(vis_stats));
+	vis_stats.start = level.time;
+}
+
+/*
+ * Prints the hit rate of the visible() cache,
+ * used by the "sv visstats" command.
+ */
+void
+G_VisStats(qboolean reset)
+{
+	unsigned int total;
+	float seconds;
+
+	total = vis_stats.hits + vis_stats.misses + vis_stats.moved;
+	seconds = Q_max(level.time - vis_stats.start, FRAMETIME);
+
+	gi.cprintf(NULL, PRINT_HIGH, "g_viscache %d: %u checks in %.1f seconds "
+		"(%.1f per frame)\n", (int)g_viscache->value, total, seconds,
+		total * FRAMETIME / seconds);
+
+	if (total)
+	{
+		gi.cprintf(NULL, PRINT_HIGH, "%u hits (%.1f%%), %u misses, %u moved\n",
+			vis_stats.hits, 100.0f * vis_stats.hits / total, vis_stats.misses,
+			vis_stats.moved);
+		gi.cprintf(NULL, PRINT_HIGH, "%i cached, %u dropped by moving brush "
+			"models, %u evicted\n", viscache_count, vis_stats.blocked,
+			vis_stats.evicted);
+	}
+
+	if (reset)
+	{
+		memset(&vis_stats, 0, sizeof(vis_stats));
+		vis_stats.start = level.time;
+	}
 }
 
 /*
@@ -590,6 +920,7 @@ FoundTarget(edict_t *self)
 
 	/* clear the targetname, that point is ours! */
 	combatpoint->targetname = NULL;
+	G_IndexEdict(combatpoint);
 	self->goalentity = self->movetarget = combatpoint;
 
 	/* run for it */
@@ -743,11 +1074,8 @@ FindTarget(edict_t *self)
 			return false;
 		}
 
-		if (!visible(self, client))
-		{
-			return false;
-		}
-
+		/* the cheap tests first, the
+		   trace in visible() comes last */
 		if (r == RANGE_NEAR)
 		{
 			if ((client->show_hostile < level.time) && !infront(self, client))
@@ -763,6 +1091,11 @@ FindTarget(edict_t *self)
 			}
 		}
 
+		if (!visible(self, client))
+		{
+			return false;
+		}
+
 		self->enemy = client;
 
 		if (strcmp(self->enemy->classname, "player_noise") != 0)
@@ -724,6 +724,8 @@ T_Damage(edict_t *targ, edict_t *inflictor, edict_t *attacker, vec3_t dir,
 		return;
 	}
 
+	G_WakeEdict(targ);
+
 	sphere_notified = false;
 
 	/* friendly fire avoidance. If enabled you can't
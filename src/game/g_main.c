@@ -103,6 +103,10 @@ cvar_t *g_machinegun_norecoil;
 cvar_t *g_quick_weap;
 cvar_t *g_swap_speed;
 cvar_t *g_itemsbobeffect;
+cvar_t *g_save_compress;
+cvar_t *sv_features;
+cvar_t *g_thinkwheel;
+cvar_t *g_viscache;
 cvar_t *g_start_items;
 cvar_t *ai_model_scale;
 cvar_t *g_game;
@@ -130,6 +134,7 @@ Q2_DLL_EXPORTED game_export_t *
 GetGameAPI(const game_import_t *import)
 {
 	gi = *import;
+	G_HookVisCache();
 
 	globals.apiversion = GAME_API_VERSION;
 	globals.Init = InitGame;
@@ -477,6 +482,8 @@ G_RunFrame(void)
 	level.framenum++;
 	level.time = level.framenum * FRAMETIME;
 
+	G_SweepFindIndex();
+
 	gibsthisframe = 0;
 	debristhisframe = 0;
 
@@ -490,6 +497,9 @@ G_RunFrame(void)
 		return;
 	}
 
+	G_AdvanceThinkWheel();
+	G_CheckThinkWheel();
+
 	/* treat each object in turn
 	   even the world gets a chance
 	   to think */
@@ -497,7 +507,7 @@ G_RunFrame(void)
 
 	for (i = 0; i < globals.num_edicts; i++, ent++)
 	{
-		if (!ent->inuse)
+		if (G_EdictAsleep(i) || !ent->inuse)
 		{
 			continue;
 		}
@@ -529,6 +539,7 @@ G_RunFrame(void)
 		}
 
 		G_RunEntity(ent);
+		G_SleepEdict(ent);
 	}
 
 	/* see if it is time to end a deathmatch */
@@ -326,6 +326,7 @@ ThrowHead(edict_t *self, const char *gibname, int damage, gibtype_t type)
 	self->svflags &= ~SVF_MONSTER;
 	self->takedamage = DAMAGE_YES;
 	self->targetname = NULL;
+	G_IndexEdict(self);
 	self->die = gib_die;
 
 	// The entity still has the monsters clipmaks.
@@ -25,6 +25,8 @@
  * =======================================================================
  */
 
+#include <limits.h>
+
 #include "header/local.h"
 
 #define STOP_EPSILON 0.1
@@ -154,11 +156,13 @@ SV_Impact(edict_t *e1, trace_t *trace)
 
 	if (e1->touch && (e1->solid != SOLID_NOT))
 	{
+		G_WakeEdict(e1);
 		e1->touch(e1, e2, &trace->plane, trace->surface);
 	}
 
 	if (e2->touch && (e2->solid != SOLID_NOT))
 	{
+		G_WakeEdict(e2);
 		e2->touch(e2, e1, NULL, NULL);
 	}
 }
@@ -1693,3 +1697,451 @@ SV_Physics_NewToss(edict_t *ent)
 		gi.linkentity(slave);
 	}
 }
+
+/* ================================================================== */
+
+/* THINK WHEEL */
+
+/*
+ * With g_thinkwheel set, entities that only wait for
+ * their next think (MOVETYPE_NONE, no prethink, no
+ * animation, no ground or team) are taken out of the
+ * frame loop and parked in a timer wheel keyed by
+ * the frame their think is due. The frame loop
+ * still walks the edicts in order, so a parked
+ * entity that comes due thinks at the same place
+ * as before.
+ *
+ * Everything that changes another entity from the
+ * outside has to wake it with G_WakeEdict(). The
+ * callback dispatchers (use, touch, pain, die) and
+ * G_InitEdict() / G_FreeEdict() already do that.
+ * g_thinkwheel 2 checks the parked entities every
+ * frame and reports the ones that were changed
+ * without being woken.
+ */
+
+#define WHEEL_NEAR_BITS 8
+#define WHEEL_NEAR (1 << WHEEL_NEAR_BITS) /* frames */
+#define WHEEL_FAR 64 /* blocks of WHEEL_NEAR frames */
+
+#define WHEEL_AWAKE 0
+#define WHEEL_PARKED 1 /* no think pending */
+#define WHEEL_QUEUED 2 /* in a slot, waiting for wheel_due */
+
+#define WHEEL_OVERFLOW (WHEEL_NEAR + WHEEL_FAR)
+
+typedef struct
+{
+	/* per edict */
+	byte *state;
+	int *due;
+	int *next;
+	int *prev;
+	short *slot;
+
+	/* near slots, far slots and the overflow list */
+	int head[WHEEL_NEAR + WHEEL_FAR + 1];
+
+	int size;
+	int framenum; /* last frame the wheel was advanced to */
+	int sleeping;
+
+	/* counters for sv thinkstats */
+	unsigned int skipped;
+	unsigned int frames;
+	unsigned int timerwakes;
+	unsigned int hookwakes;
+} thinkwheel_t;
+
+static thinkwheel_t wheel;
+
+/*
+ * Same test as SV_RunThink(), for an arbitrary frame.
+ */
+static qboolean
+G_ThinkPending(float thinktime, int framenum)
+{
+	float time;
+
+	time = framenum * FRAMETIME;
+
+	return thinktime > time + 0.001;
+}
+
+/*
+ * First frame after framenum that runs the think,
+ * or -1 if none is pending or it's too far away.
+ */
+static int
+G_ThinkDueFrame(float thinktime, int framenum)
+{
+	int due;
+
+	if ((thinktime <= 0) || (thinktime > (INT_MAX / 4) * FRAMETIME))
+	{
+		return -1;
+	}
+
+	due = (int)(thinktime / FRAMETIME) - 1;
+
+	if (due <= framenum)
+	{
+		due = framenum + 1;
+	}
+
+	while (G_ThinkPending(thinktime, due))
+	{
+		due++;
+	}
+
+	return due;
+}
+
+static void
+G_WheelUnlink(int num)
+{
+	int slot;
+
+	slot = wheel.slot[num];
+
+	if (wheel.prev[num] >= 0)
+	{
+		wheel.next[wheel.prev[num]] = wheel.next[num];
+	}
+	else
+	{
+		wheel.head[slot] = wheel.next[num];
+	}
+
+	if (wheel.next[num] >= 0)
+	{
+		wheel.prev[wheel.next[num]] = wheel.prev[num];
+	}
+}
+
+static void
+G_WheelLink(int num)
+{
+	int slot, delta;
+
+	delta = (wheel.due[num] >> WHEEL_NEAR_BITS) -
+		(wheel.framenum >> WHEEL_NEAR_BITS);
+
+	if (wheel.due[num] - wheel.framenum < WHEEL_NEAR)
+	{
+		slot = wheel.due[num] & (WHEEL_NEAR - 1);
+	}
+	else if (delta > 0 && delta < WHEEL_FAR)
+	{
+		slot = WHEEL_NEAR + ((wheel.due[num] >> WHEEL_NEAR_BITS) & (WHEEL_FAR - 1));
+	}
+	else
+	{
+		slot = WHEEL_OVERFLOW;
+	}
+
+	wheel.slot[num] = slot;
+	wheel.prev[num] = -1;
+	wheel.next[num] = wheel.head[slot];
+
+	if (wheel.head[slot] >= 0)
+	{
+		wheel.prev[wheel.head[slot]] = num;
+	}
+
+	wheel.head[slot] = num;
+}
+
+/*
+ * Relinks everything in slot, things that are
+ * due by now are woken up.
+ */
+static void
+G_WheelCascade(int slot)
+{
+	int num, next;
+
+	num = wheel.head[slot];
+	wheel.head[slot] = -1;
+
+	for ( ; num >= 0; num = next)
+	{
+		next = wheel.next[num];
+
+		if (wheel.due[num] <= wheel.framenum)
+		{
+			wheel.state[num] = WHEEL_AWAKE;
+			wheel.sleeping--;
+			wheel.timerwakes++;
+		}
+		else
+		{
+			G_WheelLink(num);
+		}
+	}
+}
+
+/*
+ * Puts ent back into the frame loop.
+ */
+void
+G_WakeEdict(edict_t *ent)
+{
+	int num;
+
+	if (!ent || !wheel.sleeping)
+	{
+		return;
+	}
+
+	num = ent - g_edicts;
+
+	if ((num < 0) || (num >= wheel.size) || (wheel.state[num] == WHEEL_AWAKE))
+	{
+		return;
+	}
+
+	if (wheel.state[num] == WHEEL_QUEUED)
+	{
+		G_WheelUnlink(num);
+	}
+
+	wheel.state[num] = WHEEL_AWAKE;
+	wheel.sleeping--;
+	wheel.hookwakes++;
+}
+
+/*
+ * Wakes everything, needed when the edicts were
+ * cleared or loaded or the wheel was switched off.
+ */
+void
+G_ResetThinkWheel(void)
+{
+	int i;
+
+	if (wheel.size < game.maxentities)
+	{
+		if (wheel.size)
+		{
+			gi.TagFree(wheel.due);
+		}
+
+		/* one block for all per edict arrays */
+		wheel.due = gi.TagMalloc(game.maxentities * (3 * sizeof(int) +
+			sizeof(short) + sizeof(byte)), TAG_GAME);
+		wheel.next = wheel.due + game.maxentities;
+		wheel.prev = wheel.next + game.maxentities;
+		wheel.slot = (short *)(wheel.prev + game.maxentities);
+		wheel.state = (byte *)(wheel.slot + game.maxentities);
+		wheel.size = game.maxentities;
+	}
+
+	memset(wheel.state, WHEEL_AWAKE, wheel.size);
+
+	for (i = 0; i < WHEEL_OVERFLOW + 1; i++)
+	{
+		wheel.head[i] = -1;
+	}
+
+	wheel.framenum = level.framenum;
+	wheel.sleeping = 0;
+	wheel.skipped = 0;
+	wheel.frames = 0;
+	wheel.timerwakes = 0;
+	wheel.hookwakes = 0;
+}
+
+/*
+ * Called when the game dll is loaded, the old
+ * arrays were freed with the TAG_GAME allocations.
+ */
+void
+G_InitThinkWheel(void)
+{
+	memset(&wheel, 0, sizeof(wheel));
+}
+
+/*
+ * Called once per frame before the frame loop.
+ * Wakes the entities that think in this frame.
+ */
+void
+G_AdvanceThinkWheel(void)
+{
+	if (!g_thinkwheel->value)
+	{
+		if (wheel.sleeping)
+		{
+			G_ResetThinkWheel();
+		}
+
+		return;
+	}
+
+	if (wheel.size < game.maxentities)
+	{
+		G_ResetThinkWheel();
+	}
+
+	wheel.frames++;
+
+	while (wheel.framenum < level.framenum)
+	{
+		wheel.framenum++;
+
+		if (!wheel.sleeping)
+		{
+			continue;
+		}
+
+		if (!(wheel.framenum & (WHEEL_NEAR - 1)))
+		{
+			if (!((wheel.framenum >> WHEEL_NEAR_BITS) & (WHEEL_FAR - 1)))
+			{
+				G_WheelCascade(WHEEL_OVERFLOW);
+			}
+
+			G_WheelCascade(WHEEL_NEAR +
+				((wheel.framenum >> WHEEL_NEAR_BITS) & (WHEEL_FAR - 1)));
+		}
+
+		G_WheelCascade(wheel.framenum & (WHEEL_NEAR - 1));
+	}
+}
+
+/*
+ * True if the frame loop can skip the edict.
+ */
+qboolean
+G_EdictAsleep(int num)
+{
+	if (!wheel.sleeping || (num >= wheel.size))
+	{
+		return false;
+	}
+
+	if (wheel.state[num] == WHEEL_AWAKE)
+	{
+		return false;
+	}
+
+	wheel.skipped++;
+
+	return true;
+}
+
+static qboolean
+G_CanSleep(const edict_t *ent)
+{
+	if (!ent->inuse || ent->client || ent->prethink ||
+		ent->groundentity || ent->teammaster ||
+		(ent->movetype != MOVETYPE_NONE) ||
+		ent->bmodel_anim.enabled ||
+		(ent->s.renderfx & RF_BEAM))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Called after the frame loop ran ent. Parks it if
+ * it has nothing to do until its next think.
+ */
+void
+G_SleepEdict(edict_t *ent)
+{
+	int num, due;
+
+	if (!g_thinkwheel->value || !wheel.size)
+	{
+		return;
+	}
+
+	num = ent - g_edicts;
+
+	if ((num <= game.maxclients) || (num >= wheel.size) ||
+		(wheel.state[num] != WHEEL_AWAKE) || !G_CanSleep(ent))
+	{
+		return;
+	}
+
+	if (ent->nextthink > 0)
+	{
+		due = G_ThinkDueFrame(ent->nextthink, level.framenum);
+
+		/* not worth it for things thinking every frame */
+		if ((due < 0) || (due <= level.framenum + 1))
+		{
+			return;
+		}
+
+		wheel.due[num] = due;
+		wheel.state[num] = WHEEL_QUEUED;
+		G_WheelLink(num);
+	}
+	else
+	{
+		wheel.due[num] = -1;
+		wheel.state[num] = WHEEL_PARKED;
+	}
+
+	wheel.sleeping++;
+}
+
+/*
+ * g_thinkwheel 2: checks that nothing changed
+ * the parked entities behind our back.
+ */
+void
+G_CheckThinkWheel(void)
+{
+	edict_t *ent;
+	int i, due;
+
+	if ((g_thinkwheel->value < 2) || !wheel.sleeping)
+	{
+		return;
+	}
+
+	for (i = 0; i < wheel.size && i < globals.num_edicts; i++)
+	{
+		if (wheel.state[i] == WHEEL_AWAKE)
+		{
+			continue;
+		}
+
+		ent = &g_edicts[i];
+		due = (ent->nextthink > 0) ?
+			G_ThinkDueFrame(ent->nextthink, level.framenum) : -1;
+
+		if (ent->inuse && G_CanSleep(ent) && (due == wheel.due[i]))
+		{
+			continue;
+		}
+
+		gi.dprintf("g_thinkwheel: %s (%d) was changed while asleep\n",
+			ent->classname ? ent->classname : "noclass", i);
+
+		G_WakeEdict(ent);
+	}
+}
+
+void
+G_ThinkWheelStats(void)
+{
+	gi.cprintf(NULL, PRINT_HIGH, "g_thinkwheel %d: %d of %d edicts asleep\n",
+		(int)g_thinkwheel->value, wheel.sleeping, globals.num_edicts);
+
+	if (wheel.frames)
+	{
+		gi.cprintf(NULL, PRINT_HIGH, "%.1f edicts skipped per frame over %u frames\n",
+			(float)wheel.skipped / wheel.frames, wheel.frames);
+	}
+
+	gi.cprintf(NULL, PRINT_HIGH, "%u woken by their think, %u from outside\n",
+		wheel.timerwakes, wheel.hookwakes);
+}
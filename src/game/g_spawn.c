@@ -561,6 +561,9 @@ ED_CallSpawn(edict_t *ent)
 		return;
 	}
 
+	/* respawned in place, e.g. by the medic */
+	G_WakeEdict(ent);
+
 	ent->gravityVector[0] = 0.0;
 	ent->gravityVector[1] = 0.0;
 	ent->gravityVector[2] = -1.0;
@@ -1201,14 +1204,17 @@ SpawnEntities(const char *mapname, char *entities, const char *spawnpoint)
 {
 	edict_t *ent;
 	int inhibit;
-	int i;
+	int i, count;
 	float skill_level;
+	clock_t start, spawned;
 
 	if (!mapname || !entities || !spawnpoint)
 	{
 		return;
 	}
 
+	start = clock();
+
 	skill_level = floor(skill->value);
 
 	if (skill_level < 0)
@@ -1234,6 +1240,10 @@ SpawnEntities(const char *mapname, char *entities, const char *spawnpoint)
 
 	memset(&level, 0, sizeof(level));
 	memset(g_edicts, 0, game.maxentities * sizeof(g_edicts[0]));
+	G_ResetFindIndex();
+	G_ResetFreeList();
+	G_ResetThinkWheel();
+	G_ResetVisCache();
 
 	Q_strlcpy(level.mapname, mapname, sizeof(level.mapname));
 	level.is_n64 = !strncmp(level.mapname, "q64/", 4);
@@ -1247,6 +1257,7 @@ SpawnEntities(const char *mapname, char *entities, const char *spawnpoint)
 
 	ent = NULL;
 	inhibit = 0;
+	count = 0;
 
 	/* parse ents */
 	while (1)
@@ -1277,6 +1288,7 @@ SpawnEntities(const char *mapname, char *entities, const char *spawnpoint)
 		}
 
 		entities = ED_ParseEdict(entities, ent);
+		count++;
 
 		/* yet another map hack */
 		if (!Q_stricmp(level.mapname, "command") &&
@@ -1339,8 +1351,14 @@ SpawnEntities(const char *mapname, char *entities, const char *spawnpoint)
 
 	gi.dprintf("%i entities inhibited.\n", inhibit);
 
+	spawned = clock();
+
 	G_FindTeams();
 
+	/* index everything at once instead of
+	   tracking all edicts as touched */
+	G_ResetFindIndex();
+
 	PlayerTrail_Init();
 
 	if (deathmatch->value)
@@ -1372,6 +1390,10 @@ SpawnEntities(const char *mapname, char *entities, const char *spawnpoint)
 
 	/* setup server-side shadow lights */
 	setup_shadow_lights();
+
+	gi.dprintf("%s: %i entities spawned in %.1f ms, level setup %.1f ms.\n",
+		__func__, count, (double)(spawned - start) * 1000.0 / CLOCKS_PER_SEC,
+		(double)(clock() - spawned) * 1000.0 / CLOCKS_PER_SEC);
 }
 
 /* =================================================================== */
@@ -348,6 +348,31 @@ ServerCommand(void)
 	{
 		SVCmd_WriteIP_f();
 	}
+	else if (Q_stricmp(cmd, "savebench") == 0)
+	{
+		SaveBenchmark(gi.argc() > 2 ? Q_max(atoi(gi.argv(2)), 1) : 10);
+	}
+	else if (Q_stricmp(cmd, "findbench") == 0)
+	{
+		FindBenchmark(gi.argc() > 2 ? Q_max(atoi(gi.argv(2)), 1) : 500);
+	}
+	else if (Q_stricmp(cmd, "edictstats") == 0)
+	{
+		G_EdictStats(gi.argc() > 2 && !Q_stricmp(gi.argv(2), "reset"));
+	}
+	else if (Q_stricmp(cmd, "radiusbench") == 0)
+	{
+		FindRadiusBenchmark(gi.argc() > 2 ? Q_max(atoi(gi.argv(2)), 1) : 1000,
+			gi.argc() > 3 ? (float)atof(gi.argv(3)) : 160);
+	}
+	else if (Q_stricmp(cmd, "thinkstats") == 0)
+	{
+		G_ThinkWheelStats();
+	}
+	else if (Q_stricmp(cmd, "visstats") == 0)
+	{
+		G_VisStats(gi.argc() > 2 && !Q_stricmp(gi.argv(2), "reset"));
+	}
 	/* JABot[start] */
 	else if (Q_stricmp(cmd, "addbot") == 0)
 	{
@@ -372,6 +397,10 @@ ServerCommand(void)
 	{
 		AITools_SaveNodes();
 	}
+	else if (!Q_stricmp(cmd, "astarstats"))
+	{
+		AStar_Stats(gi.argc() > 2 && !Q_stricmp(gi.argv(2), "reset"));
+	}
 	else if (Q_stricmp(cmd, "removebot") == 0)
 	{
 		BOT_RemoveBot(gi.argv(2));
@@ -1685,6 +1685,7 @@ update_target_camera_think(edict_t *self)
 
 			while ((t = G_Find(t, FOFS(targetname), self->killtarget)))
 			{
+				G_WakeEdict(t);
 				t->use(t, self, self->activator);
 			}
 
@@ -57,24 +57,331 @@ G_ProjectSource2(const vec3_t point, const vec3_t distance, const vec3_t forward
 }
 
 /*
- * Searches all active entities for the next
- * one that holds the matching string at fieldofs
- * (use the FOFS() macro) in the structure.
- *
- * Searches beginning at the edict after from, or
- * the beginning. If NULL, NULL will be returned
- * if the end of the list is reached.
+ * Index of the classnames and targetnames for G_Find().
+ * Each edict is linked into one bucket per field and the
+ * buckets are sorted by edict number, so the matches come
+ * in the same order as when scanning g_edicts. Since the
+ * fields are assigned all over the code, the edicts spawned
+ * or passed to G_IndexEdict() since the start of the frame
+ * are checked for changes before each lookup and all edicts
+ * once per frame by G_SweepFindIndex().
  */
-edict_t *
-G_Find(edict_t *from, int fieldofs, const char *match)
+#define FIND_INDEX_SIZE 1024 /* power of two */
+
+typedef struct
 {
-	const char *s;
+	size_t fieldofs;
+	int head[FIND_INDEX_SIZE];
+	int tail[FIND_INDEX_SIZE];
+	int *next;
+	int *prev;
+	int *bucket; /* -1 if not linked */
+	const char **value; /* field when linked */
+} findindex_t;
+
+static findindex_t findindex[2];
+static int *find_touched;
+static byte *find_istouched;
+static int find_numtouched;
+static int find_size;
+static qboolean find_rebuild;
+
+static unsigned int
+G_FindHash(const char *s)
+{
+	unsigned int hash = 2166136261u;
+	int c;
 
-	if (!match)
+	/* case insensitive like Q_stricmp() */
+	while ((c = *s++))
 	{
-		return NULL;
+		if ((c >= 'A') && (c <= 'Z'))
+		{
+			c += 'a' - 'A';
+		}
+
+		hash = (hash ^ c) * 16777619u;
+	}
+
+	return hash & (FIND_INDEX_SIZE - 1);
+}
+
+static void
+G_FindUnlink(findindex_t *index, int num)
+{
+	int b = index->bucket[num];
+
+	if (b < 0)
+	{
+		return;
+	}
+
+	if (index->prev[num] >= 0)
+	{
+		index->next[index->prev[num]] = index->next[num];
+	}
+	else
+	{
+		index->head[b] = index->next[num];
+	}
+
+	if (index->next[num] >= 0)
+	{
+		index->prev[index->next[num]] = index->prev[num];
+	}
+	else
+	{
+		index->tail[b] = index->prev[num];
+	}
+
+	index->bucket[num] = -1;
+	index->value[num] = NULL;
+}
+
+static void
+G_FindLink(findindex_t *index, int num, const char *value)
+{
+	int b, after;
+
+	b = G_FindHash(value);
+
+	/* most edicts are linked in ascending order */
+	after = index->tail[b];
+
+	while ((after >= 0) && (after > num))
+	{
+		after = index->prev[after];
+	}
+
+	index->prev[num] = after;
+
+	if (after >= 0)
+	{
+		index->next[num] = index->next[after];
+		index->next[after] = num;
+	}
+	else
+	{
+		index->next[num] = index->head[b];
+		index->head[b] = num;
+	}
+
+	if (index->next[num] >= 0)
+	{
+		index->prev[index->next[num]] = num;
+	}
+	else
+	{
+		index->tail[b] = num;
+	}
+
+	index->bucket[num] = b;
+	index->value[num] = value;
+}
+
+/*
+ * Relinks edict num if its fields changed. With rehash
+ * a string freed and reallocated at the same address
+ * is caught, too. That's only done once per frame.
+ */
+static void
+G_FindUpdate(int num, qboolean rehash)
+{
+	const char *value;
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		value = *(const char **)((byte *)&g_edicts[num] + findindex[i].fieldofs);
+
+		if ((value == findindex[i].value[num]) &&
+			(!rehash || !value || (G_FindHash(value) == findindex[i].bucket[num])))
+		{
+			continue;
+		}
+
+		G_FindUnlink(&findindex[i], num);
+
+		if (value)
+		{
+			G_FindLink(&findindex[i], num, value);
+		}
+	}
+}
+
+static void
+G_FindRebuild(void)
+{
+	int i, j;
+
+	if (find_size < game.maxentities)
+	{
+		for (i = 0; i < 2; i++)
+		{
+			if (find_size)
+			{
+				gi.TagFree(findindex[i].next);
+			}
+
+			/* one block for next, prev, bucket and value */
+			findindex[i].next = gi.TagMalloc(game.maxentities *
+				(sizeof(int) * 3 + sizeof(char *)), TAG_GAME);
+			findindex[i].prev = findindex[i].next + game.maxentities;
+			findindex[i].bucket = findindex[i].prev + game.maxentities;
+			findindex[i].value = (const char **)(findindex[i].bucket +
+				game.maxentities);
+		}
+
+		if (find_size)
+		{
+			gi.TagFree(find_touched);
+		}
+
+		find_touched = gi.TagMalloc(game.maxentities *
+			(sizeof(int) + sizeof(byte)), TAG_GAME);
+		find_istouched = (byte *)(find_touched + game.maxentities);
+		find_size = game.maxentities;
+	}
+
+	findindex[0].fieldofs = FOFS(classname);
+	findindex[1].fieldofs = FOFS(targetname);
+
+	for (i = 0; i < 2; i++)
+	{
+		for (j = 0; j < FIND_INDEX_SIZE; j++)
+		{
+			findindex[i].head[j] = -1;
+			findindex[i].tail[j] = -1;
+		}
+
+		for (j = 0; j < find_size; j++)
+		{
+			findindex[i].bucket[j] = -1;
+			findindex[i].value[j] = NULL;
+		}
+	}
+
+	memset(find_istouched, 0, find_size);
+	find_numtouched = 0;
+	find_rebuild = false;
+
+	for (i = 0; i < globals.num_edicts; i++)
+	{
+		G_FindUpdate(i, false);
+	}
+}
+
+/*
+ * Makes the index current before a lookup.
+ */
+static void
+G_FindSync(void)
+{
+	int i;
+
+	if (find_rebuild || (find_size < game.maxentities))
+	{
+		G_FindRebuild();
+		return;
 	}
 
+	for (i = 0; i < find_numtouched; i++)
+	{
+		G_FindUpdate(find_touched[i], false);
+	}
+}
+
+/*
+ * Drops the index, for example when g_edicts was
+ * cleared or loaded. It's rebuilt on the next lookup.
+ */
+void
+G_ResetFindIndex(void)
+{
+	find_rebuild = true;
+}
+
+/*
+ * Called when the game dll is loaded, the
+ * memory of the old index was freed with
+ * the TAG_GAME allocations.
+ */
+void
+G_InitFindIndex(void)
+{
+	memset(findindex, 0, sizeof(findindex));
+	find_touched = NULL;
+	find_istouched = NULL;
+	find_numtouched = 0;
+	find_size = 0;
+	find_rebuild = true;
+}
+
+/*
+ * Must be called after changing the classname or
+ * targetname of an edict that wasn't spawned in
+ * this frame, so G_Find() picks up the new value.
+ */
+void
+G_IndexEdict(edict_t *ent)
+{
+	int num;
+
+	if (!ent || find_rebuild)
+	{
+		return;
+	}
+
+	num = ent - g_edicts;
+
+	if (num >= find_size)
+	{
+		find_rebuild = true;
+		return;
+	}
+
+	if (!find_istouched[num])
+	{
+		find_istouched[num] = 1;
+		find_touched[find_numtouched++] = num;
+	}
+}
+
+/*
+ * Brings the whole index up to date. Called once
+ * per frame, this catches assignments that weren't
+ * followed by G_IndexEdict().
+ */
+void
+G_SweepFindIndex(void)
+{
+	int i;
+
+	if (find_rebuild || (find_size < game.maxentities))
+	{
+		G_FindRebuild();
+		return;
+	}
+
+	for (i = 0; i < find_numtouched; i++)
+	{
+		G_FindUpdate(find_touched[i], true);
+		find_istouched[find_touched[i]] = 0;
+	}
+
+	for (i = 0; i < globals.num_edicts; i++)
+	{
+		G_FindUpdate(i, false);
+	}
+
+	find_numtouched = 0;
+}
+
+static edict_t *
+G_FindScan(edict_t *from, int fieldofs, const char *match)
+{
+	const char *s;
+
 	if (!from)
 	{
 		from = g_edicts;
@@ -107,16 +414,206 @@ G_Find(edict_t *from, int fieldofs, const char *match)
 	return NULL;
 }
 
+static edict_t *
+G_FindIndexed(edict_t *from, findindex_t *index, const char *match)
+{
+	int b, num, i;
+
+	G_FindSync();
+
+	b = G_FindHash(match);
+	num = from ? from - g_edicts : -1;
+
+	if ((num >= 0) && (index->bucket[num] == b))
+	{
+		i = index->next[num];
+	}
+	else
+	{
+		for (i = index->head[b]; (i >= 0) && (i <= num); i = index->next[i])
+		{
+		}
+	}
+
+	for ( ; (i >= 0) && (i < globals.num_edicts); i = index->next[i])
+	{
+		if (g_edicts[i].inuse && !Q_stricmp(index->value[i], match))
+		{
+			return &g_edicts[i];
+		}
+	}
+
+	return NULL;
+}
+
 /*
- * Returns entities that have origins
- * within a spherical area
+ * Searches all active entities for the next
+ * one that holds the matching string at fieldofs
+ * (use the FOFS() macro) in the structure.
+ *
+ * Searches beginning at the edict after from, or
+ * the beginning. If NULL, NULL will be returned
+ * if the end of the list is reached.
  */
 edict_t *
-findradius(edict_t *from, const vec3_t org, float rad)
+G_Find(edict_t *from, int fieldofs, const char *match)
+{
+	if (!match)
+	{
+		return NULL;
+	}
+
+	if (fieldofs == FOFS(classname))
+	{
+		return G_FindIndexed(from, &findindex[0], match);
+	}
+	else if (fieldofs == FOFS(targetname))
+	{
+		return G_FindIndexed(from, &findindex[1], match);
+	}
+
+	return G_FindScan(from, fieldofs, match);
+}
+
+/*
+ * Times walking a chain of n edicts linked by
+ * target and targetname like G_UseTargets() does,
+ * once through the index and once by scanning
+ * g_edicts. Used by the "sv findbench" command.
+ */
+void
+FindBenchmark(int n)
+{
+	edict_t **chain, *t;
+	clock_t start;
+	double indexed, scanned;
+	int i, hits;
+
+	chain = gi.TagMalloc(n * sizeof(edict_t *), TAG_LEVEL);
+
+	for (i = 0; i < n; i++)
+	{
+		if (globals.num_edicts >= game.maxentities - 1)
+		{
+			n = i;
+			break;
+		}
+
+		chain[i] = G_Spawn();
+		chain[i]->classname = "findbench";
+		chain[i]->targetname = G_CopyString(va("findbench%d", i), TAG_LEVEL);
+		chain[i]->target = G_CopyString(va("findbench%d", i + 1), TAG_LEVEL);
+	}
+
+	/* like a chain that was in the map */
+	G_SweepFindIndex();
+
+	hits = 0;
+	start = clock();
+
+	for (i = 0; i < n; i++)
+	{
+		for (t = NULL; (t = G_Find(t, FOFS(targetname), chain[i]->target)); )
+		{
+			hits++;
+		}
+	}
+
+	indexed = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+	start = clock();
+
+	for (i = 0; i < n; i++)
+	{
+		for (t = NULL; (t = G_FindScan(t, FOFS(targetname), chain[i]->target)); )
+		{
+			hits--;
+		}
+	}
+
+	scanned = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+
+	gi.cprintf(NULL, PRINT_HIGH, "%i links, %i edicts: index %.3f ms, "
+		"scan %.3f ms%s\n", n, globals.num_edicts, indexed, scanned,
+		hits ? " (MISMATCH)" : "");
+
+	for (i = 0; i < n; i++)
+	{
+		gi.TagFree((void *)chain[i]->targetname);
+		gi.TagFree(chain[i]->target);
+		G_FreeEdict(chain[i]);
+	}
+
+	gi.TagFree(chain);
+}
+
+/*
+ * findradius() asks the area grid of the server for the
+ * edicts in the box around the sphere and walks them in
+ * edict order. The callers iterate by passing in the last
+ * result, so the candidates are kept in a slot until the
+ * iteration ends. Nested iterations, like an explosion
+ * killing a monster that explodes, get a slot of their
+ * own. Edicts with SOLID_NOT aren't in the area grid,
+ * but findradius() never returned them anyway.
+ */
+#define RADIUS_SLOTS 4
+
+typedef struct
+{
+	int framenum;
+	vec3_t org;
+	float rad;
+	int pos; /* list index of the last result */
+	int count;
+	int list[MAX_EDICTS]; /* edict numbers, ascending */
+} radiusquery_t;
+
+static radiusquery_t radius_slots[RADIUS_SLOTS];
+static int radius_nextslot;
+
+/* one block for the BoxEdicts() results and a
+   mark per edict, grown with game.maxentities */
+static edict_t **radius_touch;
+static byte *radius_marks;
+static int radius_size;
+
+/*
+ * Called when the game dll is loaded, the
+ * buffers were freed with TAG_GAME.
+ */
+void
+G_InitFindRadius(void)
+{
+	memset(radius_slots, 0, sizeof(radius_slots));
+	radius_nextslot = 0;
+	radius_touch = NULL;
+	radius_marks = NULL;
+	radius_size = 0;
+}
+
+static qboolean
+FindRadiusMatch(const edict_t *ent, const vec3_t org, float rad)
 {
 	vec3_t eorg;
 	int j;
 
+	if (!ent->inuse || (ent->solid == SOLID_NOT))
+	{
+		return false;
+	}
+
+	for (j = 0; j < 3; j++)
+	{
+		eorg[j] = org[j] - (ent->s.origin[j] +
+				   (ent->mins[j] + ent->maxs[j]) * 0.5);
+	}
+
+	return VectorLengthSquared(eorg) <= rad * rad;
+}
+
+static edict_t *
+FindRadiusScan(edict_t *from, const vec3_t org, float rad)
+{
 	if (!from)
 	{
 		from = g_edicts;
@@ -128,33 +625,222 @@ findradius(edict_t *from, const vec3_t org, float rad)
 
 	for ( ; from < &g_edicts[globals.num_edicts]; from++)
 	{
-		if (!from->inuse)
+		if (FindRadiusMatch(from, org, rad))
 		{
-			continue;
+			return from;
 		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Fills q with the edicts that may be within rad of
+ * org. Returns false if there are too many of them.
+ */
+static qboolean
+FindRadiusQuery(radiusquery_t *q, const vec3_t org, float rad)
+{
+	edict_t **touch;
+	vec3_t mins, maxs;
+	int i, num, total;
 
-		if (from->solid == SOLID_NOT)
+	if (radius_size < game.maxentities)
+	{
+		if (radius_size)
 		{
-			continue;
+			gi.TagFree(radius_touch);
 		}
 
-		for (j = 0; j < 3; j++)
+		radius_touch = gi.TagMalloc(MAX_EDICTS * sizeof(edict_t *) +
+			game.maxentities, TAG_GAME);
+		radius_marks = (byte *)(radius_touch + MAX_EDICTS);
+		radius_size = game.maxentities;
+	}
+
+	touch = radius_touch;
+
+	VectorCopy(org, q->org);
+	q->rad = rad;
+	q->framenum = level.framenum;
+	q->pos = -1;
+	q->count = 0;
+
+	/* the center of a linked edict is inside
+	   its absolute bounds, so this box holds
+	   everything whose center is in the sphere */
+	for (i = 0; i < 3; i++)
+	{
+		mins[i] = org[i] - rad;
+		maxs[i] = org[i] + rad;
+	}
+
+	num = gi.BoxEdicts(mins, maxs, touch, MAX_EDICTS, AREA_SOLID);
+	total = gi.BoxEdicts(mins, maxs, touch + num, MAX_EDICTS - num,
+		AREA_TRIGGERS);
+	total += num;
+
+	if (total >= MAX_EDICTS)
+	{
+		return false;
+	}
+
+	/* sort by marking, cheaper than qsort()
+	   for the usual number of edicts */
+	memset(radius_marks, 0, globals.num_edicts);
+
+	for (i = 0; i < total; i++)
+	{
+		radius_marks[touch[i] - g_edicts] = 1;
+	}
+
+	for (i = 0; i < globals.num_edicts; i++)
+	{
+		if (radius_marks[i])
+		{
+			q->list[q->count++] = i;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Returns entities that have origins
+ * within a spherical area
+ */
+edict_t *
+findradius(edict_t *from, const vec3_t org, float rad)
+{
+	radiusquery_t *q;
+	edict_t *ent;
+	int i, num;
+
+	q = NULL;
+	num = from ? from - g_edicts : -1;
+
+	/* continue an iteration */
+	if (from)
+	{
+		for (i = 0; i < RADIUS_SLOTS; i++)
+		{
+			q = &radius_slots[i];
+
+			if ((q->framenum == level.framenum) && (q->pos >= 0) &&
+				(q->pos < q->count) && (q->list[q->pos] == num) &&
+				(q->rad == rad) && VectorCompare(q->org, org))
+			{
+				break;
+			}
+		}
+
+		if (i == RADIUS_SLOTS)
 		{
-			eorg[j] = org[j] - (from->s.origin[j] +
-					   (from->mins[j] + from->maxs[j]) * 0.5);
+			q = NULL;
 		}
+	}
 
-		if (VectorLengthSquared(eorg) > rad * rad)
+	if (!q)
+	{
+		q = &radius_slots[radius_nextslot];
+		radius_nextslot = (radius_nextslot + 1) % RADIUS_SLOTS;
+
+		if (!FindRadiusQuery(q, org, rad))
 		{
-			continue;
+			q->count = 0;
+			return FindRadiusScan(from, org, rad);
 		}
 
-		return from;
+		/* the slot of this iteration was taken
+		   by a nested one, pick up after from */
+		while ((q->pos + 1 < q->count) && (q->list[q->pos + 1] <= num))
+		{
+			q->pos++;
+		}
+	}
+
+	for (i = q->pos + 1; i < q->count; i++)
+	{
+		ent = &g_edicts[q->list[i]];
+
+		if (FindRadiusMatch(ent, org, rad))
+		{
+			q->pos = i;
+			return ent;
+		}
 	}
 
+	/* done, free the slot */
+	q->count = 0;
+	q->pos = -1;
+
 	return NULL;
 }
 
+/*
+ * Times n findradius() iterations of radius rad
+ * around the inuse edicts, once through the area
+ * grid and once by scanning g_edicts. Used by the
+ * "sv radiusbench" command.
+ */
+void
+FindRadiusBenchmark(int n, float rad)
+{
+	const edict_t *center;
+	edict_t *ent;
+	clock_t start;
+	double grid, scanned;
+	int i, c, hits, checks;
+
+	hits = checks = 0;
+	c = 0;
+	start = clock();
+
+	for (i = 0; i < n; i++)
+	{
+		do
+		{
+			c = (c + 1) % globals.num_edicts;
+		}
+		while (!g_edicts[c].inuse);
+
+		center = &g_edicts[c];
+
+		for (ent = NULL; (ent = findradius(ent, center->s.origin, rad)); )
+		{
+			hits++;
+			checks += ent - g_edicts;
+		}
+	}
+
+	grid = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+	c = 0;
+	start = clock();
+
+	for (i = 0; i < n; i++)
+	{
+		do
+		{
+			c = (c + 1) % globals.num_edicts;
+		}
+		while (!g_edicts[c].inuse);
+
+		center = &g_edicts[c];
+
+		for (ent = NULL; (ent = FindRadiusScan(ent, center->s.origin, rad)); )
+		{
+			checks -= ent - g_edicts;
+		}
+	}
+
+	scanned = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+
+	gi.cprintf(NULL, PRINT_HIGH, "%i queries of radius %.0f, %i edicts, "
+		"%i hits: grid %.3f ms, scan %.3f ms%s\n", n, rad,
+		globals.num_edicts, hits, grid, scanned,
+		checks ? " (MISMATCH)" : "");
+}
+
 /*
  * Searches all active entities for
  * the next one that holds the matching
@@ -362,6 +1048,7 @@ G_UseTargets(edict_t *ent, edict_t *activator)
 			{
 				if (t->use)
 				{
+					G_WakeEdict(t);
 					t->use(t, ent, activator);
 				}
 			}
@@ -653,6 +1340,8 @@ G_InitEdict(edict_t *e)
 
 	e->inuse = true;
 	e->classname = "noclass";
+	G_IndexEdict(e);
+	G_WakeEdict(e);
 	e->gravity = 1.0;
 	e->s.number = e - g_edicts;
 
@@ -675,21 +1364,175 @@ G_InitEdict(edict_t *e)
 #define POLICY_DEFAULT		0
 #define POLICY_DESPERATE	1
 
+/*
+ * The free edicts above the clients wait in a ring in
+ * the order they were freed, oldest at the head. All
+ * edicts behind the head were freed later, so only the
+ * head needs to be checked against the reuse delay.
+ */
+static int *free_ring;
+static byte *free_queued;
+static float *free_time; /* freetime when queued */
+static int free_size;
+static int free_head;
+static int free_count;
+
+static struct
+{
+	float start;
+	int spawned;
+	int reused;
+	int appended;
+	int desperate;
+	int failed;
+	int freed;
+	int highwater;
+} edict_stats;
+
+static void
+G_FreeListPush(int num)
+{
+	if ((num >= free_size) || free_queued[num] || (free_count >= free_size))
+	{
+		return;
+	}
+
+	free_ring[(free_head + free_count) % free_size] = num;
+	free_queued[num] = 1;
+	free_time[num] = g_edicts[num].freetime;
+	free_count++;
+}
+
+static void
+G_FreeListPop(void)
+{
+	free_queued[free_ring[free_head]] = 0;
+	free_head = (free_head + 1) % free_size;
+	free_count--;
+}
+
+static int
+G_FreeListCompare(const void *a, const void *b)
+{
+	int na = *(const int *)a;
+	int nb = *(const int *)b;
+
+	if (g_edicts[na].freetime != g_edicts[nb].freetime)
+	{
+		return (g_edicts[na].freetime < g_edicts[nb].freetime) ? -1 : 1;
+	}
+
+	return na - nb;
+}
+
+/*
+ * Refills the free list from g_edicts, needed
+ * when the edicts were cleared or loaded.
+ */
+void
+G_ResetFreeList(void)
+{
+	int i;
+
+	if (free_size < game.maxentities)
+	{
+		if (free_size)
+		{
+			gi.TagFree(free_ring);
+		}
+
+		/* one block for ring, time and queued */
+		free_ring = gi.TagMalloc(game.maxentities *
+			(sizeof(int) + sizeof(float) + sizeof(byte)), TAG_GAME);
+		free_time = (float *)(free_ring + game.maxentities);
+		free_queued = (byte *)(free_time + game.maxentities);
+		free_size = game.maxentities;
+	}
+
+	memset(free_queued, 0, free_size);
+	free_head = 0;
+	free_count = 0;
+
+	memset(&edict_stats, 0, sizeof(edict_stats));
+	edict_stats.start = level.time;
+	edict_stats.highwater = globals.num_edicts;
+
+	for (i = game.maxclients + 1; i < globals.num_edicts; i++)
+	{
+		if (!g_edicts[i].inuse)
+		{
+			free_ring[free_count++] = i;
+		}
+	}
+
+	qsort(free_ring, free_count, sizeof(free_ring[0]), G_FreeListCompare);
+
+	for (i = 0; i < free_count; i++)
+	{
+		free_queued[free_ring[i]] = 1;
+		free_time[free_ring[i]] = g_edicts[free_ring[i]].freetime;
+	}
+}
+
+/*
+ * Called when the game dll is loaded, the old
+ * list was freed with the TAG_GAME allocations.
+ */
+void
+G_InitFreeList(void)
+{
+	free_ring = NULL;
+	free_queued = NULL;
+	free_time = NULL;
+	free_size = 0;
+	free_head = 0;
+	free_count = 0;
+	memset(&edict_stats, 0, sizeof(edict_stats));
+}
+
 static edict_t *
 G_FindFreeEdict(int policy)
 {
 	edict_t *e;
+	int num;
+
+	if (free_size < game.maxentities)
+	{
+		G_ResetFreeList();
+	}
 
-	for (e = g_edicts + game.maxclients + 1 ; e < &g_edicts[globals.num_edicts] ; e++)
+	while (free_count)
 	{
+		num = free_ring[free_head];
+		e = &g_edicts[num];
+
+		/* taken by someone else in the meantime */
+		if (e->inuse || (num <= game.maxclients) || (num >= globals.num_edicts))
+		{
+			G_FreeListPop();
+			continue;
+		}
+
+		/* freed again since it was queued */
+		if (e->freetime != free_time[num])
+		{
+			G_FreeListPop();
+			G_FreeListPush(num);
+			continue;
+		}
+
 		/* the first couple seconds of server time can involve a lot of
 		   freeing and allocating, so relax the replacement policy
 		*/
-		if (!e->inuse && (policy == POLICY_DESPERATE || e->freetime < 2.0f || (level.time - e->freetime) > 0.5f))
+		if (policy == POLICY_DESPERATE || e->freetime < 2.0f || (level.time - e->freetime) > 0.5f)
 		{
+			G_FreeListPop();
 			G_InitEdict(e);
 			return e;
 		}
+
+		/* everything behind the head is younger */
+		break;
 	}
 
 	return NULL;
@@ -702,20 +1545,80 @@ G_SpawnOptional(void)
 
 	if (e)
 	{
+		edict_stats.spawned++;
+		edict_stats.reused++;
 		return e;
 	}
 
 	if (globals.num_edicts >= game.maxentities)
 	{
-		return G_FindFreeEdict (POLICY_DESPERATE);
+		e = G_FindFreeEdict (POLICY_DESPERATE);
+
+		if (e)
+		{
+			edict_stats.spawned++;
+			edict_stats.desperate++;
+		}
+		else
+		{
+			edict_stats.failed++;
+		}
+
+		return e;
 	}
 
 	e = &g_edicts[globals.num_edicts++];
 	G_InitEdict(e);
 
+	edict_stats.spawned++;
+	edict_stats.appended++;
+	edict_stats.highwater = Q_max(edict_stats.highwater, globals.num_edicts);
+
 	return e;
 }
 
+/*
+ * Prints the edict allocation statistics,
+ * used by the "sv edictstats" command.
+ */
+void
+G_EdictStats(qboolean reset)
+{
+	float seconds;
+	int i, inuse;
+
+	inuse = 0;
+
+	for (i = 0; i < globals.num_edicts; i++)
+	{
+		if (g_edicts[i].inuse)
+		{
+			inuse++;
+		}
+	}
+
+	seconds = Q_max(level.time - edict_stats.start, FRAMETIME);
+
+	gi.cprintf(NULL, PRINT_HIGH, "edicts: %i in use, %i allocated, %i max, "
+		"%i waiting for reuse\n", inuse, globals.num_edicts,
+		game.maxentities, free_count);
+	gi.cprintf(NULL, PRINT_HIGH, "in %.1f seconds: %i spawned (%.1f/s), "
+		"%i freed (%.1f/s)\n", seconds, edict_stats.spawned,
+		edict_stats.spawned / seconds, edict_stats.freed,
+		edict_stats.freed / seconds);
+	gi.cprintf(NULL, PRINT_HIGH, "spawned from: free list %i, new slots %i, "
+		"desperate reuse %i, failed %i, highest count %i\n",
+		edict_stats.reused, edict_stats.appended, edict_stats.desperate,
+		edict_stats.failed, edict_stats.highwater);
+
+	if (reset)
+	{
+		memset(&edict_stats, 0, sizeof(edict_stats));
+		edict_stats.start = level.time;
+		edict_stats.highwater = globals.num_edicts;
+	}
+}
+
 edict_t *
 G_Spawn(void)
 {
@@ -761,6 +1664,15 @@ G_FreeEdict(edict_t *ed)
 	ed->classname = "freed";
 	ed->freetime = level.time;
 	ed->inuse = false;
+	G_IndexEdict(ed);
+	G_WakeEdict(ed);
+
+	edict_stats.freed++;
+
+	if (free_size)
+	{
+		G_FreeListPush(ed - g_edicts);
+	}
 }
 
 void
@@ -801,6 +1713,7 @@ G_TouchTriggers(edict_t *ent)
 			continue;
 		}
 
+		G_WakeEdict(hit);
 		hit->touch(hit, ent, NULL, NULL);
 	}
 }
@@ -840,6 +1753,7 @@ G_TouchSolids(edict_t *ent)
 
 		if (ent->touch)
 		{
+			G_WakeEdict(hit);
 			ent->touch(hit, ent, NULL, NULL);
 		}
 
@@ -1702,6 +1702,7 @@ Trap_Think(edict_t *ent)
 				best->s.effects |= EF_GIB;
 				best->takedamage = DAMAGE_YES;
 
+				G_WakeEdict(best);
 				best->movetype = MOVETYPE_TOSS;
 				best->svflags |= SVF_MONSTER;
 				best->deadflag = DEAD_DEAD;
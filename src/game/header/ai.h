@@ -116,6 +116,10 @@ void BOT_Respawn(edict_t *self);
 void AITools_Frame(void);
 void AITools_DropNodes(edict_t *ent);
 
+/* astar.c */
+void AStar_FlushCache(void);
+void AStar_Stats(qboolean reset);
+
 /* ai_dropnodes.c */
 void AITools_SaveNodes(void);
 void AITools_InitEditnodes(void);
@@ -38,6 +38,10 @@
 #define GAME_API_R97_VERSION 3
 #define GAME_API_VERSION 4
 
+/* bits of the sv_features cvar, set by engines which
+   provide game imports that older ones are missing */
+#define SV_FEATURE_WRITESAVEFILE 0x00000001 /* gi.WriteSaveFile() */
+
 /* edict->svflags */
 #define SVF_NOCLIENT 0x00000001             /* don't send entity to clients, even if it has effects */
 #define SVF_DEADMONSTER 0x00000002          /* treat as CONTENTS_DEADMONSTER for collision */
@@ -221,6 +225,11 @@ typedef struct
 
 	const char* (*LocalizationMessage)(const char *message, int *sound_index);
 	const char* (*LocalizationUIMessage)(const char *message, const char *default_message);
+
+	/* hands a savegame file over to the server, which writes
+	   it in the background. Relative to the working directory.
+	   Only there if sv_features has SV_FEATURE_WRITESAVEFILE. */
+	void (*WriteSaveFile)(const char *filename, const void *data, size_t len);
 } game_import_t;
 
 /* functions exported by the game subsystem */
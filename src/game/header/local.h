@@ -777,6 +777,10 @@ extern cvar_t *g_machinegun_norecoil;
 extern cvar_t *g_quick_weap;
 extern cvar_t *g_swap_speed;
 extern cvar_t *g_itemsbobeffect;
+extern cvar_t *g_save_compress;
+extern cvar_t *sv_features;
+extern cvar_t *g_thinkwheel;
+extern cvar_t *g_viscache;
 extern cvar_t *g_start_items;
 extern cvar_t *ai_model_scale;
 extern cvar_t *g_game;
@@ -894,6 +898,16 @@ void G_InitEdict(edict_t *e);
 edict_t *G_SpawnOptional(void);
 edict_t *G_Spawn(void);
 void G_FreeEdict(edict_t *ed);
+void G_IndexEdict(edict_t *ent);
+void G_InitFindIndex(void);
+void G_InitFindRadius(void);
+void G_ResetFindIndex(void);
+void G_SweepFindIndex(void);
+void FindBenchmark(int n);
+void FindRadiusBenchmark(int n, float rad);
+void G_InitFreeList(void);
+void G_ResetFreeList(void);
+void G_EdictStats(qboolean reset);
 
 void G_TouchTriggers(edict_t *ent);
 void G_TouchSolids(edict_t *ent);
@@ -1062,6 +1076,10 @@ void FoundTarget(edict_t *self);
 qboolean FindTarget(edict_t *self);
 qboolean infront(edict_t *self, edict_t *other);
 qboolean visible(const edict_t *self, const edict_t *other);
+void G_HookVisCache(void);
+void G_InitVisCache(void);
+void G_ResetVisCache(void);
+void G_VisStats(qboolean reset);
 qboolean FacingIdeal(const edict_t *self);
 void HuntTarget(edict_t *self);
 qboolean ai_checkattack(edict_t *self);
@@ -1199,6 +1217,14 @@ void M_SetStandMinMax(edict_t *ent, float *mins, float *maxs);
 
 /* g_phys.c */
 void G_RunEntity(edict_t *ent);
+void G_WakeEdict(edict_t *ent);
+void G_SleepEdict(edict_t *ent);
+qboolean G_EdictAsleep(int num);
+void G_InitThinkWheel(void);
+void G_ResetThinkWheel(void);
+void G_AdvanceThinkWheel(void);
+void G_CheckThinkWheel(void);
+void G_ThinkWheelStats(void);
 void SV_AddGravity(edict_t *ent);
 
 /* g_main.c */
@@ -1215,6 +1241,7 @@ void GetChaseTarget(edict_t *ent);
 void InitGame(void);
 void ReadLevel(const char *filename);
 void WriteLevel(const char *filename);
+void SaveBenchmark(int iterations);
 void ReadGame(const char *filename);
 void WriteGame(const char *filename, qboolean autosave);
 void SpawnEntities(const char *mapname, char *entities, const char *spawnpoint);
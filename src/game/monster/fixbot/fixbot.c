@@ -373,6 +373,7 @@ use_scanner(edict_t *self)
 			/* remove the old one */
 			if (strcmp(self->goalentity->classname, "bot_goal") == 0)
 			{
+				G_WakeEdict(self->goalentity);
 				self->goalentity->nextthink = level.time + 0.1;
 				self->goalentity->think = G_FreeEdict;
 			}
@@ -399,6 +400,7 @@ use_scanner(edict_t *self)
 
 		if (self->goalentity->touch_debounce_time < level.time || VectorLength(vec) < 32)
 		{
+			G_WakeEdict(self->goalentity);
 			self->goalentity->nextthink = level.time + 0.1;
 			self->goalentity->think = G_FreeEdict;
 			self->goalentity = self->enemy = NULL;
@@ -428,6 +430,7 @@ use_scanner(edict_t *self)
 
 		if (strcmp(self->goalentity->classname, "bot_goal") == 0)
 		{
+			G_WakeEdict(self->goalentity);
 			self->goalentity->nextthink = level.time + 0.1;
 			self->goalentity->think = G_FreeEdict;
 			self->goalentity = self->enemy = NULL;
@@ -634,6 +637,7 @@ fly_vertical(edict_t *self)
 	if ((self->s.frame == FRAME_landing_58) ||
 		(self->s.frame == FRAME_takeoff_16))
 	{
+		G_WakeEdict(self->goalentity);
 		self->goalentity->nextthink = level.time + 0.1;
 		self->goalentity->think = G_FreeEdict;
 		self->monsterinfo.currentmove = &fixbot_move_stand;
@@ -672,6 +676,7 @@ fly_vertical2(edict_t *self)
 
 	if (len < 32)
 	{
+		G_WakeEdict(self->goalentity);
 		self->goalentity->nextthink = level.time + 0.1;
 		self->goalentity->think = G_FreeEdict;
 		self->monsterinfo.currentmove = &fixbot_move_stand;
@@ -1165,6 +1170,7 @@ fixbot_fire_laser(edict_t *self)
 			self->enemy->monsterinfo.aiflags = 0;
 			self->enemy->target = NULL;
 			self->enemy->targetname = NULL;
+			G_IndexEdict(self->enemy);
 			self->enemy->combattarget = NULL;
 			self->enemy->deathtarget = NULL;
 			self->enemy->owner = self;
@@ -858,12 +858,12 @@ flyer_die(edict_t *self, edict_t *inflictor /* unused */,
 }
 
 /* kamikaze code .. blow up if blocked */
-static int
+qboolean
 flyer_blocked(edict_t *self, float dist)
 {
 	if (!self)
 	{
-		return 0;
+		return false;
 	}
 
 	/* kamikaze = 100, normal = 50 */
@@ -947,6 +947,7 @@ SP_monster_flyer(edict_t *self)
 	{
 		self->targetname = self->target;
 		self->target = NULL;
+		G_IndexEdict(self);
 	}
 
 	sound_sight = gi.soundindex("flyer/flysght1.wav");
@@ -988,7 +989,7 @@ SP_monster_flyer(edict_t *self)
 	self->monsterinfo.melee = flyer_melee;
 	self->monsterinfo.sight = flyer_sight;
 	self->monsterinfo.idle = flyer_idle;
-	self->monsterinfo.blocked = (void *)flyer_blocked;
+	self->monsterinfo.blocked = flyer_blocked;
 
 	gi.linkentity(self);
 
@@ -1048,7 +1049,7 @@ SP_monster_kamikaze(edict_t *self)
 	self->monsterinfo.sight = flyer_sight;
 	self->monsterinfo.idle = flyer_idle;
 
-	self->monsterinfo.blocked = (void *)flyer_blocked;
+	self->monsterinfo.blocked = flyer_blocked;
 
 	gi.linkentity(self);
 
@@ -91,6 +91,7 @@ SP_FixCoopSpots(edict_t *self)
 			if ((!self->targetname) || (Q_stricmp(self->targetname, spot->targetname) != 0))
 			{
 				self->targetname = spot->targetname;
+				G_IndexEdict(self);
 			}
 
 			return;
@@ -2511,6 +2512,7 @@ PutClientInServer(edict_t *ent)
 	ent->viewheight = 22;
 	ent->inuse = true;
 	ent->classname = "player";
+	G_IndexEdict(ent);
 	ent->mass = 200;
 	ent->solid = SOLID_BBOX;
 	ent->deadflag = DEAD_NO;
@@ -3085,6 +3087,7 @@ ClientDisconnect(edict_t *ent)
 	ent->solid = SOLID_NOT;
 	ent->inuse = false;
 	ent->classname = "disconnected";
+	G_IndexEdict(ent);
 	ent->client->pers.connected = false;
 
 	playernum = ent - g_edicts - 1;
@@ -3343,6 +3346,7 @@ ClientThink(edict_t *ent, usercmd_t *ucmd)
 				continue;
 			}
 
+			G_WakeEdict(other);
 			other->touch(other, ent, NULL, NULL);
 		}
 	}
@@ -70,6 +70,7 @@
 #include "../../common/header/common.h" // YQ2ARCH
 #include "../header/local.h"
 #include "savegame.h"
+#include "../../common/unzip/miniz/miniz.h"
 
 /*
  * When ever the savegame version is changed, q2 will refuse to
@@ -256,46 +257,198 @@ sg_fread(void *dest, size_t n, FILE *f)
 	}
 }
 
+/*
+ * Savegames are put together in memory and handed
+ * over to the server with gi.WriteSaveFile(), which
+ * writes them to disk in the background.
+ */
+typedef struct
+{
+	byte *data;
+	size_t len;
+	size_t size;
+} savebuf_t;
+
+static void *
+SaveBufAlloc(savebuf_t *sb, size_t len)
+{
+	void *p;
+
+	if (sb->len + len > sb->size)
+	{
+		sb->size = Q_max(sb->size * 2, sb->len + len + 0x10000);
+		p = realloc(sb->data, sb->size);
+
+		if (!p)
+		{
+			gi.error("%s: can't allocate " YQ2_COM_PRIdS " bytes",
+				__func__, sb->size);
+		}
+
+		sb->data = p;
+	}
+
+	p = sb->data + sb->len;
+	sb->len += len;
+
+	return p;
+}
+
 static void
-sg_fwrite(const void *src, size_t n, FILE *f)
+SaveBufAppend(savebuf_t *sb, const void *data, size_t len)
+{
+	memcpy(SaveBufAlloc(sb, len), data, len);
+}
+
+/*
+ * Engines without gi.WriteSaveFile() get
+ * the file written right away.
+ */
+static qboolean
+SaveWriteFile(const char *filename, const void *data, size_t len)
 {
-	if (fwrite(src, n, 1, f) != 1)
+	qboolean ok;
+	FILE *f;
+
+	if ((int)sv_features->value & SV_FEATURE_WRITESAVEFILE)
 	{
-		fclose(f);
-		gi.error("Error writing " YQ2_COM_PRIdS " bytes to save file", n);
+		gi.WriteSaveFile(filename, data, len);
+		return true;
+	}
+
+	f = Q_fopen(filename, "wb");
+
+	if (!f)
+	{
+		return false;
 	}
+
+	ok = (fwrite(data, len, 1, f) == 1);
+
+	if (fclose(f))
+	{
+		ok = false;
+	}
+
+	return ok;
 }
 
-const field_t *
-FindSpawntempField(const char *key)
+/*
+ * Every key/value pair of the entity string is looked
+ * up in the spawntemp and then in the entity fields.
+ * InitFieldLookups() indexes both tables once into open
+ * addressing hash tables keyed by the lower case name.
+ */
+#define FIELD_LOOKUP_SIZE 512 /* power of two, > 2 * fields */
+#define FIELD_LOOKUP_MASK (FIELD_LOOKUP_SIZE - 1)
+
+static const field_t *lookup_stfields[FIELD_LOOKUP_SIZE];
+static const field_t *lookup_entfields[FIELD_LOOKUP_SIZE];
+
+static unsigned int
+FieldLookupHash(const char *name)
 {
-	const field_t *f;
+	unsigned int h;
+	byte c;
 
-	for (f = stfields; f < ARREND(stfields); f++)
+	h = 2166136261u;
+
+	/* folds case like Q_strcasecmp() */
+	while ((c = *name++))
+	{
+		if ((c >= 'A') && (c <= 'Z'))
+		{
+			c += 'a' - 'A';
+		}
+
+		h = (h ^ c) * 16777619u;
+	}
+
+	return h & FIELD_LOOKUP_MASK;
+}
+
+static const field_t *
+FieldLookup(const field_t **table, const char *key)
+{
+	unsigned int i;
+
+	i = FieldLookupHash(key);
+
+	while (table[i])
 	{
-		if (!Q_strcasecmp(f->name, key))
+		if (!Q_strcasecmp(table[i]->name, key))
 		{
-			return f;
+			return table[i];
 		}
+
+		i = (i + 1) & FIELD_LOOKUP_MASK;
 	}
 
 	return NULL;
 }
 
-const field_t *
-FindSpawnfield(const char *key)
+/*
+ * The tables are walked front to back and duplicates are
+ * skipped, so the first match wins like with a linear search.
+ */
+static void
+FieldLookupInsert(const field_t **table, const field_t *f)
+{
+	unsigned int i;
+
+	if (FieldLookup(table, f->name))
+	{
+		return;
+	}
+
+	i = FieldLookupHash(f->name);
+
+	while (table[i])
+	{
+		i = (i + 1) & FIELD_LOOKUP_MASK;
+	}
+
+	table[i] = f;
+}
+
+static void
+InitFieldLookups(void)
 {
 	const field_t *f;
 
+	memset(lookup_stfields, 0, sizeof(lookup_stfields));
+	memset(lookup_entfields, 0, sizeof(lookup_entfields));
+
+	if (ARRLEN(stfields) * 2 > FIELD_LOOKUP_SIZE ||
+		ARRLEN(entfields) * 2 > FIELD_LOOKUP_SIZE)
+	{
+		gi.error("%s: FIELD_LOOKUP_SIZE too small", __func__);
+	}
+
+	for (f = stfields; f < ARREND(stfields); f++)
+	{
+		FieldLookupInsert(lookup_stfields, f);
+	}
+
 	for (f = entfields; f < ARREND(entfields); f++)
 	{
-		if (!(f->flags & FFL_NOSPAWN) && !Q_strcasecmp(f->name, key))
+		if (!(f->flags & FFL_NOSPAWN))
 		{
-			return f;
+			FieldLookupInsert(lookup_entfields, f);
 		}
 	}
+}
 
-	return NULL;
+const field_t *
+FindSpawntempField(const char *key)
+{
+	return FieldLookup(lookup_stfields, key);
+}
+
+const field_t *
+FindSpawnfield(const char *key)
+{
+	return FieldLookup(lookup_entfields, key);
 }
 
 static void
@@ -365,6 +518,8 @@ ReinitGameEntities(int ent_cnt)
 	globals.max_edicts = num_e;
 }
 
+static void InitSaveLookups(void);
+
 /*
  * This will be called when the dll is first loaded,
  * which only happens when a new game is started or
@@ -445,6 +600,10 @@ InitGame(void)
 	g_quick_weap = gi.cvar("g_quick_weap", "1", CVAR_ARCHIVE);
 	g_swap_speed = gi.cvar("g_swap_speed", "1", CVAR_ARCHIVE);
 	g_itemsbobeffect = gi.cvar("g_itemsbobeffect", "0", CVAR_ARCHIVE);
+	g_save_compress = gi.cvar("g_save_compress", "1", CVAR_ARCHIVE);
+	sv_features = gi.cvar("sv_features", "0", CVAR_NOSET);
+	g_thinkwheel = gi.cvar("g_thinkwheel", "0", 0);
+	g_viscache = gi.cvar("g_viscache", "0", 0);
 	g_game = gi.cvar("game", "", 0);
 	g_start_items = gi.cvar("g_start_items", "", 0);
 	ai_model_scale = gi.cvar("ai_model_scale", "0", 0);
@@ -467,6 +626,14 @@ InitGame(void)
 	CTFInit();
 
 	AI_Init();//JABot
+
+	InitSaveLookups();
+	InitFieldLookups();
+	G_InitFindIndex();
+	G_InitFindRadius();
+	G_InitFreeList();
+	G_InitThinkWheel();
+	G_InitVisCache();
 }
 
 /* ========================================================= */
@@ -492,6 +659,173 @@ GetFunctionList(int field_ofs, const fptrList_t *fpl)
 	return NULL;
 }
 
+/*
+ * The function and mmove lists are searched for every
+ * function pointer of every entity saved or loaded.
+ * InitSaveLookups() indexes them once into two open
+ * addressing hash tables, one keyed by address and one
+ * by name. Function entries are keyed together with
+ * their list, mmoves with mmoveList.
+ */
+#define SAVE_LOOKUP_SIZE 4096 /* power of two, > 2 * entries */
+#define SAVE_LOOKUP_MASK (SAVE_LOOKUP_SIZE - 1)
+
+typedef struct
+{
+	const void *list;
+	const void *key; /* address or name */
+	const void *entry;
+} savelookup_t;
+
+static savelookup_t lookup_byaddr[SAVE_LOOKUP_SIZE];
+static savelookup_t lookup_byname[SAVE_LOOKUP_SIZE];
+
+static unsigned int
+SaveLookupHashAddr(const void *list, const void *adr)
+{
+	unsigned long long h;
+
+	h = ((unsigned long long)(size_t)adr ^
+		((unsigned long long)(size_t)list << 7)) *
+		0x9E3779B97F4A7C15ull;
+
+	return (unsigned int)(h >> 40) & SAVE_LOOKUP_MASK;
+}
+
+static unsigned int
+SaveLookupHashName(const void *list, const char *name)
+{
+	unsigned int h;
+
+	h = 2166136261u ^ (unsigned int)((size_t)list >> 4);
+
+	while (*name)
+	{
+		h = (h ^ (byte)*name++) * 16777619u;
+	}
+
+	return h & SAVE_LOOKUP_MASK;
+}
+
+static const savelookup_t *
+SaveLookupAddr(const void *list, const void *adr)
+{
+	const savelookup_t *l;
+	unsigned int i;
+
+	i = SaveLookupHashAddr(list, adr);
+
+	for (l = &lookup_byaddr[i]; l->entry; l = &lookup_byaddr[i])
+	{
+		if ((l->list == list) && (l->key == adr))
+		{
+			return l;
+		}
+
+		i = (i + 1) & SAVE_LOOKUP_MASK;
+	}
+
+	return NULL;
+}
+
+static const savelookup_t *
+SaveLookupName(const void *list, const char *name)
+{
+	const savelookup_t *l;
+	unsigned int i;
+
+	i = SaveLookupHashName(list, name);
+
+	for (l = &lookup_byname[i]; l->entry; l = &lookup_byname[i])
+	{
+		if ((l->list == list) && !strcmp(l->key, name))
+		{
+			return l;
+		}
+
+		i = (i + 1) & SAVE_LOOKUP_MASK;
+	}
+
+	return NULL;
+}
+
+/*
+ * Adds an entry to both tables. The lists are walked
+ * front to back and duplicates are skipped, so the first
+ * match wins, just like with a linear search.
+ */
+static void
+SaveLookupInsert(const void *list, const void *adr, const char *name,
+		const void *entry)
+{
+	unsigned int i;
+
+	if (!SaveLookupAddr(list, adr))
+	{
+		i = SaveLookupHashAddr(list, adr);
+
+		while (lookup_byaddr[i].entry)
+		{
+			i = (i + 1) & SAVE_LOOKUP_MASK;
+		}
+
+		lookup_byaddr[i].list = list;
+		lookup_byaddr[i].key = adr;
+		lookup_byaddr[i].entry = entry;
+	}
+
+	if (!SaveLookupName(list, name))
+	{
+		i = SaveLookupHashName(list, name);
+
+		while (lookup_byname[i].entry)
+		{
+			i = (i + 1) & SAVE_LOOKUP_MASK;
+		}
+
+		lookup_byname[i].list = list;
+		lookup_byname[i].key = name;
+		lookup_byname[i].entry = entry;
+	}
+}
+
+static void
+InitSaveLookups(void)
+{
+	const fplist_entry_t *fpe;
+	const fnlist_entry_t *fne;
+	const mmoveList_t *mml;
+	int count;
+
+	memset(lookup_byaddr, 0, sizeof(lookup_byaddr));
+	memset(lookup_byname, 0, sizeof(lookup_byname));
+
+	count = ARRLEN(mmoveList);
+
+	for (fpe = fplist_ent.start; fpe < fplist_ent.end; fpe++)
+	{
+		count += fpe->fnlist->end - fpe->fnlist->start;
+	}
+
+	if (count * 2 > SAVE_LOOKUP_SIZE)
+	{
+		gi.error("%s: %i entries, SAVE_LOOKUP_SIZE too small", __func__, count);
+	}
+
+	for (fpe = fplist_ent.start; fpe < fplist_ent.end; fpe++)
+	{
+		for (fne = fpe->fnlist->start; fne < fpe->fnlist->end; fne++)
+		{
+			SaveLookupInsert(fpe->fnlist, fne->funcPtr, fne->funcStr, fne);
+		}
+	}
+
+	for (mml = mmoveList; mml < ARREND(mmoveList); mml++)
+	{
+		SaveLookupInsert(mmoveList, mml->mmovePtr, mml->mmoveStr, mml);
+	}
+}
+
 /*
  * Helper function to get
  * the human readable function
@@ -502,22 +836,16 @@ GetFunctionList(int field_ofs, const fptrList_t *fpl)
 static const fnlist_entry_t *
 GetFunctionByAddress(const byte *adr, const functionList_t *fnl)
 {
-	const fnlist_entry_t *fne;
+	const savelookup_t *l;
 
 	if (!fnl)
 	{
 		return NULL;
 	}
 
-	for (fne = fnl->start; fne < fnl->end; fne++)
-	{
-		if (fne->funcPtr == adr)
-		{
-			return fne;
-		}
-	}
+	l = SaveLookupAddr(fnl, adr);
 
-	return NULL;
+	return l ? l->entry : NULL;
 }
 
 /*
@@ -530,22 +858,16 @@ GetFunctionByAddress(const byte *adr, const functionList_t *fnl)
 static const byte *
 FindFunctionByName(const char *name, const functionList_t *fnl)
 {
-	const fnlist_entry_t *fne;
+	const savelookup_t *l;
 
 	if (!fnl)
 	{
 		return NULL;
 	}
 
-	for (fne = fnl->start; fne < fnl->end; fne++)
-	{
-		if (!strcmp(name, fne->funcStr))
-		{
-			return fne->funcPtr;
-		}
-	}
+	l = SaveLookupName(fnl, name);
 
-	return NULL;
+	return l ? ((const fnlist_entry_t *)l->entry)->funcPtr : NULL;
 }
 
 /*
@@ -556,17 +878,11 @@ FindFunctionByName(const char *name, const functionList_t *fnl)
 static const mmoveList_t *
 GetMmoveByAddress(const mmove_t *adr)
 {
-	const mmoveList_t *mml;
+	const savelookup_t *l;
 
-	for (mml = mmoveList; mml < ARREND(mmoveList); mml++)
-	{
-		if (mml->mmovePtr == adr)
-		{
-			return mml;
-		}
-	}
+	l = SaveLookupAddr(mmoveList, adr);
 
-	return NULL;
+	return l ? l->entry : NULL;
 }
 
 /*
@@ -577,17 +893,11 @@ GetMmoveByAddress(const mmove_t *adr)
 static const mmove_t *
 FindMmoveByName(const char *name)
 {
-	const mmoveList_t *mml;
+	const savelookup_t *l;
 
-	for (mml = mmoveList; mml < ARREND(mmoveList); mml++)
-	{
-		if (!strcmp(name, mml->mmoveStr))
-		{
-			return mml->mmovePtr;
-		}
-	}
+	l = SaveLookupName(mmoveList, name);
 
-	return NULL;
+	return l ? ((const mmoveList_t *)l->entry)->mmovePtr : NULL;
 }
 
 /* ========================================================= */
@@ -644,7 +954,7 @@ GetMmoveLength(const mmove_t *mm)
  * below this block into files.
  */
 static void
-WriteField1(FILE *f, const field_t *field, void *base, const fptrList_t *fpl)
+WriteField1(savebuf_t *sb, const field_t *field, void *base, const fptrList_t *fpl)
 {
 	void *p;
 	size_t len;
@@ -711,13 +1021,12 @@ WriteField1(FILE *f, const field_t *field, void *base, const fptrList_t *fpl)
 			*(int *)p = GetMmoveLength(*(mmove_t **)p);
 			break;
 		default:
-			fclose(f);
 			gi.error("%s: unknown field type", __func__);
 	}
 }
 
 static void
-WriteFunction(FILE *f, const byte *fn, const functionList_t *fnl)
+WriteFunction(savebuf_t *sb, const byte *fn, const functionList_t *fnl)
 {
 	const fnlist_entry_t *fne;
 
@@ -731,12 +1040,12 @@ WriteFunction(FILE *f, const byte *fn, const functionList_t *fnl)
 	if (fne)
 	{
 		size_t len = strlen(fne->funcStr) + 1;
-		sg_fwrite(fne->funcStr, len, f);
+		SaveBufAppend(sb, fne->funcStr, len);
 	}
 }
 
 static void
-WriteMmove(FILE *f, const mmove_t *mm)
+WriteMmove(savebuf_t *sb, const mmove_t *mm)
 {
 	const mmoveList_t *mmove;
 
@@ -750,12 +1059,12 @@ WriteMmove(FILE *f, const mmove_t *mm)
 	if (mmove)
 	{
 		size_t len = strlen(mmove->mmoveStr) + 1;
-		sg_fwrite(mmove->mmoveStr, len, f);
+		SaveBufAppend(sb, mmove->mmoveStr, len);
 	}
 }
 
 static void
-WriteField2(FILE *f, const field_t *field, const void *base, const fptrList_t *fpl)
+WriteField2(savebuf_t *sb, const field_t *field, const void *base, const fptrList_t *fpl)
 {
 	const void *p;
 
@@ -772,14 +1081,14 @@ WriteField2(FILE *f, const field_t *field, const void *base, const fptrList_t *f
 				size_t len;
 
 				len = strlen(*(const char **)p) + 1;
-				sg_fwrite(*(const char **)p, len, f);
+				SaveBufAppend(sb, *(const char **)p, len);
 			}
 			break;
 		case F_FUNCTION:
-			WriteFunction(f, *(const byte **)p, GetFunctionList(field->ofs, fpl));
+			WriteFunction(sb, *(const byte **)p, GetFunctionList(field->ofs, fpl));
 			break;
 		case F_MMOVE:
-			WriteMmove(f, *(const mmove_t **)p);
+			WriteMmove(sb, *(const mmove_t **)p);
 			break;
 		default:
 			break;
@@ -787,22 +1096,22 @@ WriteField2(FILE *f, const field_t *field, const void *base, const fptrList_t *f
 }
 
 static void
-WriteStruct(FILE *f, const void *base, void *temp, const structdef_t *sd)
+WriteStruct(savebuf_t *sb, const void *base, void *temp, const structdef_t *sd)
 {
 	const field_t *field;
 
 	/* change the pointers to lengths or indexes */
 	for (field = sd->fields_start; field < sd->fields_end; field++)
 	{
-		WriteField1(f, field, temp, sd->fplist);
+		WriteField1(sb, field, temp, sd->fplist);
 	}
 
-	sg_fwrite(temp, sd->size, f);
+	SaveBufAppend(sb, temp, sd->size);
 
 	/* now write any allocated data following the edict */
 	for (field = sd->fields_start; field < sd->fields_end; field++)
 	{
-		WriteField2(f, field, base, sd->fplist);
+		WriteField2(sb, field, base, sd->fplist);
 	}
 }
 
@@ -1003,14 +1312,14 @@ ReadStruct(FILE *f, void *base, const structdef_t *sd, short save_ver)
  * Write the client struct into a file.
  */
 static void
-WriteClient(FILE *f, const gclient_t *client)
+WriteClient(savebuf_t *sb, const gclient_t *client)
 {
 	gclient_t temp;
 
 	/* all of the ints, floats, and vectors stay as they are */
 	temp = *client;
 
-	WriteStruct(f, client, &temp, &sd_client);
+	WriteStruct(sb, client, &temp, &sd_client);
 }
 
 /*
@@ -1059,7 +1368,7 @@ ReadClient(FILE *f, gclient_t *client, short save_ver)
  * - help computer info
  */
 static void
-WriteSaveHeader(FILE *f)
+WriteSaveHeader(savebuf_t *sb)
 {
 	savegameHeader_t sv;
 
@@ -1070,11 +1379,11 @@ WriteSaveHeader(FILE *f)
 	Q_strlcpy(sv.os, YQ2OSTYPE, sizeof(sv.os) - 1);
 	Q_strlcpy(sv.arch, YQ2ARCH, sizeof(sv.arch) - 1);
 
-	sg_fwrite(&sv, sizeof(sv), f);
+	SaveBufAppend(sb, &sv, sizeof(sv));
 }
 
 static void
-WriteGameLocals(FILE *f, qboolean autosave)
+WriteGameLocals(savebuf_t *sb, qboolean autosave)
 {
 	game_locals_t temp;
 
@@ -1085,11 +1394,11 @@ WriteGameLocals(FILE *f, qboolean autosave)
 	temp.maxclients = 0;
 	temp.maxentities = 0;
 
-	WriteStruct(f, &game, &temp, &sd_game);
+	WriteStruct(sb, &game, &temp, &sd_game);
 }
 
 static void
-WriteItemsNames(FILE *f)
+WriteItemsNames(savebuf_t *sb)
 {
 	size_t i;
 
@@ -1101,7 +1410,7 @@ WriteItemsNames(FILE *f)
 
 			Q_strlcpy(temp, itemlist[i].classname, sizeof(temp));
 
-			sg_fwrite(&temp, sizeof(temp) - 1 /* MAX_QPATH */, f);
+			SaveBufAppend(sb, &temp, sizeof(temp) - 1 /* MAX_QPATH */);
 		}
 	}
 }
@@ -1109,7 +1418,7 @@ WriteItemsNames(FILE *f)
 void
 WriteGame(const char *filename, qboolean autosave)
 {
-	FILE *f;
+	savebuf_t sb;
 	int i;
 
 	if (!autosave)
@@ -1117,26 +1426,27 @@ WriteGame(const char *filename, qboolean autosave)
 		SaveClientData();
 	}
 
-	f = Q_fopen(filename, "wb");
-
-	if (!f)
-	{
-		gi.error("%s: Couldn't open %s", __func__, filename);
-		return;
-	}
+	memset(&sb, 0, sizeof(sb));
 
-	WriteSaveHeader(f);
-	WriteGameLocals(f, autosave);
+	WriteSaveHeader(&sb);
+	WriteGameLocals(&sb, autosave);
 
 	for (i = 0; i < game.maxclients; i++)
 	{
-		WriteClient(f, &game.clients[i]);
+		WriteClient(&sb, &game.clients[i]);
 	}
 
 	/* Save items names */
-	WriteItemsNames(f);
+	WriteItemsNames(&sb);
 
-	fclose(f);
+	if (!SaveWriteFile(filename, sb.data, sb.len))
+	{
+		free(sb.data);
+		gi.error("%s: Couldn't write %s", __func__, filename);
+		return;
+	}
+
+	free(sb.data);
 }
 
 /*
@@ -1334,83 +1644,465 @@ ReadGame(const char *filename)
 /* ========================================================== */
 
 /*
- * Helper function to write the
- * edict into a file. Called by
- * WriteLevel.
+ * Levels are saved as one compressed image, so they're
+ * written and read with a single call. The structs are
+ * stored as they are in memory with their pointers cleared.
+ * Pointers and strings go into a relocation table, which
+ * references the struct field and holds an index or an
+ * offset into a string pool:
+ *
+ * int magic, version, sizeof(edict_t), sizeof(level_locals_t)
+ * int length of the image, length of the compressed image
+ *     or 0 if the image is stored uncompressed
+ * image, usually compressed:
+ *   int number of entities, relocations, string pool bytes
+ *   int entity numbers
+ *   level_locals_t
+ *   edict_t for each entity
+ *   levelreloc_t relocations
+ *   string pool
+ *
+ * Older level files are a stream of structs, each followed
+ * by its strings, and start with sizeof(edict_t). These are
+ * still read by ReadLevelStream().
  */
-static void
-WriteEdict(FILE *f, const edict_t *ent)
-{
-	edict_t temp;
+#define LEVELSAVE_MAGIC (('V' << 24) + ('L' << 16) + ('Q' << 8) + 'Y')
+#define LEVELSAVE_VERSION 1
+#define LEVELSAVE_HEADER 6
 
-	/* all of the ints, floats, and vectors stay as they are */
-	temp = *ent;
-	temp.client = NULL;
+typedef struct
+{
+	int block; /* entity number, -1 for the level locals */
+	int field; /* index into the fields of the struct */
+	int value; /* index or string pool offset */
+} levelreloc_t;
 
-	WriteStruct(f, ent, &temp, &sd_ent);
-}
+typedef struct
+{
+	savebuf_t entnums;
+	savebuf_t blocks;
+	savebuf_t relocs;
+	savebuf_t pool;
+} levelwriter_t;
 
-/*
- * Helper function to write the
- * level local data into a file.
- * Called by WriteLevel.
- */
-static void
-WriteLevelLocals(FILE *f)
+static int
+WriteLevelString(levelwriter_t *w, const char *s)
 {
-	level_locals_t temp;
+	int ofs;
 
-	/* all of the ints, floats, and vectors stay as they are */
-	temp = level;
+	ofs = w->pool.len;
+	SaveBufAppend(&w->pool, s, strlen(s) + 1);
 
-	WriteStruct(f, &level, &temp, &sd_level);
+	return ofs;
 }
 
 /*
- * Writes the current level
- * into a file.
+ * Appends the struct at base to the image and moves all
+ * pointers and strings into the relocation table.
  */
-void
-WriteLevel(const char *filename)
+static void
+WriteLevelStruct(levelwriter_t *w, int block, const void *base,
+		const structdef_t *sd)
 {
-	int i;
-	FILE *f;
+	const functionList_t *fnl;
+	const fnlist_entry_t *fne;
+	const mmoveList_t *mml;
+	const field_t *field;
+	levelreloc_t reloc;
+	const void *p;
+	byte *out;
 
-	f = Q_fopen(filename, "wb");
+	out = SaveBufAlloc(&w->blocks, sd->size);
+	memcpy(out, base, sd->size);
 
-	if (!f)
+	for (field = sd->fields_start; field < sd->fields_end; field++)
 	{
-		gi.error("%s: Couldn't open %s", __func__, filename);
-		return;
+		p = *(void * const *)((const byte *)base + field->ofs);
+
+		switch (field->type)
+		{
+			case F_LSTRING:
+			case F_LRAWSTRING:
+			case F_GRAWSTRING:
+			case F_EDICT:
+			case F_ITEM:
+			case F_FUNCTION:
+			case F_MMOVE:
+				memset(out + field->ofs, 0, sizeof(void *));
+				break;
+			default:
+				continue;
+		}
+
+		if (!p)
+		{
+			continue;
+		}
+
+		reloc.block = block;
+		reloc.field = field - sd->fields_start;
+
+		switch (field->type)
+		{
+			case F_EDICT:
+				reloc.value = (const edict_t *)p - g_edicts;
+				break;
+			case F_ITEM:
+				reloc.value = ITEM_INDEX((const gitem_t *)p);
+				break;
+			case F_FUNCTION:
+				fnl = GetFunctionList(field->ofs, sd->fplist);
+				fne = GetFunctionByAddress(p, fnl);
+
+				if (!fne)
+				{
+					gi.dprintf("%s: function at address %p not found in %s\n",
+						__func__, p, fnl ? fnl->name : "unknown list");
+					continue;
+				}
+
+				reloc.value = WriteLevelString(w, fne->funcStr);
+				break;
+			case F_MMOVE:
+				mml = GetMmoveByAddress(p);
+
+				if (!mml)
+				{
+					gi.dprintf("%s: mmove at address %p not found\n",
+						__func__, p);
+					continue;
+				}
+
+				reloc.value = WriteLevelString(w, mml->mmoveStr);
+				break;
+			default:
+				reloc.value = WriteLevelString(w, p);
+				break;
+		}
+
+		SaveBufAppend(&w->relocs, &reloc, sizeof(reloc));
 	}
+}
 
-	/* write out edict size for checking */
-	i = sizeof(edict_t);
-	sg_fwrite(&i, sizeof(i), f);
+/*
+ * Returns the current level as a malloc()ed
+ * image, ready to be written into a file.
+ */
+static byte *
+WriteLevelImage(size_t *size)
+{
+	levelwriter_t w;
+	savebuf_t raw;
+	edict_t temp;
+	mz_ulong complen;
+	byte *image;
+	int header[LEVELSAVE_HEADER];
+	int counts[3];
+	int i;
 
-	/* write out level_locals_t */
-	WriteLevelLocals(f);
+	memset(&w, 0, sizeof(w));
+	WriteLevelStruct(&w, -1, &level, &sd_level);
 
-	/* write out all the entities */
 	for (i = 0; i < globals.num_edicts; i++)
 	{
-		const edict_t *ent;
+		if (!g_edicts[i].inuse)
+		{
+			continue;
+		}
 
-		ent = &g_edicts[i];
+		temp = g_edicts[i];
+		temp.client = NULL;
 
-		if (!ent->inuse)
+		SaveBufAppend(&w.entnums, &i, sizeof(i));
+		WriteLevelStruct(&w, i, &temp, &sd_ent);
+	}
+
+	counts[0] = w.entnums.len / sizeof(int);
+	counts[1] = w.relocs.len / sizeof(levelreloc_t);
+	counts[2] = w.pool.len;
+
+	memset(&raw, 0, sizeof(raw));
+	SaveBufAppend(&raw, counts, sizeof(counts));
+	SaveBufAppend(&raw, w.entnums.data, w.entnums.len);
+	SaveBufAppend(&raw, w.blocks.data, w.blocks.len);
+	SaveBufAppend(&raw, w.relocs.data, w.relocs.len);
+	SaveBufAppend(&raw, w.pool.data, w.pool.len);
+
+	free(w.entnums.data);
+	free(w.blocks.data);
+	free(w.relocs.data);
+	free(w.pool.data);
+
+	if (g_save_compress->value)
+	{
+		complen = compressBound(raw.len);
+		image = malloc(sizeof(header) + complen);
+
+		if (!image || (compress2(image + sizeof(header), &complen,
+				raw.data, raw.len, Z_BEST_SPEED) != Z_OK))
 		{
-			continue;
+			free(image);
+			free(raw.data);
+			gi.error("%s: couldn't compress the level", __func__);
+			return NULL;
 		}
+	}
+	else
+	{
+		/* stored as is */
+		complen = 0;
+		image = malloc(sizeof(header) + raw.len);
 
-		sg_fwrite(&i, sizeof(i), f);
-		WriteEdict(f, ent);
+		if (!image)
+		{
+			free(raw.data);
+			gi.error("%s: can't allocate " YQ2_COM_PRIdS " bytes",
+				__func__, sizeof(header) + raw.len);
+			return NULL;
+		}
+
+		memcpy(image + sizeof(header), raw.data, raw.len);
 	}
 
-	i = -1;
-	sg_fwrite(&i, sizeof(i), f);
+	header[0] = LEVELSAVE_MAGIC;
+	header[1] = LEVELSAVE_VERSION;
+	header[2] = sizeof(edict_t);
+	header[3] = sizeof(level_locals_t);
+	header[4] = raw.len;
+	header[5] = complen;
+	memcpy(image, header, sizeof(header));
 
-	fclose(f);
+	free(raw.data);
+
+	*size = sizeof(header) + (complen ? complen : raw.len);
+
+	return image;
+}
+
+/*
+ * Fills lvl and edicts from a level image. Pointers to
+ * entities always point into g_edicts. Returns NULL on
+ * success or an error message.
+ */
+static const char *
+ReadLevelImage(const byte *image, size_t size, level_locals_t *lvl,
+		edict_t *edicts)
+{
+	const levelreloc_t *reloc, *relocs;
+	const structdef_t *sd;
+	const field_t *field;
+	const byte *blocks;
+	const char *pool;
+	const int *entnums;
+	int header[LEVELSAVE_HEADER];
+	int counts[3];
+	mz_ulong rawlen;
+	byte *raw;
+	void *base, *p;
+	int i;
+
+	if (size < sizeof(header))
+	{
+		return "truncated level file";
+	}
+
+	memcpy(header, image, sizeof(header));
+
+	if ((header[0] != LEVELSAVE_MAGIC) || (header[1] != LEVELSAVE_VERSION))
+	{
+		return "unknown level file version";
+	}
+
+	if ((header[2] != sizeof(edict_t)) || (header[3] != sizeof(level_locals_t)))
+	{
+		return "mismatched edict size";
+	}
+
+	if ((header[4] < (int)sizeof(counts)) || (header[5] < 0) ||
+		((size_t)(header[5] ? header[5] : header[4]) > size - sizeof(header)))
+	{
+		return "truncated level file";
+	}
+
+	rawlen = header[4];
+	raw = malloc(rawlen);
+
+	if (!raw)
+	{
+		return "can't allocate memory for the level";
+	}
+
+	if (!header[5])
+	{
+		memcpy(raw, image + sizeof(header), rawlen);
+	}
+	else if ((uncompress(raw, &rawlen, image + sizeof(header),
+			header[5]) != Z_OK) || (rawlen != (mz_ulong)header[4]))
+	{
+		free(raw);
+		return "corrupt level file";
+	}
+
+	memcpy(counts, raw, sizeof(counts));
+
+	if ((counts[0] < 0) || (counts[0] > game.maxentities) ||
+		(counts[1] < 0) || (counts[2] < 0) ||
+		(rawlen != sizeof(counts) + counts[0] * (sizeof(int) + sizeof(edict_t)) +
+			sizeof(level_locals_t) + counts[1] * sizeof(levelreloc_t) + counts[2]) ||
+		(counts[2] && raw[rawlen - 1]))
+	{
+		free(raw);
+		return "corrupt level file";
+	}
+
+	entnums = (const int *)(raw + sizeof(counts));
+	blocks = (const byte *)(entnums + counts[0]);
+	relocs = (const levelreloc_t *)(blocks + sizeof(level_locals_t) +
+		counts[0] * sizeof(edict_t));
+	pool = (const char *)(relocs + counts[1]);
+
+	memcpy(lvl, blocks, sizeof(level_locals_t));
+	blocks += sizeof(level_locals_t);
+
+	for (i = 0; i < counts[0]; i++, blocks += sizeof(edict_t))
+	{
+		if ((entnums[i] < 0) || (entnums[i] >= game.maxentities))
+		{
+			free(raw);
+			return "entnum out of bounds";
+		}
+
+		memcpy(&edicts[entnums[i]], blocks, sizeof(edict_t));
+	}
+
+	for (reloc = relocs; reloc < relocs + counts[1]; reloc++)
+	{
+		if (reloc->block == -1)
+		{
+			base = lvl;
+			sd = &sd_level;
+		}
+		else if ((reloc->block >= 0) && (reloc->block < game.maxentities))
+		{
+			base = &edicts[reloc->block];
+			sd = &sd_ent;
+		}
+		else
+		{
+			free(raw);
+			return "relocation out of bounds";
+		}
+
+		if ((reloc->field < 0) ||
+			(reloc->field >= sd->fields_end - sd->fields_start))
+		{
+			free(raw);
+			return "relocation out of bounds";
+		}
+
+		field = sd->fields_start + reloc->field;
+		p = (byte *)base + field->ofs;
+
+		switch (field->type)
+		{
+			case F_EDICT:
+				if ((reloc->value >= 0) && (reloc->value < game.maxentities))
+				{
+					*(edict_t **)p = &g_edicts[reloc->value];
+				}
+				continue;
+			case F_ITEM:
+				*(gitem_t **)p = GetItemByIndex(reloc->value);
+				continue;
+			default:
+				break;
+		}
+
+		if ((reloc->value < 0) || (reloc->value >= counts[2]))
+		{
+			free(raw);
+			return "relocation out of bounds";
+		}
+
+		switch (field->type)
+		{
+			case F_LSTRING:
+			case F_LRAWSTRING:
+				*(char **)p = G_CopyString(pool + reloc->value, TAG_LEVEL);
+				break;
+			case F_GRAWSTRING:
+				*(char **)p = G_CopyString(pool + reloc->value, TAG_GAME);
+				break;
+			case F_FUNCTION:
+				*(const byte **)p = FindFunctionByName(pool + reloc->value,
+					GetFunctionList(field->ofs, sd->fplist));
+
+				if (!*(const byte **)p)
+				{
+					gi.dprintf("%s: function %s not found\n",
+						__func__, pool + reloc->value);
+				}
+				break;
+			case F_MMOVE:
+				*(const mmove_t **)p = FindMmoveByName(pool + reloc->value);
+
+				if (!*(const mmove_t **)p)
+				{
+					gi.dprintf("%s: mmove %s not found\n",
+						__func__, pool + reloc->value);
+				}
+				break;
+			default:
+				free(raw);
+				return "relocation for a field without pointer";
+		}
+	}
+
+	free(raw);
+
+	return NULL;
+}
+
+/* ========================================================== */
+
+/*
+ * Helper function to write the
+ * edict into a file. Called by
+ * WriteLevel.
+ */
+static void
+WriteEdict(savebuf_t *sb, const edict_t *ent)
+{
+	edict_t temp;
+
+	/* all of the ints, floats, and vectors stay as they are */
+	temp = *ent;
+	temp.client = NULL;
+
+	WriteStruct(sb, ent, &temp, &sd_ent);
+}
+
+/*
+ * Writes the current level
+ * into a file, through the
+ * server.
+ */
+void
+WriteLevel(const char *filename)
+{
+	byte *image;
+	size_t size;
+
+	image = WriteLevelImage(&size);
+
+	if (!SaveWriteFile(filename, image, size))
+	{
+		free(image);
+		gi.error("%s: Couldn't write %s", __func__, filename);
+		return;
+	}
+
+	free(image);
 
 	/* Store AI navigation data */
 	AITools_SaveNodes();
@@ -1444,49 +2136,90 @@ ReadLevelLocals(FILE *f)
 	SanitizeLevelStruct();
 }
 
+static void
+SanitizeLevelEntity(edict_t *ent)
+{
+	/* sanitize certain field values */
+	ent->client = NULL;
+	ent->inuse = true;
+	ent->s.number = ent - g_edicts;
+
+	if (!ent->classname)
+	{
+		ent->classname = "noclass";
+	}
+
+	/* let the server rebuild world links for this ent */
+	memset(&ent->area, 0, sizeof(ent->area));
+	gi.linkentity(ent);
+}
+
 /*
- * Reads a level back into the memory.
- * SpawnEntities were already called
- * in the same way when the level was
- * saved. All world links were cleared
- * before this function was called. When
- * this function is called, no clients
- * are connected to the server.
+ * Reads a level saved as an image
+ * by WriteLevel(). f is positioned
+ * after the magic number.
  */
-void
-ReadLevel(const char *filename)
+static void
+ReadLevelImageFile(FILE *f)
 {
-	int entnum;
-	FILE *f;
+	const char *errmsg;
+	byte *image;
+	long size;
 	int i;
-	edict_t *ent;
 
-	f = Q_fopen(filename, "rb");
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	rewind(f);
 
-	if (!f)
+	image = malloc(size);
+
+	if (!image)
 	{
-		gi.error("%s: Couldn't open %s", __func__, filename);
+		fclose(f);
+		gi.error("%s: can't allocate %li bytes", __func__, size);
 		return;
 	}
 
-	/* free any dynamic memory allocated by
-	   loading the level  base state */
-	gi.FreeTags(TAG_LEVEL);
-
-	/* wipe all the entities */
-	memset(g_edicts, 0, game.maxentities * sizeof(g_edicts[0]));
-	globals.num_edicts = maxclients->value + 1;
+	if (fread(image, size, 1, f) != 1)
+	{
+		free(image);
+		fclose(f);
+		gi.error("Error reading %li bytes from save file", size);
+		return;
+	}
 
-	/* check edict size */
-	sg_fread(&i, sizeof(i), f);
+	errmsg = ReadLevelImage(image, size, &level, g_edicts);
+	free(image);
 
-	if (i != sizeof(edict_t))
+	if (errmsg)
 	{
 		fclose(f);
-		gi.error("%s: mismatched edict size", __func__);
+		gi.error("%s: %s", __func__, errmsg);
 		return;
 	}
 
+	SanitizeLevelStruct();
+
+	for (i = 0; i < game.maxentities; i++)
+	{
+		if (g_edicts[i].inuse)
+		{
+			globals.num_edicts = Q_max(globals.num_edicts, i + 1);
+			SanitizeLevelEntity(&g_edicts[i]);
+		}
+	}
+}
+
+/*
+ * Reads a level saved by older versions,
+ * one struct after the other. f is
+ * positioned after the edict size.
+ */
+static void
+ReadLevelStream(FILE *f)
+{
+	int entnum;
+
 	/* load the level locals */
 	ReadLevelLocals(f);
 
@@ -1512,26 +2245,69 @@ ReadLevel(const char *filename)
 			globals.num_edicts = entnum + 1;
 		}
 
-		ent = &g_edicts[entnum];
-		ReadStruct(f, ent, &sd_ent, 0);
+		ReadStruct(f, &g_edicts[entnum], &sd_ent, 0);
+		SanitizeLevelEntity(&g_edicts[entnum]);
+	}
+}
 
-		/* sanitize certain field values */
-		ent->client = NULL;
-		ent->inuse = true;
-		ent->s.number = ent - g_edicts;
+/*
+ * Reads a level back into the memory.
+ * SpawnEntities were already called
+ * in the same way when the level was
+ * saved. All world links were cleared
+ * before this function was called. When
+ * this function is called, no clients
+ * are connected to the server.
+ */
+void
+ReadLevel(const char *filename)
+{
+	FILE *f;
+	int i;
+	edict_t *ent;
 
-		if (!ent->classname)
-		{
-			ent->classname = "noclass";
-		}
+	f = Q_fopen(filename, "rb");
 
-		/* let the server rebuild world links for this ent */
-		memset(&ent->area, 0, sizeof(ent->area));
-		gi.linkentity(ent);
+	if (!f)
+	{
+		gi.error("%s: Couldn't open %s", __func__, filename);
+		return;
+	}
+
+	/* free any dynamic memory allocated by
+	   loading the level  base state */
+	gi.FreeTags(TAG_LEVEL);
+
+	/* wipe all the entities */
+	memset(g_edicts, 0, game.maxentities * sizeof(g_edicts[0]));
+	globals.num_edicts = maxclients->value + 1;
+
+	/* check the format, older files
+	   start with the edict size */
+	sg_fread(&i, sizeof(i), f);
+
+	if (i == LEVELSAVE_MAGIC)
+	{
+		ReadLevelImageFile(f);
+	}
+	else if (i == sizeof(edict_t))
+	{
+		ReadLevelStream(f);
+	}
+	else
+	{
+		fclose(f);
+		gi.error("%s: mismatched edict size", __func__);
+		return;
 	}
 
 	fclose(f);
 
+	G_ResetFindIndex();
+	G_ResetFreeList();
+	G_ResetThinkWheel();
+	G_ResetVisCache();
+
 	/* mark all clients as unconnected */
 	for (i = 0; i < maxclients->value; i++)
 	{
@@ -1563,3 +2339,139 @@ ReadLevel(const char *filename)
 	/* reload shadow light data from configstrings */
 	G_LoadShadowLights();
 }
+
+/* ========================================================= */
+
+/*
+ * Frees the strings of a struct read by
+ * SaveBenchmark() into a scratch buffer.
+ */
+static void
+FreeStructStrings(void *base, const structdef_t *sd)
+{
+	const field_t *field;
+	char **str;
+
+	for (field = sd->fields_start; field < sd->fields_end; field++)
+	{
+		if ((field->type == F_LSTRING) || (field->type == F_LRAWSTRING) ||
+			(field->type == F_GRAWSTRING))
+		{
+			str = (char **)((byte *)base + field->ofs);
+
+			if (*str)
+			{
+				gi.TagFree(*str);
+			}
+		}
+	}
+}
+
+/*
+ * Saves and loads the entities of the current level
+ * iterations times, into scratch buffers, once as
+ * a stream of structs like older versions did and
+ * once as a level image. Used by the "sv savebench"
+ * server command.
+ */
+void
+SaveBenchmark(int iterations)
+{
+	level_locals_t *scratchlevel;
+	edict_t *scratch;
+	clock_t start;
+	double writetime, readtime;
+	byte *image;
+	size_t size;
+	savebuf_t sb;
+	FILE *f;
+	int i, j, count;
+
+	f = tmpfile();
+
+	if (!f)
+	{
+		gi.cprintf(NULL, PRINT_HIGH, "Couldn't open a scratch file.\n");
+		return;
+	}
+
+	memset(&sb, 0, sizeof(sb));
+
+	count = 0;
+	start = clock();
+
+	for (j = 0; j < iterations; j++)
+	{
+		for (i = 0; i < globals.num_edicts; i++)
+		{
+			if (g_edicts[i].inuse)
+			{
+				WriteEdict(&sb, &g_edicts[i]);
+				count++;
+			}
+		}
+	}
+
+	writetime = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+
+	fwrite(sb.data, sb.len, 1, f);
+	rewind(f);
+	scratch = gi.TagMalloc(game.maxentities * sizeof(edict_t), TAG_LEVEL);
+	start = clock();
+
+	for (i = 0; i < count; i++)
+	{
+		ReadStruct(f, scratch, &sd_ent, 0);
+		FreeStructStrings(scratch, &sd_ent);
+	}
+
+	readtime = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+	fclose(f);
+
+	gi.cprintf(NULL, PRINT_HIGH, "stream: %i entities, " YQ2_COM_PRIdS " bytes, "
+		"write %.2f ms, read %.2f ms\n", count / iterations, sb.len / iterations,
+		writetime / iterations, readtime / iterations);
+
+	free(sb.data);
+
+	image = NULL;
+	size = 0;
+	start = clock();
+
+	for (j = 0; j < iterations; j++)
+	{
+		free(image);
+		image = WriteLevelImage(&size);
+	}
+
+	writetime = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+
+	scratchlevel = gi.TagMalloc(sizeof(level_locals_t), TAG_LEVEL);
+	start = clock();
+
+	for (j = 0; j < iterations; j++)
+	{
+		memset(scratch, 0, game.maxentities * sizeof(edict_t));
+		ReadLevelImage(image, size, scratchlevel, scratch);
+
+		FreeStructStrings(scratchlevel, &sd_level);
+
+		for (i = 0; i < game.maxentities; i++)
+		{
+			if (scratch[i].inuse)
+			{
+				FreeStructStrings(&scratch[i], &sd_ent);
+			}
+		}
+	}
+
+	readtime = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+
+	gi.cprintf(NULL, PRINT_HIGH, "image: %i entities, " YQ2_COM_PRIdS " bytes, "
+		"write %.2f ms, read %.2f ms\n", count / iterations, size,
+		writetime / iterations, readtime / iterations);
+
+	free(image);
+	gi.TagFree(scratchlevel);
+	gi.TagFree(scratch);
+}
@@ -48,6 +48,10 @@
 /* expected count of entities in packet */
 #define MAX_PACKET_ENTITIES 256
 
+/* buckets of the client lookup by address and qport,
+   a power of two larger than MAX_CLIENTS */
+#define CLIENT_HASH_SIZE 512
+
 #define SV_OUTPUTBUF_LENGTH (MAX_MSGLEN - 16)
 #define EDICT_NUM(n) ((edict_t *)((byte *)ge->edicts + ge->edict_size * (n)))
 #define CL_EDICT(cl) EDICT_NUM(1 + ((cl) - svs.clients))
@@ -64,6 +68,17 @@ typedef enum
 	ss_pic
 } server_state_t;
 
+/* hash index over the model, sound or image configstrings,
+   kept in sync by SV_FindIndex() and rebuilt when invalid */
+#define CS_INDEX_SIZE 1024 /* power of two, > 2 * MAX_MODELS */
+
+typedef struct
+{
+	qboolean valid;
+	int used;                       /* first empty slot, the end of the range searched */
+	short slots[CS_INDEX_SIZE];     /* slot in the range, 0 if empty */
+} csindex_t;
+
 typedef struct
 {
 	server_state_t state;           /* precache commands are only valid during load */
@@ -73,12 +88,16 @@ typedef struct
 
 	unsigned time;                  /* always sv.framenum * 100 msec */
 	int framenum;
+	long long ticktime;             /* Sys_Microseconds() the last frame ran */
 
 	char name[MAX_QPATH];           /* map name, or cinematic name */
 	struct cmodel_s *models[MAX_MODELS];
 
 	stringlist_t configstrings_overflow;
 	char configstrings[MAX_CONFIGSTRINGS][MAX_CONFIGSTRING];
+	csindex_t modelindex;
+	csindex_t soundindex;
+	csindex_t imageindex;
 	entity_xstate_t *baselines;
 	int numbaselines;
 
@@ -140,10 +159,19 @@ typedef struct client_s
 
 	client_frame_t frames[UPDATE_BACKUP];     /* updates can be delta'd from here */
 
-	byte *download;                     /* file being downloaded */
+	byte *download;                     /* file being downloaded, shared by SV_OpenDownload */
 	int downloadsize;                   /* total bytes (can't use EOF because of paks) */
 	int downloadcount;                  /* bytes sent */
 
+	/* windowed download, for clients with PROTOCOL_EXT_DOWNLOAD */
+	qboolean dlwindowed;
+	int dlstart;                        /* file offset of the first chunk */
+	int dlnumchunks;
+	int dlchunkbase;                    /* chunks acknowledged in a row */
+	unsigned dlacked;                   /* chunks acknowledged after them, bit 0 is dlchunkbase */
+	int dlsent[DOWNLOAD_WINDOW];        /* svs.realtime a chunk was last sent, 0 if not yet */
+	int dlrtt;                          /* smoothed ack round trip in ms */
+
 	int lastmessage;                    /* sv.framenum when packet was last received */
 	int lastconnect;
 
@@ -152,6 +180,16 @@ typedef struct client_s
 	netchan_t netchan;
 	int protocol;
 
+	int extensions;                     /* PROTOCOL_EXT_* the client announced on connect */
+	byte *gamestate;                    /* deflated gamestate being sent */
+	int gamestatesize;
+	int gamestaterawsize;
+
+	int hash_next;                      /* next client slot + 1 in the same svs.clienthash bucket */
+
+	byte *entity_deferred;              /* per edict: frames an update was held back by the rate budget */
+	int num_entity_deferred;
+
 	/* per-frame caches for SV_Multicast fanout */
 	vec3_t cached_origin;
 	int cached_leafnum;
@@ -171,6 +209,7 @@ typedef struct
 {
 	qboolean initialized;               /* sv_init has completed */
 	int realtime;                       /* always increasing, no clamping, etc */
+	int realtime_usec;                  /* sub millisecond part of realtime */
 
 	char mapcmd[MAX_SAVE_TOKEN_CHARS];  /* ie: *intro.cin+base */
 
@@ -186,6 +225,8 @@ typedef struct
 
 	challenge_t challenges[MAX_CHALLENGES];    /* to prevent invalid IPs from connecting */
 
+	int clienthash[CLIENT_HASH_SIZE];   /* first client slot + 1 by base address and qport */
+
 	/* serverrecord values */
 	FILE *demofile;
 	sizebuf_t demo_multicast;
@@ -198,6 +239,53 @@ typedef struct
 #define GAMEMODE_COOP 2
 #define GAMEMODE_DM 3
 
+/* timing statistics, shown by the serverprofile command */
+#define TICK_JITTER_BUCKETS 8
+#define TICK_JITTER_LIMITS {50, 100, 250, 500, 1000, 2500, 10000, 0}
+
+typedef struct
+{
+	unsigned long long count;
+	long long usec;
+	long long max_usec;
+} profstat_t;
+
+typedef struct
+{
+	profstat_t packet_lookup;           /* finding the owner of a packet */
+	profstat_t packet_client;           /* dispatching sequenced client packets */
+	profstat_t packet_connectionless;   /* dispatching connectionless packets */
+	profstat_t packet_unknown;          /* packets without a matching client */
+	profstat_t multicast;               /* fanning out sv.multicast to the clients */
+	profstat_t entity_budget;           /* fitting packet entities into the client's rate */
+
+	/* connectionless query volume */
+	unsigned long long queries_status;
+	unsigned long long queries_info;
+	unsigned long long queries_ping;
+	unsigned long long queries_throttled;   /* dropped by the per address limit */
+	unsigned long long queries_rebuilt;     /* status or info replies built */
+
+	/* distance of the game frames from the 100 msec tick,
+	   bucketed by TICK_JITTER_LIMITS */
+	unsigned long long tick_jitter[TICK_JITTER_BUCKETS];
+	long long tick_early;                   /* largest interval below 100 msec */
+	long long tick_late;                    /* largest interval above 100 msec */
+
+	/* serverrecord output */
+	unsigned long long demo_queued;         /* bytes handed to the writer */
+	unsigned int demo_highwater;            /* most bytes waiting in the ring */
+	profstat_t demo_stall;                  /* waiting for the writer to catch up */
+
+	profstat_t save_snapshot;               /* serializing a savegame, on the main thread */
+	profstat_t save_write;                  /* writing it out, in the background */
+} sv_profile_t;
+
+extern sv_profile_t sv_profile;
+
+void SV_ProfileAdd(profstat_t *stat, long long usec);
+void SV_ProfileTick(long long interval);
+
 extern netadr_t net_from;
 extern sizebuf_t net_message;
 
@@ -214,12 +302,22 @@ extern cvar_t *sv_airaccelerate;            /* don't reload level state when ree
 extern cvar_t *sv_enforcetime;
 extern cvar_t *sv_downloadserver;			/* Download server. */
 extern cvar_t *sv_language;			/* Localization. */
+extern cvar_t *sv_entity_budget;		/* Trim frames to the client's rate instead of dropping them. */
+extern cvar_t *sv_gamestate_compression;	/* Deflate the gamestate for clients that support it. */
+extern cvar_t *sv_download_rate;		/* Bytes per second for windowed downloads. */
+extern cvar_t *sv_query_rate;			/* Connectionless queries per second and address. */
+extern cvar_t *sv_query_burst;			/* Queries an address may send at once. */
+extern cvar_t *sv_demo_compress;		/* Write server demos gzipped. */
 
 extern client_t *sv_client;
 extern edict_t *sv_player;
 
 void SV_DropClient(client_t *drop);
 
+void SV_ClientHashAdd(client_t *cl);
+void SV_ClientHashRemove(client_t *cl);
+client_t *SV_ClientHashFind(netadr_t adr, int qport);
+
 int SV_ModelIndex(const char *name);
 int SV_SoundIndex(const char *name);
 int SV_ImageIndex(const char *name);
@@ -253,6 +351,7 @@ void SV_SendClientMessages(void);
 void SV_SendPrepClientMessages(void);
 
 void SV_Multicast(const vec3_t origin, multicast_t to);
+void SV_ClientMoved(const client_t *client);
 void SV_StartSound(const vec3_t origin, const edict_t *entity, int channel,
 		int soundindex, float volume, float attenuation,
 		float timeofs);
@@ -263,13 +362,23 @@ int SV_GetRecomendedProtocol(void);
 
 void SV_Nextserver(void);
 void SV_ExecuteClientMessage(client_t *cl);
+void SV_CloseDownload(client_t *cl);
+void SV_FlushDownloads(void);
+void SV_SendDownloadChunks(client_t *cl);
 
 void SV_ReadLevelFile(void);
+void SV_InvalidateConfigstringIndex(int index);
 char *SV_StatusString(void);
 void SV_ConnectionlessPacket(void);
+void SV_InvalidateQueryCache(void);
 
-void SV_WriteFrameToClient(client_t *client, sizebuf_t *msg);
+void SV_WriteFrameToClient(client_t *client, sizebuf_t *msg, int budget);
 void SV_RecordDemoMessage(void);
+
+qboolean SV_DemoOpen(const char *name, qboolean compress);
+void SV_DemoWrite(const void *data, int len);
+void SV_DemoClose(void);
+unsigned int SV_DemoBacklog(void);
 void SV_BuildClientFrame(client_t *client);
 
 extern game_export_t *ge;
@@ -287,6 +396,9 @@ void SV_CleanLevelFileName(char *savename);
 void SV_WriteServerFile(qboolean autosave);
 void SV_Loadgame_f(void);
 void SV_Savegame_f(void);
+void SV_CheckSaves(void);
+void SV_WaitForSaves(void);
+void SV_GameWriteSaveFile(const char *filename, const void *data, size_t len);
 
 /* high level object sorting to reduce interaction tests */
 void SV_ClearWorld(void);
@@ -590,13 +590,13 @@ SV_ServerRecord_f(void)
 	}
 
 	/* open the demo file */
-	Com_sprintf(name, sizeof(name), "%s/demos/%s.dm2", FS_Gamedir(), Cmd_Argv(1));
+	Com_sprintf(name, sizeof(name), "%s/demos/%s.dm2%s", FS_Gamedir(),
+			Cmd_Argv(1), sv_demo_compress->value ? ".gz" : "");
 
 	Com_Printf("recording to %s.\n", name);
 	FS_CreatePath(name);
-	svs.demofile = Q_fopen(name, "wb");
 
-	if (!svs.demofile)
+	if (!SV_DemoOpen(name, sv_demo_compress->value != 0))
 	{
 		Com_Printf("ERROR: couldn't open.\n");
 		return;
@@ -631,14 +631,13 @@ SV_ServerRecord_f(void)
 
 			/* i in native server range */
 			MSG_WriteConfigString(&buf,
-				P_ConvertConfigStringTo(i, sv_client->protocol),
+				P_ConvertConfigStringTo(i, SV_GetRecomendedProtocol()),
 				sv.configstrings[i]);
 
 			if (buf.cursize + 67 >= buf.maxsize)
 			{
 				Com_Printf("not enough buffer space available.\n");
-				fclose(svs.demofile);
-				svs.demofile = NULL;
+				SV_DemoClose();
 				return;
 			}
 		}
@@ -647,8 +646,8 @@ SV_ServerRecord_f(void)
 	/* write it to the demo file */
 	Com_DPrintf("signon message length: %i\n", buf.cursize);
 	len = LittleLong(buf.cursize);
-	fwrite(&len, 4, 1, svs.demofile);
-	fwrite(buf.data, buf.cursize, 1, svs.demofile);
+	SV_DemoWrite(&len, 4);
+	SV_DemoWrite(buf.data, buf.cursize);
 }
 
 /*
@@ -663,8 +662,7 @@ SV_ServerStop_f(void)
 		return;
 	}
 
-	fclose(svs.demofile);
-	svs.demofile = NULL;
+	SV_DemoClose();
 	Com_Printf("Recording completed.\n");
 }
 
@@ -771,6 +769,91 @@ SV_Gamemode_f(void)
 	}
 }
 
+static void
+SV_PrintProfStat(const char *name, const profstat_t *stat)
+{
+	Com_Printf("%-24s %10llu %10.2f %10lld\n", name, stat->count,
+			stat->count ? (double)stat->usec / stat->count : 0.0,
+			stat->max_usec);
+}
+
+static void
+SV_PrintTickJitter(void)
+{
+	static const int limits[TICK_JITTER_BUCKETS] = TICK_JITTER_LIMITS;
+	unsigned long long total;
+	int i;
+
+	total = 0;
+
+	for (i = 0; i < TICK_JITTER_BUCKETS; i++)
+	{
+		total += sv_profile.tick_jitter[i];
+	}
+
+	Com_Printf("\ntick jitter: %llu frames, %lld usec max early, "
+			"%lld usec max late\n", total, sv_profile.tick_early,
+			sv_profile.tick_late);
+
+	if (!total)
+	{
+		return;
+	}
+
+	for (i = 0; i < TICK_JITTER_BUCKETS; i++)
+	{
+		if (limits[i])
+		{
+			Com_Printf("  < %5i usec %10llu %6.2f%%\n", limits[i],
+					sv_profile.tick_jitter[i],
+					100.0 * sv_profile.tick_jitter[i] / total);
+		}
+		else
+		{
+			Com_Printf(" >= %5i usec %10llu %6.2f%%\n", limits[i - 1],
+					sv_profile.tick_jitter[i],
+					100.0 * sv_profile.tick_jitter[i] / total);
+		}
+	}
+}
+
+/*
+ * Prints the server timing statistics,
+ * "serverprofile reset" clears them.
+ */
+static void
+SV_ServerProfile_f(void)
+{
+	Com_Printf("%-24s %10s %10s %10s\n", "section", "count", "avg usec",
+			"max usec");
+	Com_Printf("------------------------ ---------- ---------- ----------\n");
+	SV_PrintProfStat("packet lookup", &sv_profile.packet_lookup);
+	SV_PrintProfStat("packet client", &sv_profile.packet_client);
+	SV_PrintProfStat("packet connectionless", &sv_profile.packet_connectionless);
+	SV_PrintProfStat("packet unknown", &sv_profile.packet_unknown);
+	SV_PrintProfStat("multicast", &sv_profile.multicast);
+	SV_PrintProfStat("entity budget", &sv_profile.entity_budget);
+	Com_Printf("\nqueries: %llu status, %llu info, %llu ping, %llu throttled, "
+			"%llu replies built\n", sv_profile.queries_status,
+			sv_profile.queries_info, sv_profile.queries_ping,
+			sv_profile.queries_throttled, sv_profile.queries_rebuilt);
+	SV_PrintTickJitter();
+
+	Com_Printf("\ndemo: %llu bytes queued, %u bytes backlog, "
+			"%u bytes high water\n", sv_profile.demo_queued,
+			SV_DemoBacklog(), sv_profile.demo_highwater);
+	SV_PrintProfStat("demo stall", &sv_profile.demo_stall);
+
+	Com_Printf("\n");
+	SV_PrintProfStat("save snapshot", &sv_profile.save_snapshot);
+	SV_PrintProfStat("save write", &sv_profile.save_write);
+
+	if ((Cmd_Argc() > 1) && !strcmp(Cmd_Argv(1), "reset"))
+	{
+		memset(&sv_profile, 0, sizeof(sv_profile));
+	}
+}
+
 void
 SV_InitOperatorCommands(void)
 {
@@ -781,6 +864,7 @@ SV_InitOperatorCommands(void)
 	Cmd_AddCommand("status", SV_Status_f);
 	Cmd_AddCommand("serverinfo", SV_Serverinfo_f);
 	Cmd_AddCommand("dumpuser", SV_DumpUser_f);
+	Cmd_AddCommand("serverprofile", SV_ServerProfile_f);
 
 	Cmd_AddCommand("map", SV_Map_f);
 	Cmd_AddCommand("listmaps", SV_ListMaps_f);
@@ -29,13 +29,195 @@
 extern cvar_t *hostname;
 extern cvar_t *rcon_password;
 
+/*
+ * Status and info replies are built at most once per server
+ * frame and then served as prebuilt out of band packets. A
+ * client connecting, leaving or changing its name marks them
+ * stale right away, serverinfo changes are picked up with the
+ * next frame.
+ */
+typedef struct
+{
+	qboolean valid;
+	int framenum;
+	int spawncount;
+	int time;
+	int length;
+	byte data[MAX_MSGLEN];
+} querycache_t;
+
+static querycache_t status_cache;
+static querycache_t info_cache;
+
+/*
+ * Query floods are throttled per source address by a token
+ * bucket. Tokens are kept in thousandths of a query, the
+ * bucket refills with sv_query_rate queries per second up to
+ * sv_query_burst. Buckets live in a small hash table, an
+ * address that collides with another one shares its bucket.
+ * Taking it over with a full bucket would let two addresses
+ * refill each other forever.
+ */
+#define QUERY_BUCKETS 1024
+#define QUERY_MAX 1000000 /* limit of sv_query_rate and sv_query_burst */
+
+typedef struct
+{
+	int time;
+	int tokens;
+} querybucket_t;
+
+static querybucket_t query_buckets[QUERY_BUCKETS];
+
+void
+SV_InvalidateQueryCache(void)
+{
+	status_cache.valid = false;
+	info_cache.valid = false;
+}
+
+static qboolean
+SVC_QueryCacheStale(const querycache_t *cache)
+{
+	return !cache->valid || (cache->framenum != sv.framenum) ||
+		(cache->spawncount != svs.spawncount) ||
+		(svs.realtime - cache->time >= 100) ||
+		(svs.realtime < cache->time);
+}
+
+static void
+SVC_QueryCacheStore(querycache_t *cache, const char *header, const char *text)
+{
+	/* -1 sequence means out of band */
+	memset(cache->data, 0xff, 4);
+	Com_sprintf((char *)cache->data + 4, sizeof(cache->data) - 4,
+			"%s%s", header, text);
+
+	cache->length = 4 + (int)strlen((char *)cache->data + 4);
+	cache->framenum = sv.framenum;
+	cache->spawncount = svs.spawncount;
+	cache->time = svs.realtime;
+	cache->valid = true;
+
+	sv_profile.queries_rebuilt++;
+}
+
+static unsigned int
+SVC_QueryHashKey(const netadr_t *adr)
+{
+	const byte *data;
+	unsigned int hash;
+	int i, len;
+
+	switch (adr->type)
+	{
+		case NA_IP:
+			data = adr->ip;
+			len = 4;
+			break;
+
+		case NA_IP6:
+			data = adr->ip;
+			len = 16;
+			break;
+
+		case NA_IPX:
+			data = adr->ipx;
+			len = 10;
+			break;
+
+		default:
+			data = NULL;
+			len = 0;
+			break;
+	}
+
+	/* FNV-1a */
+	hash = 2166136261u ^ adr->type;
+	hash *= 16777619u;
+
+	for (i = 0; i < len; i++)
+	{
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash & (QUERY_BUCKETS - 1);
+}
+
+/*
+ * Takes a token from the bucket of net_from. Returns
+ * false if the query should be dropped.
+ */
+static qboolean
+SVC_QueryAllowed(void)
+{
+	querybucket_t *bucket;
+	long long tokens;
+	int rate, burst, full;
+
+	/* the bucket holds burst * 1000 tokens, keep that in an int */
+	rate = (sv_query_rate->value > 0) ?
+		(int)Q_min(sv_query_rate->value, QUERY_MAX) : 0;
+
+	if ((rate <= 0) || NET_IsLocalAddress(net_from))
+	{
+		return true;
+	}
+
+	burst = (sv_query_burst->value > 1) ?
+		(int)Q_min(sv_query_burst->value, QUERY_MAX) : 1;
+
+	full = burst * 1000;
+
+	bucket = &query_buckets[SVC_QueryHashKey(&net_from)];
+
+	/* unused or from before a restart */
+	if (!bucket->time || (svs.realtime < bucket->time))
+	{
+		bucket->time = svs.realtime;
+		bucket->tokens = full;
+	}
+	else
+	{
+		/* in 64 bit, a long idle bucket or a high rate overflow an int */
+		tokens = bucket->tokens +
+			(long long)(svs.realtime - bucket->time) * rate;
+
+		bucket->tokens = (tokens > full) ? full : (int)tokens;
+		bucket->time = svs.realtime;
+	}
+
+	if (bucket->tokens < 1000)
+	{
+		sv_profile.queries_throttled++;
+		return false;
+	}
+
+	bucket->tokens -= 1000;
+
+	return true;
+}
+
 /*
  * Responds with all the info that qplug or qspy can see
  */
 static void
 SVC_Status(void)
 {
-	Netchan_OutOfBandPrint(NS_SERVER, net_from, "print\n%s", SV_StatusString());
+	sv_profile.queries_status++;
+
+	if (!SVC_QueryAllowed())
+	{
+		return;
+	}
+
+	if (SVC_QueryCacheStale(&status_cache))
+	{
+		SVC_QueryCacheStore(&status_cache, "print\n", SV_StatusString());
+	}
+
+	NET_SendPacket(NS_SERVER, status_cache.length, status_cache.data, net_from);
 }
 
 static void
@@ -53,23 +235,32 @@ SVC_Info(void)
 {
 	char string[64];
 	int version;
+	int i, count;
 
 	if (maxclients->value == 1)
 	{
 		return; /* ignore in single player */
 	}
 
+	sv_profile.queries_info++;
+
+	if (!SVC_QueryAllowed())
+	{
+		return;
+	}
+
 	version = (int)strtol(Cmd_Argv(1), (char **)NULL, 10);
 
 	if (version != PROTOCOL_VERSION)
 	{
 		Com_sprintf(string, sizeof(string), "%s: wrong version\n",
 				hostname->string);
+		Netchan_OutOfBandPrint(NS_SERVER, net_from, "info\n%s", string);
+		return;
 	}
-	else
-	{
-		int i, count;
 
+	if (SVC_QueryCacheStale(&info_cache))
+	{
 		count = 0;
 
 		for (i = 0; i < maxclients->value; i++)
@@ -83,9 +274,11 @@ SVC_Info(void)
 		Com_sprintf(string, sizeof(string), "%16s %8s %2i/%2i\n",
 				hostname->string, sv.name, count,
 				(int)maxclients->value);
+
+		SVC_QueryCacheStore(&info_cache, "info\n", string);
 	}
 
-	Netchan_OutOfBandPrint(NS_SERVER, net_from, "info\n%s", string);
+	NET_SendPacket(NS_SERVER, info_cache.length, info_cache.data, net_from);
 }
 
 /*
@@ -94,6 +287,13 @@ SVC_Info(void)
 static void
 SVC_Ping(void)
 {
+	sv_profile.queries_ping++;
+
+	if (!SVC_QueryAllowed())
+	{
+		return;
+	}
+
 	Netchan_OutOfBandPrint(NS_SERVER, net_from, "ack");
 }
 
@@ -158,6 +358,7 @@ SVC_DirectConnect(void)
 	int version;
 	int qport;
 	int challenge;
+	int extensions;
 
 	adr = net_from;
 
@@ -178,6 +379,9 @@ SVC_DirectConnect(void)
 
 	Q_strlcpy(userinfo, Cmd_Argv(4), sizeof(userinfo));
 
+	/* optional, older clients don't send it */
+	extensions = (int)strtol(Cmd_Argv(5), (char **)NULL, 10);
+
 	/* force the IP key/value pair so the game can filter based on ip */
 	Info_SetValueForKey(userinfo, "ip", NET_AdrToString(net_from));
 
@@ -270,10 +474,22 @@ gotnewcl:
 
 	/* build a new connection  accept the new client this
 	   is the only place a client_t is ever initialized */
+	SV_ClientHashRemove(newcl);
+
+	if (newcl->gamestate)
+	{
+		free(newcl->gamestate);
+	}
+
+	free(newcl->entity_deferred);
+
+	SV_CloseDownload(newcl);
+
 	*newcl = temp;
 	sv_client = newcl;
 	ent = CL_EDICT(newcl);
 	newcl->challenge = challenge; /* save challenge for checksumming */
+	newcl->extensions = extensions & PROTOCOL_EXT_ALL;
 
 	/* get the game a chance to reject this connection or modify the userinfo */
 	if (!(ge->ClientConnect(ent, userinfo)))
@@ -309,8 +525,10 @@ gotnewcl:
 	}
 
 	Netchan_Setup(NS_SERVER, &newcl->netchan, adr, qport);
+	SV_ClientHashAdd(newcl);
 
 	newcl->state = cs_connected;
+	SV_ClientMoved(newcl);
 
 	SZ_Init(&newcl->datagram, newcl->datagram_buf, sizeof(newcl->datagram_buf));
 	newcl->datagram.allowoverflow = true;
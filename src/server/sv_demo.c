@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 1997-2001 Id Software, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ * =======================================================================
+ *
+ * Server demo output. The main thread copies the demo messages into a
+ * single producer, single consumer ring buffer and a writer thread
+ * drains it to disk, so a slow disk doesn't stall the server frame.
+ * Optionally the demo is written as a gzip stream.
+ *
+ * =======================================================================
+ */
+
+#include <stdatomic.h>
+
+#include "header/server.h"
+#include "../common/unzip/miniz/miniz.h"
+
+#define DEMO_RING_SIZE 0x400000 /* must be a power of two */
+#define DEMO_RING_MASK (DEMO_RING_SIZE - 1)
+
+typedef struct
+{
+	FILE *file;
+	void *thread; /* NULL if writing synchronously */
+
+	/* head is only written by the main thread, tail
+	   only by the writer thread. Both are free running
+	   and masked when indexing the ring. */
+	byte *ring;
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_int stop;
+
+	/* deflate state, owned by the writer thread */
+	qboolean compress;
+	qboolean pending; /* input since the last sync flush */
+	z_stream stream;
+	mz_ulong crc;
+	unsigned int isize;
+	byte out[0x10000];
+} demowriter_t;
+
+static demowriter_t demo;
+
+static void
+SV_DemoDeflate(int flush)
+{
+	int status;
+	int len;
+
+	do
+	{
+		demo.stream.next_out = demo.out;
+		demo.stream.avail_out = sizeof(demo.out);
+
+		status = deflate(&demo.stream, flush);
+		len = sizeof(demo.out) - demo.stream.avail_out;
+
+		if (len)
+		{
+			fwrite(demo.out, len, 1, demo.file);
+		}
+
+		if (status < 0)
+		{
+			break; /* nothing left to do */
+		}
+	}
+	while (demo.stream.avail_in || !demo.stream.avail_out ||
+		((flush == Z_FINISH) && (status != Z_STREAM_END)));
+}
+
+static void
+SV_DemoOutput(const byte *data, int len)
+{
+	if (!demo.compress)
+	{
+		fwrite(data, len, 1, demo.file);
+		return;
+	}
+
+	demo.crc = crc32(demo.crc, data, len);
+	demo.isize += len;
+	demo.pending = true;
+
+	demo.stream.next_in = data;
+	demo.stream.avail_in = len;
+	SV_DemoDeflate(Z_NO_FLUSH);
+}
+
+/*
+ * Pushes everything written so far to the disk, so
+ * a crash loses at most what's still in the ring.
+ */
+static void
+SV_DemoSync(void)
+{
+	if (demo.pending)
+	{
+		SV_DemoDeflate(Z_SYNC_FLUSH);
+		demo.pending = false;
+	}
+
+	fflush(demo.file);
+}
+
+static void
+SV_DemoThread(void *arg)
+{
+	unsigned int head, tail, chunk, offset;
+
+	tail = atomic_load_explicit(&demo.tail, memory_order_relaxed);
+
+	while (1)
+	{
+		head = atomic_load_explicit(&demo.head, memory_order_acquire);
+
+		if (head == tail)
+		{
+			/* everything queued before stop was
+			   set is visible after reading it */
+			if (atomic_load_explicit(&demo.stop, memory_order_acquire))
+			{
+				if (atomic_load_explicit(&demo.head,
+						memory_order_acquire) == tail)
+				{
+					break;
+				}
+
+				continue;
+			}
+
+			SV_DemoSync();
+			Sys_Nanosleep(2000000);
+			continue;
+		}
+
+		offset = tail & DEMO_RING_MASK;
+		chunk = head - tail;
+
+		if (chunk > DEMO_RING_SIZE - offset)
+		{
+			chunk = DEMO_RING_SIZE - offset;
+		}
+
+		SV_DemoOutput(demo.ring + offset, chunk);
+
+		tail += chunk;
+		atomic_store_explicit(&demo.tail, tail, memory_order_release);
+	}
+}
+
+/*
+ * Opens name for a new server demo and starts the writer thread.
+ */
+qboolean
+SV_DemoOpen(const char *name, qboolean compress)
+{
+	/* gzip member header: deflate, no flags, no mtime, unknown OS */
+	static const byte gzheader[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+
+	memset(&demo, 0, sizeof(demo));
+	demo.file = Q_fopen(name, "wb");
+
+	if (!demo.file)
+	{
+		return false;
+	}
+
+	if (compress)
+	{
+		if (deflateInit2(&demo.stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				-MZ_DEFAULT_WINDOW_BITS, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			fclose(demo.file);
+			return false;
+		}
+
+		fwrite(gzheader, sizeof(gzheader), 1, demo.file);
+		demo.compress = true;
+		demo.crc = crc32(0, NULL, 0);
+	}
+
+	demo.ring = malloc(DEMO_RING_SIZE);
+	YQ2_COM_CHECK_OOM(demo.ring, "malloc()", DEMO_RING_SIZE)
+
+	atomic_init(&demo.head, 0);
+	atomic_init(&demo.tail, 0);
+	atomic_init(&demo.stop, 0);
+
+	demo.thread = Sys_CreateThread(SV_DemoThread, NULL);
+
+	if (!demo.thread)
+	{
+		Com_Printf("WARNING: couldn't start the demo writer, "
+				"writing synchronously.\n");
+	}
+
+	svs.demofile = demo.file;
+
+	return true;
+}
+
+/*
+ * Queues len bytes for the demo file. Only waits if
+ * the writer thread fell a whole ring behind.
+ */
+void
+SV_DemoWrite(const void *data, int len)
+{
+	unsigned int head, tail, used, offset, chunk;
+	long long start;
+
+	if (!svs.demofile)
+	{
+		return;
+	}
+
+	sv_profile.demo_queued += len;
+
+	if (!demo.thread)
+	{
+		SV_DemoOutput(data, len);
+		return;
+	}
+
+	head = atomic_load_explicit(&demo.head, memory_order_relaxed);
+	tail = atomic_load_explicit(&demo.tail, memory_order_acquire);
+
+	if (DEMO_RING_SIZE - (head - tail) < (unsigned int)len)
+	{
+		/* the disk doesn't keep up */
+		start = Sys_Microseconds();
+
+		do
+		{
+			Sys_Nanosleep(100000);
+			tail = atomic_load_explicit(&demo.tail, memory_order_acquire);
+		}
+		while (DEMO_RING_SIZE - (head - tail) < (unsigned int)len);
+
+		SV_ProfileAdd(&sv_profile.demo_stall, Sys_Microseconds() - start);
+	}
+
+	offset = head & DEMO_RING_MASK;
+	chunk = Q_min((unsigned int)len, DEMO_RING_SIZE - offset);
+
+	memcpy(demo.ring + offset, data, chunk);
+	memcpy(demo.ring, (const byte *)data + chunk, len - chunk);
+
+	atomic_store_explicit(&demo.head, head + len, memory_order_release);
+
+	used = head + len - tail;
+
+	if (used > sv_profile.demo_highwater)
+	{
+		sv_profile.demo_highwater = used;
+	}
+}
+
+/*
+ * Bytes queued but not yet written.
+ */
+unsigned int
+SV_DemoBacklog(void)
+{
+	if (!svs.demofile || !demo.thread)
+	{
+		return 0;
+	}
+
+	return atomic_load_explicit(&demo.head, memory_order_relaxed) -
+		atomic_load_explicit(&demo.tail, memory_order_acquire);
+}
+
+/*
+ * Waits for the writer to drain the ring and closes the demo.
+ */
+void
+SV_DemoClose(void)
+{
+	byte trailer[8];
+	int i;
+
+	if (!svs.demofile)
+	{
+		return;
+	}
+
+	if (demo.thread)
+	{
+		atomic_store_explicit(&demo.stop, 1, memory_order_release);
+		Sys_JoinThread(demo.thread);
+		demo.thread = NULL;
+	}
+
+	if (demo.compress)
+	{
+		SV_DemoDeflate(Z_FINISH);
+		deflateEnd(&demo.stream);
+
+		/* crc32 and uncompressed size, little endian */
+		for (i = 0; i < 4; i++)
+		{
+			trailer[i] = (demo.crc >> (i * 8)) & 0xff;
+			trailer[i + 4] = (demo.isize >> (i * 8)) & 0xff;
+		}
+
+		fwrite(trailer, sizeof(trailer), 1, demo.file);
+	}
+
+	fclose(demo.file);
+	demo.file = NULL;
+
+	free(demo.ring);
+	demo.ring = NULL;
+
+	svs.demofile = NULL;
+}
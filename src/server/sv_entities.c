@@ -448,8 +448,332 @@ SV_WritePlayerstateToClient(client_frame_t *from, client_frame_t *to,
 	}
 }
 
+typedef struct
+{
+	int index;                  /* position in the frame */
+	int cost;                   /* bytes the update would take */
+	const entity_xstate_t *from;    /* state the client has, if any */
+	float priority;
+} entbudget_t;
+
+static entbudget_t budget_ents[MAX_EDICTS];
+static qboolean budget_deferred[MAX_EDICTS];
+
+static int
+SV_CompareEntityPriority(const void *a, const void *b)
+{
+	const entbudget_t *ea = (const entbudget_t *)a;
+	const entbudget_t *eb = (const entbudget_t *)b;
+
+	if (ea->priority != eb->priority)
+	{
+		return (ea->priority > eb->priority) ? -1 : 1;
+	}
+
+	/* keep the order stable between frames */
+	return ea->index - eb->index;
+}
+
+/*
+ * Ranks an entity update by how much the client would
+ * miss it. Other players come first, then projectiles,
+ * then monsters. Close, big on screen and fast moving
+ * things are ranked up, and so is everything that was
+ * held back for a while.
+ */
+static float
+SV_EntityPriority(const client_t *client, const vec3_t org,
+		const entity_xstate_t *from, const entity_xstate_t *to)
+{
+	const edict_t *ent;
+	vec3_t center, delta;
+	float dist, radius, priority;
+	int i;
+
+	ent = EDICT_NUM(to->number);
+
+	if (to->number <= maxclients->value)
+	{
+		priority = 8;
+	}
+	else if (ent->owner && (ent->owner != ent) &&
+			 (ent->owner->client || (ent->owner->svflags & SVF_MONSTER)))
+	{
+		priority = 4;
+	}
+	else if (ent->svflags & SVF_MONSTER)
+	{
+		priority = 2;
+	}
+	else
+	{
+		priority = 1;
+	}
+
+	for (i = 0; i < 3; i++)
+	{
+		center[i] = (ent->absmin[i] + ent->absmax[i]) * 0.5f;
+		delta[i] = ent->absmax[i] - ent->absmin[i];
+	}
+
+	radius = VectorLength(delta) * 0.5f;
+
+	VectorSubtract(center, org, delta);
+	dist = Q_max(VectorLength(delta), 64.0f);
+
+	/* screen space size, then distance falloff */
+	priority *= 1.0f + radius / dist;
+	priority /= 1.0f + dist / 1024.0f;
+
+	/* recent change */
+	if (!from)
+	{
+		priority *= 2.0f;
+	}
+	else
+	{
+		VectorSubtract(to->origin, from->origin, delta);
+		priority *= 1.0f + Q_min(VectorLength(delta), 256.0f) / 64.0f;
+	}
+
+	return priority * (1 + client->entity_deferred[to->number]);
+}
+
+/*
+ * The game may hand out more than MAX_EDICTS entities,
+ * so the deferral counters are sized from ge->max_edicts
+ * and grown when a map raises it.
+ */
+static void
+SV_AllocEntityDeferred(client_t *client)
+{
+	if (client->num_entity_deferred >= ge->max_edicts)
+	{
+		return;
+	}
+
+	free(client->entity_deferred);
+	client->entity_deferred = malloc(ge->max_edicts);
+	YQ2_COM_CHECK_OOM(client->entity_deferred, "malloc()", ge->max_edicts)
+
+	memset(client->entity_deferred, 0, ge->max_edicts);
+	client->num_entity_deferred = ge->max_edicts;
+}
+
+/*
+ * Fits the packet entities of a frame into the given number
+ * of bytes. Removals, events, the client's own entity and
+ * unchanged entities are always sent, everything else is
+ * ranked and the least relevant updates are deferred. A
+ * deferred entity keeps the state the client already has,
+ * an entity new to the client is left out of the frame
+ * until there's room for it. The frame is rewritten to
+ * match what's actually sent, so later deltas stay valid.
+ */
+static void
+SV_BudgetPacketEntities(client_t *client, const client_frame_t *from,
+		client_frame_t *to, int budget)
+{
+	const entity_xstate_t *oldent, *newent;
+	entity_xstate_t *dst;
+	const edict_t *clent;
+	int oldindex, newindex, outindex;
+	int from_num_entities, numranked, optional, cost, i;
+	int oldnum, newnum;
+	qboolean force;
+	vec3_t org;
+
+	if (to->num_entities > MAX_EDICTS)
+	{
+		return;
+	}
+
+	SV_AllocEntityDeferred(client);
+
+	clent = CL_EDICT(client);
+	from_num_entities = from ? from->num_entities : 0;
+
+	/* pass 1: pay for the mandatory updates and collect the rest */
+	numranked = 0;
+	optional = 0;
+	newindex = 0;
+	oldindex = 0;
+
+	while (newindex < to->num_entities || oldindex < from_num_entities)
+	{
+		newnum = 99999;
+		oldnum = 99999;
+		newent = NULL;
+		oldent = NULL;
+
+		if (newindex < to->num_entities)
+		{
+			newent = &svs.client_entities[(to->first_entity +
+					 newindex) % svs.num_client_entities];
+			newnum = newent->number;
+		}
+
+		if (oldindex < from_num_entities)
+		{
+			oldent = &svs.client_entities[(from->first_entity +
+					 oldindex) % svs.num_client_entities];
+			oldnum = oldent->number;
+		}
+
+		if (newnum > oldnum)
+		{
+			/* removal */
+			budget -= (oldnum >= 256) ? 4 : 2;
+			oldindex++;
+			continue;
+		}
+
+		budget_deferred[newindex] = false;
+
+		if (newnum == oldnum)
+		{
+			cost = MSG_DeltaEntity_Size(oldent, newent, false,
+					newnum <= maxclients->value, client->protocol);
+			oldindex++;
+		}
+		else
+		{
+			oldent = NULL;
+			cost = MSG_DeltaEntity_Size(
+				(newnum < sv.numbaselines) ? &sv.baselines[newnum] : NULL,
+				newent, true, true, client->protocol);
+		}
+
+		force = !cost || newent->event || (newnum == NUM_FOR_EDICT(clent));
+
+		if (force)
+		{
+			budget -= cost;
+			client->entity_deferred[newnum] = 0;
+		}
+		else
+		{
+			budget_ents[numranked].index = newindex;
+			budget_ents[numranked].cost = cost;
+			budget_ents[numranked].from = oldent;
+			budget_ents[numranked].priority = 0;
+			numranked++;
+			optional += cost;
+		}
+
+		newindex++;
+	}
+
+	if (optional <= budget)
+	{
+		/* everything fits */
+		for (i = 0; i < numranked; i++)
+		{
+			newent = &svs.client_entities[(to->first_entity +
+					 budget_ents[i].index) % svs.num_client_entities];
+			client->entity_deferred[newent->number] = 0;
+		}
+
+		return;
+	}
+
+	/* pass 2: rank the optional updates and take them while they fit */
+	VectorCopy(clent->s.origin, org);
+
+	for (i = 0; i < numranked; i++)
+	{
+		newent = &svs.client_entities[(to->first_entity +
+				 budget_ents[i].index) % svs.num_client_entities];
+		budget_ents[i].priority = SV_EntityPriority(client, org,
+				budget_ents[i].from, newent);
+	}
+
+	qsort(budget_ents, numranked, sizeof(budget_ents[0]), SV_CompareEntityPriority);
+
+	for (i = 0; i < numranked; i++)
+	{
+		newent = &svs.client_entities[(to->first_entity +
+				 budget_ents[i].index) % svs.num_client_entities];
+
+		if (budget_ents[i].cost <= budget)
+		{
+			budget -= budget_ents[i].cost;
+			client->entity_deferred[newent->number] = 0;
+		}
+		else
+		{
+			budget_deferred[budget_ents[i].index] = true;
+
+			if (client->entity_deferred[newent->number] < 255)
+			{
+				client->entity_deferred[newent->number]++;
+			}
+		}
+	}
+
+	/* pass 3: rewrite the frame in place */
+	oldindex = 0;
+	outindex = 0;
+
+	for (newindex = 0; newindex < to->num_entities; newindex++)
+	{
+		newent = &svs.client_entities[(to->first_entity +
+				 newindex) % svs.num_client_entities];
+		dst = &svs.client_entities[(to->first_entity +
+				 outindex) % svs.num_client_entities];
+
+		while (oldindex < from_num_entities &&
+			   svs.client_entities[(from->first_entity + oldindex) %
+					svs.num_client_entities].number < newent->number)
+		{
+			oldindex++;
+		}
+
+		if (!budget_deferred[newindex])
+		{
+			if (dst != newent)
+			{
+				*dst = *newent;
+			}
+
+			outindex++;
+			continue;
+		}
+
+		oldent = NULL;
+
+		if (oldindex < from_num_entities)
+		{
+			oldent = &svs.client_entities[(from->first_entity +
+					 oldindex) % svs.num_client_entities];
+
+			if (oldent->number != newent->number)
+			{
+				oldent = NULL;
+			}
+		}
+
+		if (oldent)
+		{
+			/* keep what the client has, the event was already played */
+			*dst = *oldent;
+			dst->event = 0;
+			outindex++;
+		}
+	}
+
+	/* this frame is the newest in the ring, give back the unused slots */
+	svs.next_client_entities -= to->num_entities - outindex;
+	to->num_entities = outindex;
+}
+
+/*
+ * Writes the frame of a client to the message. If budget
+ * isn't -1, the message is kept within that many bytes by
+ * deferring the less relevant entity updates.
+ */
 void
-SV_WriteFrameToClient(client_t *client, sizebuf_t *msg)
+SV_WriteFrameToClient(client_t *client, sizebuf_t *msg, int budget)
 {
 	client_frame_t *frame, *oldframe;
 	int lastframe;
@@ -489,6 +813,18 @@ SV_WriteFrameToClient(client_t *client, sizebuf_t *msg)
 	/* delta encode the playerstate */
 	SV_WritePlayerstateToClient(oldframe, frame, msg, client->protocol);
 
+	/* fit the entities into what's left, keeping room for the
+	   multicast datagram and the packetentities header and end */
+	if (budget >= 0)
+	{
+		long long start;
+
+		start = Sys_Microseconds();
+		SV_BudgetPacketEntities(client, oldframe, frame,
+				budget - msg->cursize - client->datagram.cursize - 3);
+		SV_ProfileAdd(&sv_profile.entity_budget, Sys_Microseconds() - start);
+	}
+
 	/* delta encode the entities */
 	SV_EmitPacketEntities(oldframe, frame, msg, client->protocol);
 }
@@ -814,7 +1150,7 @@ SV_RecordDemoMessage(void)
 
 	/* now write the entire message to the file, prefixed by the length */
 	len = LittleLong(buf.cursize);
-	fwrite(&len, 4, 1, svs.demofile);
-	fwrite(buf.data, buf.cursize, 1, svs.demofile);
+	SV_DemoWrite(&len, 4);
+	SV_DemoWrite(buf.data, buf.cursize);
 }
 
@@ -256,6 +256,8 @@ PF_Configstring(int index, const char *val)
 		strcpy(cs, val);
 	}
 
+	SV_InvalidateConfigstringIndex(internal_index);
+
 	if (sv.state != ss_loading)
 	{
 		/* send the update to everyone */
@@ -565,6 +567,9 @@ SV_InitGameProgs(void)
 
 	Com_Printf("-------- game initialization -------\n");
 
+	Cvar_FullSet("sv_features", va("%i", SV_FEATURE_WRITESAVEFILE),
+		CVAR_NOSET);
+
 	/* load a new game dll */
 	import.multicast = SV_Multicast;
 	import.unicast = PF_Unicast;
@@ -634,6 +639,7 @@ SV_InitGameProgs(void)
 	import.LocalizationMessage = PF_LocalizationMessage;
 	import.LocalizationUIMessage = SV_LocalizationUIMessage;
 	import.TagRealloc = Z_TagRealloc;
+	import.WriteSaveFile = SV_GameWriteSaveFile;
 
 	ge = (game_export_t *)Sys_GetGameAPI(&import);
 
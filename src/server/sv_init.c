@@ -56,10 +56,88 @@ SV_AllocBaseline(int entnum)
 	return &sv.baselines[entnum];
 }
 
+static unsigned int
+SV_ConfigstringHash(const char *name)
+{
+	unsigned int hash;
+
+	hash = 2166136261u;
+
+	while (*name)
+	{
+		hash = (hash ^ (byte)*name++) * 16777619u;
+	}
+
+	return hash & (CS_INDEX_SIZE - 1);
+}
+
+/*
+ * Adds the configstrings from index->used up to the next
+ * empty one to the index. Like the linear search it
+ * replaces, the first slot holding a string wins.
+ */
+static void
+SV_ExtendConfigstringIndex(csindex_t *index, int start, int max)
+{
+	const char *name;
+	unsigned int h;
+	int slot;
+
+	while ((index->used < max) && sv.configstrings[start + index->used][0])
+	{
+		name = sv.configstrings[start + index->used];
+
+		for (h = SV_ConfigstringHash(name); index->slots[h];
+			h = (h + 1) & (CS_INDEX_SIZE - 1))
+		{
+			slot = index->slots[h];
+
+			if (!strcmp(sv.configstrings[start + slot], name))
+			{
+				break;
+			}
+		}
+
+		if (!index->slots[h])
+		{
+			index->slots[h] = index->used;
+		}
+
+		index->used++;
+	}
+}
+
+/*
+ * Forgets the index covering the configstring
+ * index, so it's rebuilt on its next use. Must be
+ * called when configstrings are written directly.
+ * -1 invalidates all of them.
+ */
+void
+SV_InvalidateConfigstringIndex(int index)
+{
+	if ((index < 0) || ((index >= CS_MODELS) && (index < CS_SOUNDS)))
+	{
+		sv.modelindex.valid = false;
+	}
+
+	if ((index < 0) || ((index >= CS_SOUNDS) && (index < CS_IMAGES)))
+	{
+		sv.soundindex.valid = false;
+	}
+
+	if ((index < 0) || ((index >= CS_IMAGES) && (index < CS_LIGHTS)))
+	{
+		sv.imageindex.valid = false;
+	}
+}
+
 static int
-SV_FindIndex(const char *name, int start, int max, qboolean create)
+SV_FindIndex(const char *name, csindex_t *index, int start, int max,
+		qboolean create)
 {
 	size_t len, space;
+	unsigned int h;
 	int i, protocol;
 
 	if (!name || !name[0])
@@ -69,8 +147,20 @@ SV_FindIndex(const char *name, int start, int max, qboolean create)
 
 	protocol = sv_client ? sv_client->protocol : PROTOCOL_VERSION;
 
-	for (i = 1; i < max && sv.configstrings[start + i][0]; i++)
+	if (!index->valid)
+	{
+		memset(index->slots, 0, sizeof(index->slots));
+		index->used = 1;
+		index->valid = true;
+
+		SV_ExtendConfigstringIndex(index, start, max);
+	}
+
+	for (h = SV_ConfigstringHash(name); index->slots[h];
+		h = (h + 1) & (CS_INDEX_SIZE - 1))
 	{
+		i = index->slots[h];
+
 		if (!strcmp(sv.configstrings[start + i], name))
 		{
 			return i;
@@ -82,6 +172,8 @@ SV_FindIndex(const char *name, int start, int max, qboolean create)
 		return 0;
 	}
 
+	i = index->used;
+
 	if (i == max)
 	{
 		if (!StringList_IsInList(&sv.configstrings_overflow, name))
@@ -118,6 +210,8 @@ SV_FindIndex(const char *name, int start, int max, qboolean create)
 		return 0;
 	}
 
+	SV_ExtendConfigstringIndex(index, start, max);
+
 	if (sv.state != ss_loading)
 	{
 		/* send the update to everyone */
@@ -134,19 +228,19 @@ SV_FindIndex(const char *name, int start, int max, qboolean create)
 int
 SV_ModelIndex(const char *name)
 {
-	return SV_FindIndex(name, CS_MODELS, MAX_MODELS, true);
+	return SV_FindIndex(name, &sv.modelindex, CS_MODELS, MAX_MODELS, true);
 }
 
 int
 SV_SoundIndex(const char *name)
 {
-	return SV_FindIndex(name, CS_SOUNDS, MAX_SOUNDS, true);
+	return SV_FindIndex(name, &sv.soundindex, CS_SOUNDS, MAX_SOUNDS, true);
 }
 
 int
 SV_ImageIndex(const char *name)
 {
-	return SV_FindIndex(name, CS_IMAGES, MAX_IMAGES, true);
+	return SV_FindIndex(name, &sv.imageindex, CS_IMAGES, MAX_IMAGES, true);
 }
 
 /*
@@ -362,6 +456,8 @@ SV_SpawnServer(char *server, char *spawnpoint, server_state_t serverstate,
 		sv.models[i + 1] = CM_InlineModel(sv.configstrings[CS_MODELS + 1 + i]);
 	}
 
+	SV_InvalidateConfigstringIndex(CS_MODELS);
+
 	/* spawn the rest of the entities on the map */
 	sv.state = ss_loading;
 	Com_SetServerState(sv.state);
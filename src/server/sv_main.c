@@ -32,6 +32,8 @@ netadr_t master_adr[MAX_MASTERS]; /* address of group servers */
 
 client_t *sv_client; /* current client */
 
+sv_profile_t sv_profile;
+
 static cvar_t *sv_optimize_sp_loadtime;
 static cvar_t *sv_optimize_mp_loadtime;
 
@@ -55,6 +57,13 @@ cvar_t *public_server; /* should heartbeats be sent */
 cvar_t *sv_entfile; /* External entity files. */
 cvar_t *sv_downloadserver; /* Download server. */
 cvar_t *sv_language; /* Server message language. */
+cvar_t *sv_entity_budget; /* Trim frames to the client's rate. */
+cvar_t *sv_gamestate_compression; /* Deflate the gamestate on connect. */
+cvar_t *sv_download_rate; /* Bytes per second for windowed downloads. */
+cvar_t *sv_query_rate; /* Connectionless queries per second and address. */
+cvar_t *sv_query_burst; /* Queries an address may send at once. */
+cvar_t *sv_tickscheduler; /* Sleep exactly until the next tick. */
+cvar_t *sv_demo_compress; /* Write server demos gzipped. */
 
 /*
  * Called when the player is totally leaving the server, either willingly
@@ -74,14 +83,195 @@ SV_DropClient(client_t *drop)
 		ge->ClientDisconnect(CL_EDICT(drop));
 	}
 
-	if (drop->download)
+	SV_CloseDownload(drop);
+
+	if (drop->gamestate)
 	{
-		FS_FreeFile(drop->download);
-		drop->download = NULL;
+		free(drop->gamestate);
+		drop->gamestate = NULL;
 	}
 
+	free(drop->entity_deferred);
+	drop->entity_deferred = NULL;
+	drop->num_entity_deferred = 0;
+
 	drop->state = cs_zombie; /* become free in a few seconds */
 	drop->name[0] = 0;
+
+	SV_InvalidateQueryCache();
+}
+
+void
+SV_ProfileAdd(profstat_t *stat, long long usec)
+{
+	stat->count++;
+	stat->usec += usec;
+
+	if (usec > stat->max_usec)
+	{
+		stat->max_usec = usec;
+	}
+}
+
+/*
+ * Records how far apart two game frames were.
+ */
+void
+SV_ProfileTick(long long interval)
+{
+	static const int limits[TICK_JITTER_BUCKETS] = TICK_JITTER_LIMITS;
+	long long jitter;
+	int i;
+
+	jitter = interval - 100000;
+
+	if (jitter < 0)
+	{
+		jitter = -jitter;
+
+		if (jitter > sv_profile.tick_early)
+		{
+			sv_profile.tick_early = jitter;
+		}
+	}
+	else if (jitter > sv_profile.tick_late)
+	{
+		sv_profile.tick_late = jitter;
+	}
+
+	for (i = 0; i < TICK_JITTER_BUCKETS - 1; i++)
+	{
+		if (jitter < limits[i])
+		{
+			break;
+		}
+	}
+
+	sv_profile.tick_jitter[i]++;
+}
+
+/*
+ * Clients are hashed by their base address and qport, which
+ * is what SV_ReadPackets uses to find the owner of a packet.
+ * The port isn't part of the key, so fixing up a translated
+ * port doesn't need a rehash. Dropped clients stay hashed
+ * while they're zombies and are removed when they become
+ * cs_free.
+ */
+static unsigned int
+SV_ClientHashKey(const netadr_t *adr, int qport)
+{
+	const byte *data;
+	unsigned int hash;
+	int i, len;
+
+	switch (adr->type)
+	{
+		case NA_IP:
+			data = adr->ip;
+			len = 4;
+			break;
+
+		case NA_IP6:
+			data = adr->ip;
+			len = 16;
+			break;
+
+		case NA_IPX:
+			data = adr->ipx;
+			len = 10;
+			break;
+
+		default:
+			data = NULL;
+			len = 0;
+			break;
+	}
+
+	/* FNV-1a */
+	hash = 2166136261u ^ adr->type;
+	hash *= 16777619u;
+
+	for (i = 0; i < len; i++)
+	{
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	hash ^= qport & 0xffff;
+	hash *= 16777619u;
+
+	return hash & (CLIENT_HASH_SIZE - 1);
+}
+
+void
+SV_ClientHashAdd(client_t *cl)
+{
+	unsigned int key;
+
+	SV_ClientHashRemove(cl);
+
+	key = SV_ClientHashKey(&cl->netchan.remote_address, cl->netchan.qport);
+	cl->hash_next = svs.clienthash[key];
+	svs.clienthash[key] = (cl - svs.clients) + 1;
+}
+
+void
+SV_ClientHashRemove(client_t *cl)
+{
+	unsigned int key;
+	int *link;
+	int slot;
+
+	key = SV_ClientHashKey(&cl->netchan.remote_address, cl->netchan.qport);
+	slot = (cl - svs.clients) + 1;
+
+	for (link = &svs.clienthash[key]; *link; link = &svs.clients[*link - 1].hash_next)
+	{
+		if (*link == slot)
+		{
+			*link = cl->hash_next;
+			break;
+		}
+	}
+
+	cl->hash_next = 0;
+}
+
+/*
+ * Returns the client owning a packet from adr with
+ * the given qport. Like a scan over all client slots
+ * the lowest matching slot wins.
+ */
+client_t *
+SV_ClientHashFind(netadr_t adr, int qport)
+{
+	client_t *cl, *best;
+	int slot;
+
+	best = NULL;
+
+	for (slot = svs.clienthash[SV_ClientHashKey(&adr, qport)]; slot; slot = cl->hash_next)
+	{
+		cl = &svs.clients[slot - 1];
+
+		if ((cl->state == cs_free) || (cl->netchan.qport != qport))
+		{
+			continue;
+		}
+
+		if (!NET_CompareBaseAdr(adr, cl->netchan.remote_address))
+		{
+			continue;
+		}
+
+		if (!best || (cl < best))
+		{
+			best = cl;
+		}
+	}
+
+	return best;
 }
 
 /*
@@ -196,16 +386,20 @@ SV_GiveMsec(void)
 static void
 SV_ReadPackets(void)
 {
-	int i;
 	client_t *cl;
 	int qport;
+	long long start, lookup;
 
 	while (NET_GetPacket(NS_SERVER, &net_from, &net_message))
 	{
+		start = Sys_Microseconds();
+
 		/* check for connectionless packet (0xffffffff) first */
 		if (*(int *)net_message.data == -1)
 		{
 			SV_ConnectionlessPacket();
+			SV_ProfileAdd(&sv_profile.packet_connectionless,
+					Sys_Microseconds() - start);
 			continue;
 		}
 
@@ -217,50 +411,38 @@ SV_ReadPackets(void)
 		qport = MSG_ReadShort(&net_message) & 0xffff;
 
 		/* check for packets from connected clients */
-		for (i = 0, cl = svs.clients; i < maxclients->value; i++, cl++)
-		{
-			if (cl->state == cs_free)
-			{
-				continue;
-			}
+		cl = SV_ClientHashFind(net_from, qport);
 
-			if (!NET_CompareBaseAdr(net_from, cl->netchan.remote_address))
-			{
-				continue;
-			}
+		lookup = Sys_Microseconds();
+		SV_ProfileAdd(&sv_profile.packet_lookup, lookup - start);
 
-			if (cl->netchan.qport != qport)
-			{
-				continue;
-			}
+		if (!cl)
+		{
+			SV_ProfileAdd(&sv_profile.packet_unknown, lookup - start);
+			continue;
+		}
 
-			if (cl->netchan.remote_address.port != net_from.port)
-			{
-				Com_Printf("%s: fixing up a translated port\n", __func__);
-				cl->netchan.remote_address.port = net_from.port;
-			}
+		if (cl->netchan.remote_address.port != net_from.port)
+		{
+			Com_Printf("%s: fixing up a translated port\n", __func__);
+			cl->netchan.remote_address.port = net_from.port;
+		}
 
-			if (Netchan_Process(&cl->netchan, &net_message))
+		if (Netchan_Process(&cl->netchan, &net_message))
+		{
+			/* this is a valid, sequenced packet, so process it */
+			if (cl->state != cs_zombie)
 			{
-				/* this is a valid, sequenced packet, so process it */
-				if (cl->state != cs_zombie)
-				{
-					cl->lastmessage = svs.realtime; /* don't timeout */
+				cl->lastmessage = svs.realtime; /* don't timeout */
 
-					if (!(sv.demofile && (sv.state == ss_demo)))
-					{
-						SV_ExecuteClientMessage(cl);
-					}
+				if (!(sv.demofile && (sv.state == ss_demo)))
+				{
+					SV_ExecuteClientMessage(cl);
 				}
 			}
-
-			break;
 		}
 
-		if (i != maxclients->value)
-		{
-			continue;
-		}
+		SV_ProfileAdd(&sv_profile.packet_client, Sys_Microseconds() - start);
 	}
 }
 
@@ -295,6 +477,7 @@ SV_CheckTimeouts(void)
 		if ((cl->state == cs_zombie) &&
 			(cl->lastmessage < zombiepoint))
 		{
+			SV_ClientHashRemove(cl);
 			cl->state = cs_free; /* can now be reused */
 			continue;
 		}
@@ -304,6 +487,7 @@ SV_CheckTimeouts(void)
 		{
 			SV_BroadcastPrintf(PRINT_HIGH, "%s timed out\n", cl->name);
 			SV_DropClient(cl);
+			SV_ClientHashRemove(cl);
 			cl->state = cs_free; /* don't bother with zombie state */
 		}
 	}
@@ -390,6 +574,7 @@ void
 SV_Frame(int usec)
 {
 	int opt_sendrate;
+	long long now;
 
 #ifndef DEDICATED_ONLY
 	time_before_game = time_after_game = 0;
@@ -401,7 +586,14 @@ SV_Frame(int usec)
 		return;
 	}
 
-	svs.realtime += usec / 1000;
+	/* finish savegames written in the background */
+	SV_CheckSaves();
+
+	/* carry the sub millisecond part over, otherwise the
+	   server clock falls behind when called more often */
+	svs.realtime_usec += usec;
+	svs.realtime += svs.realtime_usec / 1000;
+	svs.realtime_usec %= 1000;
 
 	/* keep the random time dependent */
 	randk();
@@ -436,10 +628,33 @@ SV_Frame(int usec)
 			svs.realtime = sv.time - 100;
 		}
 
-		NET_Sleep(sv.time - svs.realtime);
+		/* send replies to the packets read above */
+		NET_Flush(NS_SERVER);
+
+		if (sv_tickscheduler->value)
+		{
+			NET_SleepUntil(Sys_Microseconds() +
+					(sv.time - svs.realtime) * 1000ll - svs.realtime_usec);
+		}
+		else
+		{
+			NET_Sleep(sv.time - svs.realtime);
+		}
+
 		return;
 	}
 
+	now = Sys_Microseconds();
+
+	/* the first frame after spawning catches
+	   up with the clock, don't count it */
+	if (sv.ticktime && (sv.framenum > 1) && !sv_timedemo->value)
+	{
+		SV_ProfileTick(now - sv.ticktime);
+	}
+
+	sv.ticktime = now;
+
 	/* update ping based on the last known frame from all clients */
 	SV_CalcPings();
 
@@ -466,6 +681,9 @@ SV_Frame(int usec)
 
 	/* clear teleport flags, etc for next frame */
 	SV_PrepWorldFrame();
+
+	/* push out everything queued this frame */
+	NET_Flush(NS_SERVER);
 }
 
 /*
@@ -566,6 +784,7 @@ SV_UserinfoChanged(client_t *cl)
 
 	/* name for C code */
 	Q_strlcpy(cl->name, Info_ValueForKey(cl->userinfo, "name"), sizeof(cl->name));
+	SV_InvalidateQueryCache();
 
 	/* mask off high bit */
 	for (i = 0; i < sizeof(cl->name); i++)
@@ -643,6 +862,14 @@ SV_Init(void)
 
 	sv_entfile = Cvar_Get("sv_entfile", "1", CVAR_ARCHIVE);
 
+	sv_entity_budget = Cvar_Get("sv_entity_budget", "1", 0);
+	sv_gamestate_compression = Cvar_Get("sv_gamestate_compression", "1", 0);
+	sv_download_rate = Cvar_Get("sv_download_rate", "131072", 0);
+	sv_query_rate = Cvar_Get("sv_query_rate", "4", 0);
+	sv_query_burst = Cvar_Get("sv_query_burst", "8", 0);
+	sv_tickscheduler = Cvar_Get("sv_tickscheduler", "1", 0);
+	sv_demo_compress = Cvar_Get("sv_demo_compress", "0", 0);
+
 	SZ_Init(&net_message, net_message_buffer, sizeof(net_message_buffer));
 }
 
@@ -692,6 +919,8 @@ SV_FinalMessage(const char *message, qboolean reconnect)
 		}
 	}
 
+	NET_Flush(NS_SERVER);
+
 	for (i = 0, cl = svs.clients; i < numClients; i++, cl++)
 	{
 		if (cl->state >= cs_connected)
@@ -700,6 +929,8 @@ SV_FinalMessage(const char *message, qboolean reconnect)
 					net_message.data);
 		}
 	}
+
+	NET_Flush(NS_SERVER);
 }
 
 /* Also called in SpawnServer just in case */
@@ -722,6 +953,8 @@ SV_ClearBaselines(void)
 void
 SV_Shutdown(const char *finalmsg, qboolean reconnect)
 {
+	int i;
+
 	if (svs.clients)
 	{
 		SV_FinalMessage(finalmsg, reconnect);
@@ -729,6 +962,7 @@ SV_Shutdown(const char *finalmsg, qboolean reconnect)
 
 	Master_Shutdown();
 	SV_ShutdownGameProgs();
+	SV_WaitForSaves();
 
 	/* free current level */
 	if (sv.demofile)
@@ -747,18 +981,24 @@ SV_Shutdown(const char *finalmsg, qboolean reconnect)
 	/* free server static data */
 	if (svs.clients)
 	{
+		for (i = 0; i < maxclients->value; i++)
+		{
+			SV_CloseDownload(&svs.clients[i]);
+			free(svs.clients[i].gamestate);
+			free(svs.clients[i].entity_deferred);
+		}
+
 		Z_Free(svs.clients);
 	}
 
+	SV_FlushDownloads();
+
 	if (svs.client_entities)
 	{
 		Z_Free(svs.client_entities);
 	}
 
-	if (svs.demofile)
-	{
-		fclose(svs.demofile);
-	}
+	SV_DemoClose();
 
 	memset(&svs, 0, sizeof(svs));
 
@@ -24,8 +24,317 @@
  * =======================================================================
  */
 
+#include <stdatomic.h>
+
 #include "header/server.h"
 
+/*
+ * The files written by the server itself and those the game
+ * hands over with gi.WriteSaveFile() are snapshotted into memory
+ * and written to disk by a background thread, together with
+ * copying the savegame to its slot. The operations are queued in
+ * order and started as one batch with the next server frame. Only
+ * one batch runs at a time. Everything that reads save files or
+ * deletes them calls SV_WaitForSaves() first.
+ */
+typedef struct saveop_s
+{
+	char name[MAX_OSPATH];  /* file to write, copy to or remove */
+	char src[MAX_OSPATH];   /* file to copy from */
+	byte *data;             /* contents to write, NULL when copying or removing */
+	size_t len;
+	qboolean remove;
+	struct saveop_s *next;
+} saveop_t;
+
+static saveop_t *save_pending;
+static saveop_t **save_pending_tail = &save_pending;
+static saveop_t *save_running;      /* owned by the writer thread */
+static void *save_thread;
+static const char *save_gamedir;    /* where ge->Write*() are called in */
+static atomic_int save_done;
+static long long save_usec;
+static int save_failed;
+
+static saveop_t *
+SV_QueueSaveOp(const char *name)
+{
+	saveop_t *op;
+
+	op = calloc(1, sizeof(*op));
+	YQ2_COM_CHECK_OOM(op, "calloc()", sizeof(*op))
+
+	Q_strlcpy(op->name, name, sizeof(op->name));
+
+	*save_pending_tail = op;
+	save_pending_tail = &op->next;
+
+	return op;
+}
+
+static void
+SV_QueueSaveWrite(const char *name, const void *data, size_t len)
+{
+	saveop_t *op;
+
+	op = SV_QueueSaveOp(name);
+	op->data = malloc(len);
+	YQ2_COM_CHECK_OOM(op->data, "malloc()", len)
+
+	memcpy(op->data, data, len);
+	op->len = len;
+}
+
+/*
+ * The game hands its part of the savegame over here
+ * instead of writing it. The name is relative to the
+ * working directory it was called in, save/current/.
+ * That's spelled like FS_Gamedir() does, so that
+ * SV_CopySaveGame() finds the file in the queue.
+ */
+void
+SV_GameWriteSaveFile(const char *filename, const void *data, size_t len)
+{
+	char name[MAX_OSPATH];
+	char workdir[MAX_OSPATH];
+
+	if ((filename[0] == '/') || (filename[0] == '\\') ||
+		(filename[0] && (filename[1] == ':')))
+	{
+		Q_strlcpy(name, filename, sizeof(name));
+	}
+	else if (save_gamedir)
+	{
+		Com_sprintf(name, sizeof(name), "%s/%s", save_gamedir, filename);
+	}
+	else
+	{
+		Sys_GetWorkDir(workdir, sizeof(workdir));
+		Com_sprintf(name, sizeof(name), "%s/%s", workdir, filename);
+	}
+
+	SV_QueueSaveWrite(name, data, len);
+}
+
+/*
+ * Returns true if a write to name is queued.
+ */
+static qboolean
+SV_SaveWritePending(const char *name)
+{
+	const saveop_t *op;
+
+	for (op = save_pending; op; op = op->next)
+	{
+		if (op->data && !strcmp(op->name, name))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static qboolean
+CopyFile(const char *src, const char *dst);
+
+/*
+ * Writes to a temporary file first and renames it
+ * afterwards, so the old file stays intact until
+ * the new one is complete.
+ */
+static qboolean
+SV_WriteSaveFile(const char *name, const byte *data, size_t len)
+{
+	char tmp[MAX_OSPATH + 4];
+	qboolean ok;
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+	f = Q_fopen(tmp, "wb");
+
+	if (!f)
+	{
+		return false;
+	}
+
+	ok = (fwrite(data, len, 1, f) == 1);
+
+	if (fclose(f))
+	{
+		ok = false;
+	}
+
+	if (!ok)
+	{
+		Sys_Remove(tmp);
+		return false;
+	}
+
+	if (Sys_Rename(tmp, name))
+	{
+		/* Windows doesn't replace existing files */
+		Sys_Remove(name);
+
+		if (Sys_Rename(tmp, name))
+		{
+			Sys_Remove(tmp);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Runs a batch of queued operations. Must not call
+ * anything that isn't thread safe, like Com_Printf().
+ */
+static void
+SV_SaveThread(void *arg)
+{
+	saveop_t *op;
+	long long start;
+
+	start = Sys_Microseconds();
+
+	for (op = save_running; op; op = op->next)
+	{
+		if (op->remove)
+		{
+			Sys_Remove(op->name);
+		}
+		else if (op->src[0])
+		{
+			if (!CopyFile(op->src, op->name))
+			{
+				save_failed++;
+			}
+		}
+		else if (!SV_WriteSaveFile(op->name, op->data, op->len))
+		{
+			save_failed++;
+		}
+	}
+
+	save_usec = Sys_Microseconds() - start;
+	atomic_store_explicit(&save_done, 1, memory_order_release);
+}
+
+/*
+ * Collects a finished batch, or waits for it.
+ */
+static void
+SV_ReapSaves(qboolean wait)
+{
+	saveop_t *op, *next;
+
+	if (!save_running)
+	{
+		return;
+	}
+
+	if (save_thread)
+	{
+		if (!wait && !atomic_load_explicit(&save_done, memory_order_acquire))
+		{
+			return;
+		}
+
+		Sys_JoinThread(save_thread);
+		save_thread = NULL;
+	}
+
+	SV_ProfileAdd(&sv_profile.save_write, save_usec);
+	Com_DPrintf("savegame written in %lld usec\n", save_usec);
+
+	if (save_failed)
+	{
+		Com_Printf("WARNING: %i savegame files couldn't be written\n",
+				save_failed);
+	}
+
+	for (op = save_running; op; op = next)
+	{
+		next = op->next;
+		free(op->data);
+		free(op);
+	}
+
+	save_running = NULL;
+}
+
+static void
+SV_StartSaves(void)
+{
+	save_running = save_pending;
+	save_pending = NULL;
+	save_pending_tail = &save_pending;
+
+	save_failed = 0;
+	atomic_store_explicit(&save_done, 0, memory_order_relaxed);
+
+	save_thread = Sys_CreateThread(SV_SaveThread, NULL);
+
+	if (!save_thread)
+	{
+		SV_SaveThread(NULL);
+	}
+}
+
+/*
+ * Called every server frame, collects the last
+ * batch and starts the next one.
+ */
+void
+SV_CheckSaves(void)
+{
+	SV_ReapSaves(false);
+
+	if (save_pending && !save_running)
+	{
+		SV_StartSaves();
+	}
+}
+
+/*
+ * Returns when everything queued is on disk.
+ */
+void
+SV_WaitForSaves(void)
+{
+	SV_ReapSaves(true);
+
+	if (save_pending)
+	{
+		SV_StartSaves();
+		SV_ReapSaves(true);
+	}
+}
+
+/*
+ * Called before the game writes to save/current/. Games
+ * which don't use gi.WriteSaveFile() write their files
+ * directly, copies of those must be done before they
+ * change. Queued writes can stay queued.
+ */
+static void
+SV_WaitForCopies(void)
+{
+	const saveop_t *op;
+
+	SV_ReapSaves(true);
+
+	for (op = save_pending; op; op = op->next)
+	{
+		if (op->src[0])
+		{
+			SV_WaitForSaves();
+			break;
+		}
+	}
+}
+
 /*
  * Delete save/<XXX>/
  */
@@ -37,6 +346,8 @@ SV_WipeSavegame(char *savename)
 
 	Com_DPrintf("SV_WipeSaveGame(%s)\n", savename);
 
+	SV_WaitForSaves();
+
 	Com_sprintf(name, sizeof(name), "%s/save/%s/server.ssv",
 				FS_Gamedir(), savename);
 
@@ -69,19 +380,22 @@ SV_WipeSavegame(char *savename)
 	Sys_FindClose();
 }
 
-static void
-CopyFile(char *src, char *dst)
+/*
+ * Runs on the writer thread. A missing source
+ * isn't an error, not every level has a .sv2.
+ */
+static qboolean
+CopyFile(const char *src, const char *dst)
 {
 	FILE *f1, *f2;
 	byte buffer[65536];
-
-	Com_DPrintf("CopyFile (%s, %s)\n", src, dst);
+	qboolean ok;
 
 	f1 = Q_fopen(src, "rb");
 
 	if (!f1)
 	{
-		return;
+		return true;
 	}
 
 	f2 = Q_fopen(dst, "wb");
@@ -89,9 +403,11 @@ CopyFile(char *src, char *dst)
 	if (!f2)
 	{
 		fclose(f1);
-		return;
+		return false;
 	}
 
+	ok = true;
+
 	while (1)
 	{
 		size_t l;
@@ -103,33 +419,110 @@ CopyFile(char *src, char *dst)
 			break;
 		}
 
-		fwrite(buffer, 1, l, f2);
+		if (fwrite(buffer, 1, l, f2) != l)
+		{
+			ok = false;
+			break;
+		}
 	}
 
 	fclose(f1);
-	fclose(f2);
+
+	if (fclose(f2))
+	{
+		ok = false;
+	}
+
+	return ok;
+}
+
+static void
+SV_QueueSaveCopy(const char *src, const char *dst)
+{
+	saveop_t *op;
+
+	Com_DPrintf("CopyFile (%s, %s)\n", src, dst);
+
+	op = SV_QueueSaveOp(dst);
+	Q_strlcpy(op->src, src, sizeof(op->src));
+}
+
+/*
+ * Queues the copy of a level, name is the .sav
+ * file and file its name in save/<dst>/.
+ */
+static void
+SV_QueueLevelCopy(const char *name, const char *dst, const char *file)
+{
+	char src[MAX_OSPATH], name2[MAX_OSPATH];
+	size_t l;
+
+	Q_strlcpy(src, name, sizeof(src));
+	Com_sprintf(name2, sizeof(name2), "%s/save/%s/%s",
+				FS_Gamedir(), dst, file);
+	SV_QueueSaveCopy(src, name2);
+
+	/* change sav to sv2 */
+	l = strlen(src);
+	strcpy(src + l - 3, "sv2");
+	l = strlen(name2);
+	strcpy(name2 + l - 3, "sv2");
+	SV_QueueSaveCopy(src, name2);
+}
+
+/*
+ * Queues removing the files in save/<XXX>/. Unlike
+ * SV_WipeSavegame() this doesn't wait for the queue.
+ */
+static void
+SV_QueueWipeSavegame(const char *savename)
+{
+	char name[MAX_OSPATH];
+	const char *pattern[] = {"server.ssv", "game.ssv", "*.sav", "*.sv2"};
+	const char *s;
+	int i;
+
+	/* the files matched here can't be touched
+	   by the running batch, only by queued ones */
+	SV_ReapSaves(true);
+
+	for (i = 0; i < sizeof(pattern) / sizeof(pattern[0]); i++)
+	{
+		Com_sprintf(name, sizeof(name), "%s/save/%s/%s", FS_Gamedir(),
+				savename, pattern[i]);
+		s = Sys_FindFirst(name, 0, 0);
+
+		while (s)
+		{
+			SV_QueueSaveOp(s)->remove = true;
+			s = Sys_FindNext(0, 0);
+		}
+
+		Sys_FindClose();
+	}
 }
 
 void
 SV_CopySaveGame(char *src, char *dst)
 {
 	char name[MAX_OSPATH], name2[MAX_OSPATH];
+	const saveop_t *op;
 	size_t len;
 	char *found;
 
 	Com_DPrintf("SV_CopySaveGame(%s, %s)\n", src, dst);
 
-	SV_WipeSavegame(dst);
+	SV_QueueWipeSavegame(dst);
 
-	/* copy the savegame over */
+	/* copy the savegame over, the files may still be queued */
 	Com_sprintf(name, sizeof(name), "%s/save/%s/server.ssv", FS_Gamedir(), src);
 	Com_sprintf(name2, sizeof(name2), "%s/save/%s/server.ssv", FS_Gamedir(), dst);
 	FS_CreatePath(name2);
-	CopyFile(name, name2);
+	SV_QueueSaveCopy(name, name2);
 
 	Com_sprintf(name, sizeof(name), "%s/save/%s/game.ssv", FS_Gamedir(), src);
 	Com_sprintf(name2, sizeof(name2), "%s/save/%s/game.ssv", FS_Gamedir(), dst);
-	CopyFile(name, name2);
+	SV_QueueSaveCopy(name, name2);
 
 	Com_sprintf(name, sizeof(name), "%s/save/%s/", FS_Gamedir(), src);
 	len = strlen(name);
@@ -138,25 +531,35 @@ SV_CopySaveGame(char *src, char *dst)
 
 	while (found)
 	{
-		size_t l;
-
 		Q_strlcpy(name + len, found + len, Q_max(sizeof(name) - len, 0));
 
-		Com_sprintf(name2, sizeof(name2), "%s/save/%s/%s",
-					FS_Gamedir(), dst, found + len);
-		CopyFile(name, name2);
-
-		/* change sav to sv2 */
-		l = strlen(name);
-		strcpy(name + l - 3, "sv2");
-		l = strlen(name2);
-		strcpy(name2 + l - 3, "sv2");
-		CopyFile(name, name2);
+		/* picked up from the queue below */
+		if (!SV_SaveWritePending(name))
+		{
+			SV_QueueLevelCopy(name, dst, found + len);
+		}
 
 		found = Sys_FindNext(0, 0);
 	}
 
 	Sys_FindClose();
+
+	/* .sav files handed over by the game aren't on disk yet */
+	name[len] = '\0';
+
+	for (op = save_pending; op; op = op->next)
+	{
+		size_t l;
+
+		l = strlen(op->name);
+
+		if (op->data && !strncmp(op->name, name, len) &&
+			!strchr(op->name + len, '/') &&
+			(l > len + 4) && !strcmp(op->name + l - 4, ".sav"))
+		{
+			SV_QueueLevelCopy(op->name, dst, op->name + len);
+		}
+	}
 }
 
 void
@@ -180,27 +583,36 @@ SV_WriteLevelFile(void)
 {
 	char name[MAX_OSPATH];
 	char savename[MAX_OSPATH];
+	char levelname[MAX_OSPATH];
 	char workdir[MAX_OSPATH];
-	FILE *f;
+	sizebuf_t buf;
+	byte *data;
+	long long start;
+	int size;
 
 	Com_DPrintf("%s()\n", __func__);
 
+	start = Sys_Microseconds();
+
+	/* the game is about to overwrite save/current/ */
+	SV_WaitForCopies();
+
 	Q_strlcpy(savename, sv.name, sizeof(savename));
 	SV_CleanLevelFileName(savename);
 
-	Com_sprintf(name, sizeof(name), "%s/save/current/%s.sv2",
-				FS_Gamedir(), savename);
-	f = Q_fopen(name, "wb");
+	size = sizeof(sv.configstrings) + sizeof(qboolean) * MAX_MAP_AREAPORTALS;
+	data = malloc(size);
+	YQ2_COM_CHECK_OOM(data, "malloc()", size)
 
-	if (!f)
-	{
-		Com_Printf("Failed to open %s\n", name);
-		return;
-	}
+	SZ_Init(&buf, data, size);
+	SZ_Write(&buf, sv.configstrings, sizeof(sv.configstrings));
+	CM_WritePortalState(&buf);
 
-	fwrite(sv.configstrings, sizeof(sv.configstrings), 1, f);
-	CM_WritePortalState(f);
-	fclose(f);
+	Com_sprintf(name, sizeof(name), "%s/save/current/%s.sv2",
+				FS_Gamedir(), savename);
+	FS_CreatePath(name);
+	SV_QueueSaveWrite(name, buf.data, buf.cursize);
+	free(data);
 
 	Com_sprintf(name, sizeof(name), "%s/save/current", FS_Gamedir());
 	Sys_GetWorkDir(workdir, sizeof(workdir));
@@ -213,10 +625,14 @@ SV_WriteLevelFile(void)
 		return;
 	}
 
-	Com_sprintf(name, sizeof(name), "%s.sav", savename);
-	ge->WriteLevel(name);
+	save_gamedir = name;
+	Com_sprintf(levelname, sizeof(levelname), "%s.sav", savename);
+	ge->WriteLevel(levelname);
+	save_gamedir = NULL;
 
 	Sys_SetWorkDir(workdir);
+
+	SV_ProfileAdd(&sv_profile.save_snapshot, Sys_Microseconds() - start);
 }
 
 static void
@@ -235,6 +651,8 @@ SV_ReadConfigStrings(fileHandle_t f)
 			sv.configstrings[i][sizeof(sv.configstrings[i]) - 1] = '\0';
 		}
 	}
+
+	SV_InvalidateConfigstringIndex(-1);
 }
 
 void
@@ -247,6 +665,8 @@ SV_ReadLevelFile(void)
 
 	Com_DPrintf("%s()\n", __func__);
 
+	SV_WaitForSaves();
+
 	Q_strlcpy(savename, sv.name, sizeof(savename));
 	SV_CleanLevelFileName(savename);
 
@@ -282,24 +702,38 @@ SV_ReadLevelFile(void)
 void
 SV_WriteServerFile(qboolean autosave)
 {
-	FILE *f;
+	sizebuf_t buf;
+	byte *data;
 	cvar_t *var;
 	char name[MAX_OSPATH], string[128];
 	char workdir[MAX_OSPATH];
 	char comment[32];
 	time_t aclock;
+	long long start;
+	int size;
 
 	Com_DPrintf("SV_WriteServerFile(%s)\n", autosave ? "true" : "false");
 
-	Com_sprintf(name, sizeof(name), "%s/save/current/server.ssv", FS_Gamedir());
-	f = Q_fopen(name, "wb");
+	start = Sys_Microseconds();
 
-	if (!f)
+	/* the game is about to overwrite save/current/ */
+	SV_WaitForCopies();
+
+	size = sizeof(comment) + sizeof(svs.mapcmd);
+
+	for (var = cvar_vars; var; var = var->next)
 	{
-		Com_Printf("Couldn't write %s\n", name);
-		return;
+		if (var->flags & CVAR_LATCH)
+		{
+			size += LATCH_CVAR_SAVELENGTH + sizeof(string);
+		}
 	}
 
+	data = malloc(size);
+	YQ2_COM_CHECK_OOM(data, "malloc()", size)
+
+	SZ_Init(&buf, data, size);
+
 	/* write the comment field */
 	memset(comment, 0, sizeof(comment));
 
@@ -322,10 +756,10 @@ SV_WriteServerFile(qboolean autosave)
 				sv.configstrings[CS_NAME]);
 	}
 
-	fwrite(comment, 1, sizeof(comment), f);
+	SZ_Write(&buf, comment, sizeof(comment));
 
 	/* write the mapcmd */
-	fwrite(svs.mapcmd, 1, sizeof(svs.mapcmd), f);
+	SZ_Write(&buf, svs.mapcmd, sizeof(svs.mapcmd));
 
 	/* write all CVAR_LATCH cvars
 	   these will be things like coop,
@@ -348,11 +782,14 @@ SV_WriteServerFile(qboolean autosave)
 		memset(string, 0, sizeof(string));
 		strcpy(cvarname, var->name);
 		strcpy(string, var->string);
-		fwrite(cvarname, 1, sizeof(cvarname), f);
-		fwrite(string, 1, sizeof(string), f);
+		SZ_Write(&buf, cvarname, sizeof(cvarname));
+		SZ_Write(&buf, string, sizeof(string));
 	}
 
-	fclose(f);
+	Com_sprintf(name, sizeof(name), "%s/save/current/server.ssv", FS_Gamedir());
+	FS_CreatePath(name);
+	SV_QueueSaveWrite(name, buf.data, buf.cursize);
+	free(data);
 
 	/* write game state */
 	Com_sprintf(name, sizeof(name), "%s/save/current", FS_Gamedir());
@@ -366,9 +803,13 @@ SV_WriteServerFile(qboolean autosave)
 		return;
 	}
 
+	save_gamedir = name;
 	ge->WriteGame("game.ssv", autosave);
+	save_gamedir = NULL;
 
 	Sys_SetWorkDir(workdir);
+
+	SV_ProfileAdd(&sv_profile.save_snapshot, Sys_Microseconds() - start);
 }
 
 static void
@@ -382,6 +823,8 @@ SV_ReadServerFile(void)
 
 	Com_DPrintf("SV_ReadServerFile()\n");
 
+	SV_WaitForSaves();
+
 	Com_sprintf(name, sizeof(name), "save/current/server.ssv");
 	FS_FOpenFile(name, &f, true);
 
@@ -460,6 +903,8 @@ SV_Loadgame_f(void)
 		Com_Printf("Bad savedir.\n");
 	}
 
+	SV_WaitForSaves();
+
 	/* make sure the server.ssv file exists */
 	Com_sprintf(name, sizeof(name), "%s/save/%s/server.ssv",
 				FS_Gamedir(), Cmd_Argv(1));
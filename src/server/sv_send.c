@@ -184,6 +184,194 @@ SV_GetClientLeafCache(client_t *client, int *area, int *cluster)
 	*cluster = client->cached_cluster;
 }
 
+/*
+ * Clients are kept in buckets by the cluster of their origin,
+ * so SV_Multicast only has to visit the clients in clusters set
+ * in the PVS/PHS row. The buckets are rebuilt once per frame,
+ * clients linked in between are moved to their new bucket
+ * before the next multicast.
+ */
+static int *cluster_clients;            /* first client slot + 1 per cluster, the
+										   last one is for clients outside the map */
+static byte *cluster_occupied;          /* bit per cluster with clients in it */
+static int cluster_clients_size;
+static int bucket_numclusters;
+static int bucket_framenum = -1;
+static int bucket_spawncount;
+static int bucket_next[MAX_CLIENTS];    /* next client slot + 1 in the same bucket */
+static int bucket_cluster[MAX_CLIENTS]; /* bucket of the client, -1 if none */
+static int bucket_moved[MAX_CLIENTS];
+static qboolean bucket_is_moved[MAX_CLIENTS];
+static int num_bucket_moved;
+
+static void
+SV_BucketUnlink(int slot)
+{
+	int *link;
+	int bucket;
+
+	bucket = bucket_cluster[slot];
+
+	if (bucket < 0)
+	{
+		return;
+	}
+
+	for (link = &cluster_clients[bucket]; *link; link = &bucket_next[*link - 1])
+	{
+		if (*link == slot + 1)
+		{
+			*link = bucket_next[slot];
+			break;
+		}
+	}
+
+	if (!cluster_clients[bucket] && (bucket < bucket_numclusters))
+	{
+		cluster_occupied[bucket >> 3] &= ~(1 << (bucket & 7));
+	}
+
+	bucket_cluster[slot] = -1;
+	bucket_next[slot] = 0;
+}
+
+static void
+SV_BucketLink(int slot)
+{
+	client_t *client;
+	int area, cluster;
+
+	client = &svs.clients[slot];
+
+	if ((client->state == cs_free) || (client->state == cs_zombie))
+	{
+		return;
+	}
+
+	SV_GetClientLeafCache(client, &area, &cluster);
+
+	if ((cluster < 0) || (cluster >= bucket_numclusters))
+	{
+		cluster = bucket_numclusters;
+	}
+	else
+	{
+		cluster_occupied[cluster >> 3] |= 1 << (cluster & 7);
+	}
+
+	bucket_cluster[slot] = cluster;
+	bucket_next[slot] = cluster_clients[cluster];
+	cluster_clients[cluster] = slot + 1;
+}
+
+static void
+SV_UpdateClientBuckets(void)
+{
+	int i;
+
+	if ((bucket_framenum != sv.framenum) ||
+		(bucket_spawncount != svs.spawncount) ||
+		(bucket_numclusters != CM_NumClusters()))
+	{
+		int size;
+
+		bucket_numclusters = CM_NumClusters();
+		size = bucket_numclusters + 1;
+
+		if (size > cluster_clients_size)
+		{
+			int *heads;
+			byte *occupied;
+
+			heads = realloc(cluster_clients, size * sizeof(*heads));
+			YQ2_COM_CHECK_OOM(heads, "realloc()", size * sizeof(*heads))
+			if (!heads)
+			{
+				/* unaware about YQ2_ATTR_NORETURN_FUNCPTR? */
+				return;
+			}
+
+			cluster_clients = heads;
+
+			occupied = realloc(cluster_occupied, (size + 7) >> 3);
+			YQ2_COM_CHECK_OOM(occupied, "realloc()", (size + 7) >> 3)
+			if (!occupied)
+			{
+				/* unaware about YQ2_ATTR_NORETURN_FUNCPTR? */
+				return;
+			}
+
+			cluster_occupied = occupied;
+			cluster_clients_size = size;
+		}
+
+		memset(cluster_clients, 0, size * sizeof(*cluster_clients));
+		memset(cluster_occupied, 0, (size + 7) >> 3);
+
+		for (i = 0; i < maxclients->value; i++)
+		{
+			bucket_cluster[i] = -1;
+			bucket_next[i] = 0;
+			bucket_is_moved[i] = false;
+			SV_BucketLink(i);
+		}
+
+		num_bucket_moved = 0;
+		bucket_framenum = sv.framenum;
+		bucket_spawncount = svs.spawncount;
+
+		return;
+	}
+
+	for (i = 0; i < num_bucket_moved; i++)
+	{
+		int slot = bucket_moved[i];
+
+		bucket_is_moved[slot] = false;
+		SV_BucketUnlink(slot);
+		SV_BucketLink(slot);
+	}
+
+	num_bucket_moved = 0;
+}
+
+/*
+ * Called when a client was linked or (re)connected,
+ * its bucket is updated before the next multicast.
+ */
+void
+SV_ClientMoved(const client_t *client)
+{
+	int slot;
+
+	slot = client - svs.clients;
+
+	if ((slot < 0) || (slot >= MAX_CLIENTS) || bucket_is_moved[slot])
+	{
+		return;
+	}
+
+	bucket_is_moved[slot] = true;
+	bucket_moved[num_bucket_moved++] = slot;
+}
+
+static void
+SV_MulticastToClient(client_t *client, qboolean reliable)
+{
+	if ((client->state == cs_free) || (client->state == cs_zombie))
+	{
+		return;
+	}
+
+	if ((client->state != cs_spawned) && !reliable)
+	{
+		return;
+	}
+
+	SZ_Write(reliable ? &client->netchan.message : &client->datagram,
+			sv.multicast.data, sv.multicast.cursize);
+}
+
 void
 SV_Multicast(const vec3_t origin, multicast_t to)
 {
@@ -192,7 +380,9 @@ SV_Multicast(const vec3_t origin, multicast_t to)
 	client_t *client;
 	const byte *mask;
 	size_t mask_size = 0;
+	long long start;
 
+	start = Sys_Microseconds();
 	reliable = false;
 
 	if ((to != MULTICAST_ALL_R) && (to != MULTICAST_ALL))
@@ -248,35 +438,73 @@ SV_Multicast(const vec3_t origin, multicast_t to)
 		underwater = true;
 	}
 
-	/* send the data to all relevent clients */
-	for (j = 0, client = svs.clients; j < maxclients->value; j++, client++)
+	/* the secondary cluster of an underwater origin
+	   doesn't depend on the client, if it's in the
+	   mask everybody gets the message */
+	if (mask && underwater && (water_cluster >= 0) &&
+		((water_cluster >> 3) < mask_size) &&
+		(mask[water_cluster >> 3] & (1 << (water_cluster & 7))) &&
+		CM_AreasConnected(area1, water_area))
 	{
-		if ((client->state == cs_free) || (client->state == cs_zombie))
-		{
-			continue;
-		}
+		mask = NULL;
+	}
 
-		if ((client->state != cs_spawned) && !reliable)
+	if (!mask)
+	{
+		/* send the data to all relevent clients */
+		for (j = 0, client = svs.clients; j < maxclients->value; j++, client++)
 		{
-			continue;
+			SV_MulticastToClient(client, reliable);
 		}
+	}
+	else
+	{
+		size_t i, numbytes;
+
+		SV_UpdateClientBuckets();
 
-		if (mask)
+		/* only walk the clusters set in the mask row */
+		numbytes = Q_min(mask_size, (size_t)((bucket_numclusters + 7) >> 3));
+
+		for (i = 0; i < numbytes; i++)
 		{
-			int area2, cluster2;
-			SV_GetClientLeafCache(client, &area2, &cluster2);
+			int bits, b;
+
+			bits = mask[i] & cluster_occupied[i];
 
-			if (!SV_WereConnected(cluster2, area2, mask, area1, mask_size, underwater, water_cluster, water_area))
+			for (b = 0; bits; b++, bits >>= 1)
 			{
-				continue;
+				int slot;
+
+				if (!(bits & 1))
+				{
+					continue;
+				}
+
+				for (slot = cluster_clients[(i << 3) + b]; slot; slot = bucket_next[slot - 1])
+				{
+					int area2, cluster2;
+
+					client = &svs.clients[slot - 1];
+
+					/* clients moved without a link are checked again */
+					SV_GetClientLeafCache(client, &area2, &cluster2);
+
+					if (!SV_WereConnected(cluster2, area2, mask, area1, mask_size,
+							false, -1, 0))
+					{
+						continue;
+					}
+
+					SV_MulticastToClient(client, reliable);
+				}
 			}
 		}
-
-		SZ_Write(reliable ? &client->netchan.message : &client->datagram,
-				sv.multicast.data, sv.multicast.cursize);
 	}
 
 	SZ_Clear(&sv.multicast);
+
+	SV_ProfileAdd(&sv_profile.multicast, Sys_Microseconds() - start);
 }
 
 /*
@@ -495,6 +723,45 @@ SV_SendFreeBuffers(void)
 		msgbuff_cache = NULL;
 	}
 	msgbuff_size = 0;
+
+	free(cluster_clients);
+	cluster_clients = NULL;
+	free(cluster_occupied);
+	cluster_occupied = NULL;
+	cluster_clients_size = 0;
+	bucket_framenum = -1;
+}
+
+/*
+ * Returns how many bytes the client's datagram may use this
+ * frame without going over its rate, or -1 if it's unlimited.
+ */
+static int
+SV_RateBudget(const client_t *c)
+{
+	int total;
+	int i;
+
+	if (!sv_entity_budget->value ||
+		(c->netchan.remote_address.type == NA_LOOPBACK))
+	{
+		return -1;
+	}
+
+	/* the slot of this frame is about to be overwritten */
+	total = 0;
+
+	for (i = 0; i < RATE_MESSAGES; i++)
+	{
+		if (i != sv.framenum % RATE_MESSAGES)
+		{
+			total += c->message_size[i];
+		}
+	}
+
+	/* never spend more than two frames worth at once,
+	   otherwise a burst starves the following frames */
+	return Q_min(c->rate - total, 2 * c->rate / RATE_MESSAGES);
 }
 
 static qboolean
@@ -514,7 +781,7 @@ SV_SendClientDatagram(client_t *client)
 
 	/* send over all the relevant entity_state_t
 	   and the player_state_t */
-	SV_WriteFrameToClient(client, &msg);
+	SV_WriteFrameToClient(client, &msg, SV_RateBudget(client));
 
 	/* copy the accumulated multicast datagram
 	   for this client out to the message
@@ -547,6 +814,65 @@ SV_SendClientDatagram(client_t *client)
 	return true;
 }
 
+/*
+ * Streams the chunks of a windowed download. Everything in
+ * the window that wasn't acknowledged and wasn't sent within
+ * two round trips goes out, each chunk in a packet of its
+ * own, until this frame's share of sv_download_rate is used.
+ */
+void
+SV_SendDownloadChunks(client_t *cl)
+{
+	byte buf[DOWNLOAD_CHUNK + 16];
+	sizebuf_t msg;
+	int budget, timeout, chunk, offset, len, i;
+	int *sent;
+
+	if (!cl->dlwindowed || !cl->download)
+	{
+		return;
+	}
+
+	budget = (int)sv_download_rate->value / 10;
+	timeout = Q_max(cl->dlrtt * 2, 50);
+
+	for (i = 0; (i < DOWNLOAD_WINDOW) && (budget > 0); i++)
+	{
+		chunk = cl->dlchunkbase + i;
+
+		if (chunk >= cl->dlnumchunks)
+		{
+			break;
+		}
+
+		if (cl->dlacked & (1u << i))
+		{
+			continue;
+		}
+
+		sent = &cl->dlsent[chunk % DOWNLOAD_WINDOW];
+
+		if (*sent && (svs.realtime - *sent < timeout))
+		{
+			continue;
+		}
+
+		offset = cl->dlstart + chunk * DOWNLOAD_CHUNK;
+		len = Q_min(DOWNLOAD_CHUNK, cl->downloadsize - offset);
+
+		SZ_Init(&msg, buf, sizeof(buf));
+		MSG_WriteByte(&msg, svc_downloadchunk);
+		MSG_WriteLong(&msg, offset);
+		MSG_WriteShort(&msg, len);
+		SZ_Write(&msg, cl->download + offset, len);
+
+		Netchan_Transmit(&cl->netchan, msg.cursize, msg.data);
+
+		*sent = Q_max(svs.realtime, 1);
+		budget -= msg.cursize;
+	}
+}
+
 static void
 SV_DemoCompleted(void)
 {
@@ -685,6 +1011,9 @@ SV_SendClientMessages(void)
 			continue;
 		}
 
+		/* windowed downloads have their own budget */
+		SV_SendDownloadChunks(c);
+
 		if ((sv.state == ss_cinematic) ||
 			(sv.state == ss_demo) ||
 			(sv.state == ss_pic))
@@ -20,11 +20,15 @@
  *
  * =======================================================================
  *
- * Localization logic.
+ * Localization logic. The localization files are parsed once into a
+ * blob holding a hash table and a string pool, which is cached on disk
+ * and reused as long as the checksum of the source files matches.
  *
  * =======================================================================
  */
 
+#include <ctype.h>
+
 #include "header/server.h"
 
 typedef struct
@@ -34,29 +38,69 @@ typedef struct
 	char *sound;
 } localmessages_t;
 
+#define LOCALIZATION_IDENT (('C' << 24) + ('L' << 16) + ('Q' << 8) + 'Y')
+#define LOCALIZATION_VERSION 1
+
+typedef struct
+{
+	int ident;
+	int version;
+	unsigned checksum;              /* of the source files */
+	int numentries;
+	int tablesize;                  /* power of two */
+	int poolsize;
+} localizationheader_t;
+
+typedef struct
+{
+	unsigned hash;
+	int key;                        /* pool offsets, key is -1 for empty slots */
+	int value;
+	int sound;                      /* -1 if there is none */
+} localizationentry_t;
+
+/* only used while parsing */
 static localmessages_t *localmessages = NULL;
 static int nlocalmessages = 0;
 
-static int
-LocalizationSort(const void *p1, const void *p2)
+/* header, table and pool in one allocation */
+static byte *localization = NULL;
+static const localizationheader_t *loc_header;
+static const localizationentry_t *loc_table;
+static const char *loc_pool;
+
+static unsigned
+LocalizationHash(const char *key)
 {
-	const localmessages_t *msg1, *msg2;
+	unsigned hash;
+
+	hash = 2166136261u;
+
+	while (*key)
+	{
+		hash = (hash ^ (byte)tolower((byte)*key++)) * 16777619u;
+	}
 
-	msg1 = (localmessages_t*)p1;
-	msg2 = (localmessages_t*)p2;
-	return Q_stricmp(msg1->key, msg2->key);
+	return hash;
 }
 
+/*
+ * Returns a zero terminated, writable copy
+ * of a file loaded by FS_LoadFile() and frees it.
+ */
 static char *
-LocalizationFileRead(const char *filename, int *len)
+LocalizationFileCopy(byte *raw, int len)
 {
-	byte *raw = NULL;
 	char *buf = NULL;
 
-	*len = FS_LoadFile(filename, (void **)&raw);
-	if (*len > 1)
+	if (!raw)
 	{
-		buf = malloc(*len + 1);
+		return NULL;
+	}
+
+	if (len > 1)
+	{
+		buf = malloc(len + 1);
 		if (!buf)
 		{
 			Com_Error(ERR_DROP, "%s: can't allocate space for file\n",
@@ -64,19 +108,52 @@ LocalizationFileRead(const char *filename, int *len)
 			return NULL;
 		}
 
-		memcpy(buf, raw, *len);
-		buf[*len] = 0;
-		FS_FreeFile(raw);
+		memcpy(buf, raw, len);
+		buf[len] = 0;
 	}
 
+	FS_FreeFile(raw);
+
 	return buf;
 }
 
+/*
+ * Only detects changes of the files, so it
+ * can be cheaper than Com_BlockChecksum().
+ */
+static unsigned
+LocalizationChecksum(const byte *data, int len)
+{
+	unsigned long long hash, w;
+	int i;
+
+	hash = 14695981039346656037ull ^ len;
+
+	if (!data || (len <= 1))
+	{
+		return 0;
+	}
+
+	for (i = 0; i + 8 <= len; i += 8)
+	{
+		memcpy(&w, data + i, sizeof(w));
+		hash = (hash ^ w) * 1099511628211ull;
+	}
+
+	for (; i < len; i++)
+	{
+		hash = (hash ^ data[i]) * 1099511628211ull;
+	}
+
+	return (unsigned)(hash ^ (hash >> 32));
+}
+
 void
 SV_LocalizationInit(void)
 {
 	localmessages = NULL;
 	nlocalmessages = 0;
+	localization = NULL;
 }
 
 /* Lookup table for Windows-1252 to Unicode code points (only special range 0x80–0x9F) */
@@ -170,34 +247,23 @@ LocalizationConvertWIN1252ToUTF8(char *in_buf)
 }
 
 
+/*
+ * Parses the files into localmessages.
+ * Consumes the buffers.
+ */
 static void
-SV_LocalizationReload(void)
+LocalizationParse(char *buf_local, int len_local, char *buf_level, int len_level,
+		char *buf_strings, int len_strings)
 {
-	char *buf_local = NULL, *buf_level = NULL, *buf_strings = NULL;
-	int len_local, len_level, len_strings, curr_pos;
-	char loc_name[MAX_QPATH];
-
-	if (localmessages)
-	{
-		return;
-	}
+	int curr_pos;
 
 	nlocalmessages = 0;
 
-	/* load the localization file */
-	snprintf(loc_name, sizeof(loc_name) - 1, "localization/loc_%s.txt", sv_language->string);
-	buf_local = LocalizationFileRead(loc_name, &len_local);
-
-	/* load the heretic 2 messages file */
-	buf_level = LocalizationFileRead("levelmsg.txt", &len_level);
 	if (buf_level)
 	{
 		buf_level = LocalizationConvertWIN1252ToUTF8(buf_level);
 	}
 
-	/* load the hexen 2 messages file */
-	buf_strings = LocalizationFileRead("Strings.txt", &len_strings);
-
 	/* localization lines count */
 	if (buf_local)
 	{
@@ -589,87 +655,375 @@ SV_LocalizationReload(void)
 	free(buf_strings);
 	free(buf_level);
 	free(buf_local);
+}
+
+static void
+LocalizationFreeMessages(void)
+{
+	int i;
 
-	if (!curr_pos && !localmessages)
+	if (!localmessages)
 	{
-		localmessages = calloc(1, sizeof(*localmessages));
-		if (!localmessages)
-		{
-			Com_Error(ERR_DROP, "%s: can't allocate messages\n",
-				__func__);
-			return;
-		}
 		return;
 	}
 
-	Com_Printf("Found %d translated lines\n", nlocalmessages);
+	for (i = 0; i < nlocalmessages; i++)
+	{
+		free(localmessages[i].key);
+		free(localmessages[i].value);
+		free(localmessages[i].sound);
+	}
 
-	/* sort messages */
-	qsort(localmessages, nlocalmessages, sizeof(localmessages_t), LocalizationSort);
+	free(localmessages);
+	localmessages = NULL;
+	nlocalmessages = 0;
 }
 
-void
-SV_LocalizationFree(void)
+static void
+LocalizationAttach(byte *blob)
 {
-	if (localmessages)
+	localization = blob;
+	loc_header = (const localizationheader_t *)blob;
+	loc_table = (const localizationentry_t *)(loc_header + 1);
+	loc_pool = (const char *)(loc_table + loc_header->tablesize);
+}
+
+static int
+LocalizationPoolAdd(char *pool, int *poolsize, const char *str)
+{
+	int ofs;
+
+	ofs = *poolsize;
+	strcpy(pool + ofs, str);
+	*poolsize += strlen(str) + 1;
+
+	return ofs;
+}
+
+/*
+ * Builds the blob from localmessages. The first
+ * of several messages with the same key wins.
+ */
+static void
+LocalizationBuild(unsigned checksum)
+{
+	localizationheader_t *header;
+	localizationentry_t *table, *e;
+	size_t size, poolsize;
+	unsigned hash;
+	char *pool;
+	byte *blob;
+	int i, j, tablesize;
+
+	tablesize = 16;
+
+	while (tablesize < nlocalmessages * 2)
 	{
-		int i;
+		tablesize <<= 1;
+	}
+
+	poolsize = 0;
 
-		for (i = 0; i < nlocalmessages; i++)
+	for (i = 0; i < nlocalmessages; i++)
+	{
+		if (localmessages[i].key && localmessages[i].value)
 		{
-			if (localmessages[i].key)
-			{
-				free(localmessages[i].key);
-			}
+			poolsize += strlen(localmessages[i].key) + 1;
+			poolsize += strlen(localmessages[i].value) + 1;
 
-			if (localmessages[i].value)
+			if (localmessages[i].sound)
 			{
-				free(localmessages[i].value);
+				poolsize += strlen(localmessages[i].sound) + 1;
 			}
+		}
+	}
 
-			if (localmessages[i].sound)
+	size = sizeof(*header) + tablesize * sizeof(*table) + poolsize;
+	blob = malloc(size);
+	YQ2_COM_CHECK_OOM(blob, "malloc()", size)
+
+	header = (localizationheader_t *)blob;
+	table = (localizationentry_t *)(header + 1);
+	pool = (char *)(table + tablesize);
+
+	header->ident = LOCALIZATION_IDENT;
+	header->version = LOCALIZATION_VERSION;
+	header->checksum = checksum;
+	header->numentries = 0;
+	header->tablesize = tablesize;
+	header->poolsize = 0;
+
+	for (j = 0; j < tablesize; j++)
+	{
+		table[j].key = -1;
+	}
+
+	for (i = 0; i < nlocalmessages; i++)
+	{
+		if (!localmessages[i].key || !localmessages[i].value)
+		{
+			continue;
+		}
+
+		hash = LocalizationHash(localmessages[i].key);
+
+		for (j = hash & (tablesize - 1); table[j].key >= 0;
+			j = (j + 1) & (tablesize - 1))
+		{
+			if ((table[j].hash == hash) &&
+				!Q_stricmp(pool + table[j].key, localmessages[i].key))
 			{
-				free(localmessages[i].sound);
+				break;
 			}
 		}
-		free(localmessages);
 
-		Com_Printf("Free %d translated lines\n", nlocalmessages);
+		if (table[j].key >= 0)
+		{
+			continue; /* duplicate */
+		}
+
+		e = &table[j];
+		e->hash = hash;
+		e->key = LocalizationPoolAdd(pool, &header->poolsize, localmessages[i].key);
+		e->value = LocalizationPoolAdd(pool, &header->poolsize, localmessages[i].value);
+		e->sound = localmessages[i].sound ?
+			LocalizationPoolAdd(pool, &header->poolsize, localmessages[i].sound) : -1;
+
+		header->numentries++;
 	}
-	localmessages = NULL;
-	nlocalmessages = 0;
+
+	LocalizationAttach(blob);
 }
 
-static int
-LocalizationSearch(const char *name)
+/*
+ * Loads the blob from the cache, if it
+ * was built from the same source files.
+ */
+static qboolean
+LocalizationCacheRead(const char *name, unsigned checksum)
 {
-	int start, end;
+	const localizationentry_t *e;
+	localizationheader_t header;
+	size_t size;
+	byte *blob;
+	FILE *f;
+	int i, used;
 
-	start = 0;
-	end = nlocalmessages - 1;
+	f = Q_fopen(name, "rb");
 
-	while (start <= end)
+	if (!f)
 	{
-		int i, res;
+		return false;
+	}
+
+	if ((fread(&header, sizeof(header), 1, f) != 1) ||
+		(header.ident != LOCALIZATION_IDENT) ||
+		(header.version != LOCALIZATION_VERSION) ||
+		(header.checksum != checksum) ||
+		(header.tablesize <= 0) || (header.tablesize > 0x1000000) ||
+		(header.tablesize & (header.tablesize - 1)) ||
+		(header.numentries >= header.tablesize) ||
+		(header.poolsize < 0))
+	{
+		fclose(f);
+		return false;
+	}
 
-		i = start + (end - start) / 2;
+	size = sizeof(header) + header.tablesize * sizeof(*e) + header.poolsize;
+	blob = malloc(size);
+	YQ2_COM_CHECK_OOM(blob, "malloc()", size)
 
-		res = Q_stricmp(localmessages[i].key, name);
-		if (res == 0)
+	memcpy(blob, &header, sizeof(header));
+
+	if (fread(blob + sizeof(header), size - sizeof(header), 1, f) != 1)
+	{
+		fclose(f);
+		free(blob);
+		return false;
+	}
+
+	fclose(f);
+
+	/* don't trust the offsets */
+	e = (const localizationentry_t *)(blob + sizeof(header));
+	used = 0;
+
+	for (i = 0; i < header.tablesize; i++, e++)
+	{
+		if ((e->key < -1) || (e->key >= header.poolsize) ||
+			(e->value >= header.poolsize) || (e->sound >= header.poolsize) ||
+			((e->key >= 0) && ((e->value < 0) || (e->sound < -1))))
 		{
-			return i;
+			free(blob);
+			return false;
 		}
-		else if (res < 0)
+
+		if (e->key >= 0)
 		{
-			start = i + 1;
+			used++;
 		}
-		else
+	}
+
+	/* lookups probe until they hit an empty slot */
+	if ((used >= header.tablesize) || (used != header.numentries))
+	{
+		free(blob);
+		return false;
+	}
+
+	if (header.poolsize && blob[size - 1])
+	{
+		free(blob);
+		return false;
+	}
+
+	LocalizationAttach(blob);
+
+	return true;
+}
+
+static void
+LocalizationCacheWrite(const char *name)
+{
+	char tmp[MAX_OSPATH + 4];
+	size_t size;
+	qboolean ok;
+	FILE *f;
+
+	size = sizeof(*loc_header) + loc_header->tablesize * sizeof(*loc_table) +
+		loc_header->poolsize;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+	FS_CreatePath(tmp);
+	f = Q_fopen(tmp, "wb");
+
+	if (!f)
+	{
+		return;
+	}
+
+	ok = (fwrite(localization, size, 1, f) == 1);
+
+	if (fclose(f) || !ok)
+	{
+		Sys_Remove(tmp);
+		return;
+	}
+
+	if (Sys_Rename(tmp, name))
+	{
+		/* Windows doesn't replace existing files */
+		Sys_Remove(name);
+
+		if (Sys_Rename(tmp, name))
+		{
+			Sys_Remove(tmp);
+		}
+	}
+}
+
+static void
+SV_LocalizationReload(void)
+{
+	byte *raw_local = NULL, *raw_level = NULL, *raw_strings = NULL;
+	int len_local, len_level, len_strings;
+	char loc_name[MAX_QPATH], cache_name[MAX_OSPATH];
+	unsigned checksums[3], checksum;
+
+	if (localization)
+	{
+		return;
+	}
+
+	/* load the localization file */
+	snprintf(loc_name, sizeof(loc_name) - 1, "localization/loc_%s.txt", sv_language->string);
+	len_local = FS_LoadFile(loc_name, (void **)&raw_local);
+
+	/* load the heretic 2 messages file */
+	len_level = FS_LoadFile("levelmsg.txt", (void **)&raw_level);
+
+	/* load the hexen 2 messages file */
+	len_strings = FS_LoadFile("Strings.txt", (void **)&raw_strings);
+
+	checksums[0] = LocalizationChecksum(raw_local, len_local);
+	checksums[1] = LocalizationChecksum(raw_level, len_level);
+	checksums[2] = LocalizationChecksum(raw_strings, len_strings);
+	checksum = LocalizationChecksum((byte *)checksums, sizeof(checksums));
+
+	Com_sprintf(cache_name, sizeof(cache_name), "%s/loc_%s.cache",
+		FS_Gamedir(), sv_language->string);
+
+	if ((checksums[0] || checksums[1] || checksums[2]) &&
+		LocalizationCacheRead(cache_name, checksum))
+	{
+		if (raw_local)
 		{
-			end = i - 1;
+			FS_FreeFile(raw_local);
+		}
+
+		if (raw_level)
+		{
+			FS_FreeFile(raw_level);
+		}
+
+		if (raw_strings)
+		{
+			FS_FreeFile(raw_strings);
 		}
 	}
+	else
+	{
+		LocalizationParse(LocalizationFileCopy(raw_local, len_local), len_local,
+			LocalizationFileCopy(raw_level, len_level), len_level,
+			LocalizationFileCopy(raw_strings, len_strings), len_strings);
+		LocalizationBuild(checksum);
+		LocalizationFreeMessages();
 
-	return -1;
+		if (loc_header->numentries)
+		{
+			LocalizationCacheWrite(cache_name);
+		}
+	}
+
+	if (loc_header->numentries)
+	{
+		Com_Printf("Found %d translated lines\n", loc_header->numentries);
+	}
+}
+
+void
+SV_LocalizationFree(void)
+{
+	if (localization)
+	{
+		Com_Printf("Free %d translated lines\n", loc_header->numentries);
+		free(localization);
+	}
+
+	localization = NULL;
+}
+
+static const localizationentry_t *
+LocalizationSearch(const char *name)
+{
+	const localizationentry_t *e;
+	unsigned hash;
+	int i;
+
+	hash = LocalizationHash(name);
+
+	for (i = hash & (loc_header->tablesize - 1); loc_table[i].key >= 0;
+		i = (i + 1) & (loc_header->tablesize - 1))
+	{
+		e = &loc_table[i];
+
+		if ((e->hash == hash) && !Q_stricmp(loc_pool + e->key, name))
+		{
+			return e;
+		}
+	}
+
+	return NULL;
 }
 
 const char *
@@ -677,7 +1031,7 @@ SV_LocalizationUIMessage(const char *message, const char *default_message)
 {
 	SV_LocalizationReload();
 
-	if (!message || !localmessages || !nlocalmessages)
+	if (!message || !localization || !loc_header->numentries)
 	{
 		return default_message;
 	}
@@ -685,12 +1039,12 @@ SV_LocalizationUIMessage(const char *message, const char *default_message)
 	if ((message[0] == '$') || /* ReRelease */
 		(strspn(message, "1234567890") == strlen(message))) /* Hexen 2 / Heretic 2 */
 	{
-		int i;
+		const localizationentry_t *e;
 
-		i = LocalizationSearch(message);
-		if (i >= 0)
+		e = LocalizationSearch(message);
+		if (e)
 		{
-			return localmessages[i].value;
+			return loc_pool + e->value;
 		}
 	}
 
@@ -702,7 +1056,7 @@ SV_LocalizationMessage(const char *message, const char **sound)
 {
 	SV_LocalizationReload();
 
-	if (!message || !localmessages || !nlocalmessages)
+	if (!message || !localization || !loc_header->numentries)
 	{
 		return message;
 	}
@@ -710,17 +1064,17 @@ SV_LocalizationMessage(const char *message, const char **sound)
 	if ((message[0] == '$') || /* ReRelease */
 		(strspn(message, "1234567890") == strlen(message))) /* Hexen 2 / Heretic 2 */
 	{
-		int i;
+		const localizationentry_t *e;
 
-		i = LocalizationSearch(message);
-		if (i >= 0)
+		e = LocalizationSearch(message);
+		if (e)
 		{
-			if (sound && localmessages[i].sound)
+			if (sound && (e->sound >= 0))
 			{
-				*sound = localmessages[i].sound;
+				*sound = loc_pool + e->sound;
 			}
 
-			return localmessages[i].value;
+			return loc_pool + e->value;
 		}
 	}
 
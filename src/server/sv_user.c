@@ -25,6 +25,7 @@
  */
 
 #include "header/server.h"
+#include "../common/unzip/miniz/miniz.h"
 
 #define MAX_STRINGCMDS 8
 
@@ -120,10 +121,20 @@ SV_New_f(void)
 		CLNUM_EDICT(playernum)->s.number = playernum + 1;
 		memset(&sv_client->lastcmd, 0, sizeof(sv_client->lastcmd));
 
-		/* begin fetching configstrings */
+		/* begin fetching configstrings, in one go if the client can */
 		MSG_WriteByte(&sv_client->netchan.message, svc_stufftext);
-		MSG_WriteString(&sv_client->netchan.message,
-				va("cmd configstrings %i 0\n", svs.spawncount));
+
+		if ((sv_client->extensions & PROTOCOL_EXT_GAMESTATE) &&
+			sv_gamestate_compression->value)
+		{
+			MSG_WriteString(&sv_client->netchan.message,
+					va("cmd gamestate %i 0\n", svs.spawncount));
+		}
+		else
+		{
+			MSG_WriteString(&sv_client->netchan.message,
+					va("cmd configstrings %i 0\n", svs.spawncount));
+		}
 	}
 }
 
@@ -181,6 +192,19 @@ _NumIndexSkips(int start, int end)
 	return i - start;
 }
 
+static int
+_NextConfigstring(int i, int opt)
+{
+	/* statusbar code is sent as one big string */
+	if ((opt & OPTIMIZE_HUDSEND) &&
+		(i >= CS_STATUSBAR) && (i < CS_STATUSBAR_END))
+	{
+		return i + 1 + _NumIndexSkips(i, CS_STATUSBAR_END);
+	}
+
+	return i + 1;
+}
+
 static void
 SV_AddBaselines(int start, qboolean allow_zero)
 {
@@ -288,16 +312,7 @@ SV_Configstrings_f(void)
 				P_ConvertConfigStringTo(i, sv_client->protocol), cs);
 		}
 
-		/* statusbar code is sent as one big string */
-		if ((opt & OPTIMIZE_HUDSEND) &&
-			(i >= CS_STATUSBAR) && (i < CS_STATUSBAR_END))
-		{
-			i += 1 + _NumIndexSkips(i, CS_STATUSBAR_END);
-		}
-		else
-		{
-			i++;
-		}
+		i = _NextConfigstring(i, opt);
 	}
 
 	if ((i == start) && (i < MAX_CONFIGSTRINGS))
@@ -305,16 +320,7 @@ SV_Configstrings_f(void)
 		Com_Printf("%s: skipping index %i: too big to send\n",
 			__func__, i);
 
-		/* statusbar code is sent as one big string */
-		if ((opt & OPTIMIZE_HUDSEND) &&
-			(i >= CS_STATUSBAR) && (i < CS_STATUSBAR_END))
-		{
-			i += 1 + _NumIndexSkips(i, CS_STATUSBAR_END);
-		}
-		else
-		{
-			i++;
-		}
+		i = _NextConfigstring(i, opt);
 	}
 
 	/* send next command */
@@ -368,6 +374,202 @@ SV_Baselines_f(void)
 	SV_AddBaselines(start, false);
 }
 
+/*
+ * Writes all configstrings and baselines into one message,
+ * exactly like the configstrings and baselines commands
+ * would send them, and deflates it. The last result is
+ * kept around, clients connecting in a row mostly get the
+ * same gamestate and compressing it is the expensive part.
+ */
+static qboolean
+SV_BuildGamestate(client_t *cl)
+{
+	static byte *raw_cache, *packed_cache;
+	static int raw_cachesize, packed_cachesize;
+	sizebuf_t raw;
+	size_t size;
+	mz_ulong packedsize;
+	int i, opt;
+	byte *buf;
+
+	opt = SV_Optimizations();
+
+	/* size it first, a sizebuf can't grow */
+	size = 0;
+
+	for (i = 0; i < MAX_CONFIGSTRINGS; i = _NextConfigstring(i, opt))
+	{
+		if (sv.configstrings[i][0] != '\0')
+		{
+			size += MSG_ConfigString_Size(sv.configstrings[i]);
+		}
+	}
+
+	for (i = 0; i < sv.numbaselines; i++)
+	{
+		const entity_xstate_t *base = &sv.baselines[i];
+
+		if (base->modelindex || base->sound || base->effects)
+		{
+			size += 1 + MSG_DeltaEntity_Size(NULL, base, true, true, cl->protocol);
+		}
+	}
+
+	buf = malloc(size + 1);
+	YQ2_COM_CHECK_OOM(buf, "malloc()", size + 1)
+
+	SZ_Init(&raw, buf, size + 1);
+
+	for (i = 0; i < MAX_CONFIGSTRINGS; i = _NextConfigstring(i, opt))
+	{
+		if (sv.configstrings[i][0] != '\0')
+		{
+			MSG_WriteByte(&raw, svc_configstring);
+			MSG_WriteConfigString(&raw,
+				P_ConvertConfigStringTo(i, cl->protocol), sv.configstrings[i]);
+		}
+	}
+
+	for (i = 0; i < sv.numbaselines; i++)
+	{
+		const entity_xstate_t *base = &sv.baselines[i];
+
+		if (base->modelindex || base->sound || base->effects)
+		{
+			MSG_WriteByte(&raw, svc_spawnbaseline);
+			MSG_WriteDeltaEntity(NULL, base, &raw, true, true, cl->protocol);
+		}
+	}
+
+	if ((raw.cursize != raw_cachesize) || memcmp(raw.data, raw_cache, raw.cursize))
+	{
+		byte *packed;
+
+		packedsize = compressBound(raw.cursize);
+		packed = malloc(packedsize);
+		YQ2_COM_CHECK_OOM(packed, "malloc()", packedsize)
+
+		if (compress2(packed, &packedsize, raw.data, raw.cursize,
+				Z_BEST_COMPRESSION) != Z_OK)
+		{
+			free(packed);
+			free(buf);
+			return false;
+		}
+
+		free(raw_cache);
+		free(packed_cache);
+		raw_cache = buf;
+		raw_cachesize = raw.cursize;
+		packed_cache = packed;
+		packed_cachesize = packedsize;
+
+		Com_DPrintf("%s: %i bytes deflated to %i\n", __func__,
+				raw_cachesize, packed_cachesize);
+	}
+	else
+	{
+		free(buf);
+	}
+
+	free(cl->gamestate);
+	cl->gamestate = malloc(packed_cachesize);
+	YQ2_COM_CHECK_OOM(cl->gamestate, "malloc()", packed_cachesize)
+
+	memcpy(cl->gamestate, packed_cache, packed_cachesize);
+	cl->gamestatesize = packed_cachesize;
+	cl->gamestaterawsize = raw_cachesize;
+
+	return true;
+}
+
+/*
+ * Sends the deflated gamestate, as much as fits into
+ * each reliable message. Replaces the configstrings and
+ * baselines commands for clients with PROTOCOL_EXT_GAMESTATE.
+ */
+static void
+SV_Gamestate_f(void)
+{
+	sizebuf_t *msg;
+	int offset, len;
+
+	offset = (Cmd_Argc() > 2) ? (int)strtol(Cmd_Argv(2), (char **)NULL, 10) : 0;
+
+	Com_DPrintf("Gamestate(%i) from %s\n", offset, sv_client->name);
+
+	if (sv_client->state != cs_connected)
+	{
+		Com_Printf("gamestate not valid -- already spawned\n");
+		return;
+	}
+
+	/* handle the case of a level changing while a client was connecting */
+	if ((Cmd_Argc() <= 1) ||
+		((int)strtol(Cmd_Argv(1), (char **)NULL, 10) != svs.spawncount))
+	{
+		Com_Printf("%s from different level\n", __func__);
+		SV_New_f();
+		return;
+	}
+
+	msg = &sv_client->netchan.message;
+
+	if (offset == 0)
+	{
+		if (!(sv_client->extensions & PROTOCOL_EXT_GAMESTATE) ||
+			!SV_BuildGamestate(sv_client))
+		{
+			/* fall back to the legacy way */
+			MSG_WriteByte(msg, svc_stufftext);
+			MSG_WriteString(msg,
+				va("cmd configstrings %i 0\n", svs.spawncount));
+			return;
+		}
+	}
+
+	if (!sv_client->gamestate ||
+		(offset < 0) || (offset >= sv_client->gamestatesize))
+	{
+		Com_Printf("%s: bad offset %i from %s\n", __func__, offset,
+				sv_client->name);
+		SV_New_f();
+		return;
+	}
+
+	/* the same limits as the legacy path, minus our header */
+	len = (SV_Optimizations() & OPTIMIZE_MSGUTIL) ? MAX_MSGLEN : MAX_MSGLEN / 2;
+	len -= CMD_MARGIN + SAFE_MARGIN + 15 + msg->cursize;
+	len = Q_max(Q_min(len, sv_client->gamestatesize - offset), 1);
+
+	MSG_WriteByte(msg, svc_gamestate);
+	MSG_WriteLong(msg, sv_client->gamestatesize);
+	MSG_WriteLong(msg, sv_client->gamestaterawsize);
+	MSG_WriteLong(msg, offset);
+	MSG_WriteShort(msg, len);
+	SZ_Write(msg, sv_client->gamestate + offset, len);
+
+	offset += len;
+
+	/* send next command */
+	MSG_WriteByte(msg, svc_stufftext);
+
+	if (offset < sv_client->gamestatesize)
+	{
+		MSG_WriteString(msg,
+			va("cmd gamestate %i %i\n", svs.spawncount, offset));
+	}
+	else
+	{
+		PrintOverflowConfigstrings();
+
+		free(sv_client->gamestate);
+		sv_client->gamestate = NULL;
+
+		MSG_WriteString(msg, va("precache %i\n", svs.spawncount));
+	}
+}
+
 static void
 SV_Begin_f(void)
 {
@@ -389,6 +591,168 @@ SV_Begin_f(void)
 	Cbuf_InsertFromDefer();
 }
 
+/*
+ * Files being downloaded are loaded once and shared by all
+ * clients downloading them, a map is often fetched by many
+ * clients at the same time. The copy is read only and goes
+ * away with the last client done with it.
+ */
+typedef struct dlfile_s
+{
+	char name[MAX_QPATH];
+	byte *data;
+	int size;
+	int refcount;
+	qboolean protectedpak;          /* file_from_protected_pak when loaded */
+	struct dlfile_s *next;
+} dlfile_t;
+
+static dlfile_t *dlfiles;
+
+static byte *
+SV_OpenDownload(const char *name, int *size, qboolean *protectedpak)
+{
+	extern qboolean file_from_protected_pak;
+	dlfile_t *f;
+	byte *data;
+	int len;
+
+	for (f = dlfiles; f; f = f->next)
+	{
+		if (!strcmp(f->name, name))
+		{
+			f->refcount++;
+			*size = f->size;
+			*protectedpak = f->protectedpak;
+			return f->data;
+		}
+	}
+
+	len = FS_LoadFile(name, (void **)&data);
+
+	if (!data)
+	{
+		*size = len;
+		*protectedpak = false;
+		return NULL;
+	}
+
+	f = Z_Malloc(sizeof(*f));
+	Q_strlcpy(f->name, name, sizeof(f->name));
+	f->data = data;
+	f->size = len;
+	f->refcount = 1;
+	f->protectedpak = file_from_protected_pak;
+	f->next = dlfiles;
+	dlfiles = f;
+
+	*size = f->size;
+	*protectedpak = f->protectedpak;
+	return f->data;
+}
+
+/*
+ * Lets go of the file the client is downloading, if any.
+ */
+void
+SV_CloseDownload(client_t *cl)
+{
+	dlfile_t *f, **prev;
+
+	cl->dlwindowed = false;
+
+	if (!cl->download)
+	{
+		return;
+	}
+
+	for (prev = &dlfiles; (f = *prev) != NULL; prev = &f->next)
+	{
+		if (f->data != cl->download)
+		{
+			continue;
+		}
+
+		if (--f->refcount == 0)
+		{
+			*prev = f->next;
+			FS_FreeFile(f->data);
+			Z_Free(f);
+		}
+
+		break;
+	}
+
+	cl->download = NULL;
+}
+
+/*
+ * Drops the shared copies of the files. Called on
+ * shutdown after all downloads were closed, the
+ * files may be different when the server is back.
+ */
+void
+SV_FlushDownloads(void)
+{
+	dlfile_t *f;
+
+	while (dlfiles)
+	{
+		f = dlfiles;
+		dlfiles = f->next;
+
+		FS_FreeFile(f->data);
+		Z_Free(f);
+	}
+}
+
+/*
+ * Handles a clc_downloadack. The client always sends all it
+ * has, the chunks it got in a row and a bit for each of the
+ * following ones it got. Stale acks are ignored.
+ */
+static void
+SV_DownloadAck(client_t *cl, int base, unsigned acked)
+{
+	int i;
+
+	if (!cl->dlwindowed ||
+		(base < cl->dlchunkbase) || (base > cl->dlnumchunks))
+	{
+		return;
+	}
+
+	if (base == cl->dlchunkbase)
+	{
+		cl->dlacked |= acked;
+		return;
+	}
+
+	/* measure the round trip with the first missing chunk */
+	if (cl->dlsent[cl->dlchunkbase % DOWNLOAD_WINDOW])
+	{
+		cl->dlrtt = (cl->dlrtt * 7 + svs.realtime -
+				cl->dlsent[cl->dlchunkbase % DOWNLOAD_WINDOW]) / 8;
+	}
+
+	/* the slots of the chunks leaving the window
+	   are taken by the ones entering it */
+	for (i = cl->dlchunkbase; (i < base) &&
+		 (i < cl->dlchunkbase + DOWNLOAD_WINDOW); i++)
+	{
+		cl->dlsent[i % DOWNLOAD_WINDOW] = 0;
+	}
+
+	cl->dlchunkbase = base;
+	cl->dlacked = acked;
+
+	if (base == cl->dlnumchunks)
+	{
+		Com_DPrintf("Windowed download to %s complete\n", cl->name);
+		SV_CloseDownload(cl);
+	}
+}
+
 static void
 SV_NextDownload_f(void)
 {
@@ -396,7 +760,7 @@ SV_NextDownload_f(void)
 	int percent;
 	int size;
 
-	if (!sv_client->download)
+	if (!sv_client->download || sv_client->dlwindowed)
 	{
 		return;
 	}
@@ -429,8 +793,7 @@ SV_NextDownload_f(void)
 		return;
 	}
 
-	FS_FreeFile(sv_client->download);
-	sv_client->download = NULL;
+	SV_CloseDownload(sv_client);
 }
 
 static void
@@ -442,7 +805,7 @@ SV_BeginDownload_f(void)
 	extern cvar_t *allow_download_models;
 	extern cvar_t *allow_download_sounds;
 	extern cvar_t *allow_download_maps;
-	extern qboolean file_from_protected_pak;
+	qboolean protectedpak;
 	int offset = 0;
 
 	name = Cmd_Argv(1);
@@ -480,12 +843,10 @@ SV_BeginDownload_f(void)
 		return;
 	}
 
-	if (sv_client->download)
-	{
-		FS_FreeFile(sv_client->download);
-	}
+	SV_CloseDownload(sv_client);
 
-	sv_client->downloadsize = FS_LoadFile(name, (void **)&sv_client->download);
+	sv_client->download = SV_OpenDownload(name, &sv_client->downloadsize,
+			&protectedpak);
 	sv_client->downloadcount = offset;
 
 	if (offset > sv_client->downloadsize)
@@ -493,15 +854,11 @@ SV_BeginDownload_f(void)
 		sv_client->downloadcount = sv_client->downloadsize;
 	}
 
-	if (!sv_client->download || ((strncmp(name, "maps/", 5) == 0) && file_from_protected_pak))
+	if (!sv_client->download || ((strncmp(name, "maps/", 5) == 0) && protectedpak))
 	{
 		Com_DPrintf("Couldn't download %s to %s\n", name, sv_client->name);
 
-		if (sv_client->download)
-		{
-			FS_FreeFile(sv_client->download);
-			sv_client->download = NULL;
-		}
+		SV_CloseDownload(sv_client);
 
 		MSG_WriteByte(&sv_client->netchan.message, svc_download);
 		MSG_WriteShort(&sv_client->netchan.message, -1);
@@ -509,7 +866,33 @@ SV_BeginDownload_f(void)
 		return;
 	}
 
-	SV_NextDownload_f();
+	if ((sv_client->extensions & PROTOCOL_EXT_DOWNLOAD) &&
+		(sv_download_rate->value > 0))
+	{
+		/* the chunks are sent by SV_SendDownloadChunks */
+		sv_client->dlwindowed = true;
+		sv_client->dlstart = sv_client->downloadcount;
+		sv_client->dlnumchunks = (sv_client->downloadsize - sv_client->dlstart +
+				DOWNLOAD_CHUNK - 1) / DOWNLOAD_CHUNK;
+		sv_client->dlchunkbase = 0;
+		sv_client->dlacked = 0;
+		sv_client->dlrtt = sv_client->ping;
+		memset(sv_client->dlsent, 0, sizeof(sv_client->dlsent));
+
+		MSG_WriteByte(&sv_client->netchan.message, svc_downloadwindow);
+		MSG_WriteLong(&sv_client->netchan.message, sv_client->downloadsize);
+		MSG_WriteLong(&sv_client->netchan.message, sv_client->dlstart);
+
+		if (!sv_client->dlnumchunks)
+		{
+			SV_CloseDownload(sv_client);
+		}
+	}
+	else
+	{
+		SV_NextDownload_f();
+	}
+
 	Com_DPrintf("Downloading %s to %s\n", name, sv_client->name);
 }
 
@@ -588,6 +971,7 @@ ucmd_t ucmds[] = {
 	{"new", SV_New_f},
 	{"configstrings", SV_Configstrings_f},
 	{"baselines", SV_Baselines_f},
+	{"gamestate", SV_Gamestate_f},
 	{"begin", SV_Begin_f},
 	{"nextserver", SV_Nextserver_f},
 	{"disconnect", SV_Disconnect_f},
@@ -656,6 +1040,8 @@ SV_ExecuteClientMessage(client_t *cl)
 	int checksumIndex;
 	qboolean move_issued;
 	int lastframe;
+	int dlbase;
+	unsigned dlacked;
 
 	sv_client = cl;
 	sv_player = CL_EDICT(sv_client);
@@ -786,6 +1172,12 @@ SV_ExecuteClientMessage(client_t *cl)
 				cl->lastcmd = newcmd;
 				break;
 
+			case clc_downloadack:
+				dlbase = MSG_ReadLong(&net_message);
+				dlacked = (unsigned)MSG_ReadLong(&net_message);
+				SV_DownloadAck(cl, dlbase, dlacked);
+				break;
+
 			case clc_stringcmd:
 				s = MSG_ReadString(&net_message);
 
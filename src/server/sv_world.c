@@ -169,6 +169,14 @@ SV_LinkEdict(edict_t *ent)
 		return;
 	}
 
+	/* clients have to be rebucketed for multicasts */
+	i = NUM_FOR_EDICT(ent);
+
+	if ((i > 0) && (i <= maxclients->value))
+	{
+		SV_ClientMoved(&svs.clients[i - 1]);
+	}
+
 	/* set the size */
 	VectorSubtract(ent->maxs, ent->mins, ent->size);
 